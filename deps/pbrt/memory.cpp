@@ -31,12 +31,93 @@
 
 // core/memory.cpp*
 #include "pbrt/memory.h"
+#include <atomic>
 #include <cstdlib>
+#include <map>
+#include <mutex>
+#if defined(PBRT_HAVE_MMAP)
+#include <sys/mman.h>
+#endif
 
 namespace spray {
 
+// Huge Page Definitions
+static int hugePageMode = HUGE_PAGES_OFF;
+static std::atomic<size_t> hugePageBytes(0);
+
+// hugetlbfs blocks are munmap()'d, so FreeAligned() has to tell them apart.
+static std::mutex hugetlbMutex;
+static std::map<void *, size_t> hugetlbBlocks;
+static std::atomic<int> numHugetlbBlocks(0);
+
+static size_t roundUpHugePage(size_t size) {
+  return (size + PBRT_HUGE_PAGE_SIZE - 1) & ~((size_t)PBRT_HUGE_PAGE_SIZE - 1);
+}
+
+static void *allocHugetlb(size_t size) {
+#if defined(PBRT_HAVE_MMAP) && defined(MAP_HUGETLB)
+  size_t bytes = roundUpHugePage(size);
+  void *ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (ptr == MAP_FAILED) return nullptr;
+  {
+    std::lock_guard<std::mutex> lock(hugetlbMutex);
+    hugetlbBlocks[ptr] = bytes;
+  }
+  ++numHugetlbBlocks;
+  hugePageBytes += bytes;
+  return ptr;
+#else
+  return nullptr;
+#endif
+}
+
+static void *allocTransparentHuge(size_t size) {
+#if defined(PBRT_HAVE_POSIX_MEMALIGN) && defined(MADV_HUGEPAGE)
+  size_t bytes = roundUpHugePage(size);
+  void *ptr;
+  if (posix_memalign(&ptr, PBRT_HUGE_PAGE_SIZE, bytes) != 0) return nullptr;
+  // Advisory only. If THP is disabled the block keeps its 4 KB pages.
+  if (madvise(ptr, bytes, MADV_HUGEPAGE) == 0) hugePageBytes += bytes;
+  return ptr;
+#else
+  return nullptr;
+#endif
+}
+
+static bool freeHugetlb(void *ptr) {
+#if defined(PBRT_HAVE_MMAP)
+  if (numHugetlbBlocks == 0) return false;
+  size_t bytes;
+  {
+    std::lock_guard<std::mutex> lock(hugetlbMutex);
+    auto it = hugetlbBlocks.find(ptr);
+    if (it == hugetlbBlocks.end()) return false;
+    bytes = it->second;
+    hugetlbBlocks.erase(it);
+  }
+  --numHugetlbBlocks;
+  munmap(ptr, bytes);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void setHugePageMode(int mode) { hugePageMode = mode; }
+
+int getHugePageMode() { return hugePageMode; }
+
+size_t getHugePageBytes() { return hugePageBytes; }
+
 // Memory Allocation Functions
 void *allocAligned(size_t size) {
+  if (hugePageMode != HUGE_PAGES_OFF && size >= PBRT_HUGE_PAGE_SIZE) {
+    void *ptr = nullptr;
+    if (hugePageMode == HUGE_PAGES_HUGETLB) ptr = allocHugetlb(size);
+    if (!ptr) ptr = allocTransparentHuge(size);
+    if (ptr) return ptr;
+  }
 #if defined(PBRT_HAVE__ALIGNED_MALLOC)
   return _aligned_malloc(size, PBRT_L1_CACHE_LINE_SIZE);
 #elif defined(PBRT_HAVE_POSIX_MEMALIGN)
@@ -50,6 +131,7 @@ void *allocAligned(size_t size) {
 
 void FreeAligned(void *ptr) {
   if (!ptr) return;
+  if (freeHugetlb(ptr)) return;
 #if defined(PBRT_HAVE__ALIGNED_MALLOC)
   _aligned_free(ptr);
 #else
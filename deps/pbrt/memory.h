@@ -57,6 +57,22 @@ namespace spray {
 void *allocAligned(size_t size);
 void FreeAligned(void *);
 
+// Huge Page Declarations
+#define PBRT_HUGE_PAGE_SIZE 2097152
+
+// Backends for allocations of at least PBRT_HUGE_PAGE_SIZE bytes.
+// HUGE_PAGES_THP: 2 MB aligned and madvise(MADV_HUGEPAGE)'d.
+// HUGE_PAGES_HUGETLB: mmap(MAP_HUGETLB) from the hugetlbfs pool, falling back
+// to HUGE_PAGES_THP when the pool is exhausted.
+enum HugePageMode { HUGE_PAGES_OFF = 0, HUGE_PAGES_THP, HUGE_PAGES_HUGETLB };
+
+// Must be called before any thread allocates.
+void setHugePageMode(int mode);
+int getHugePageMode();
+
+// Total bytes handed out with huge page backing so far.
+size_t getHugePageBytes();
+
 template <typename T>
 T *AllocAligned(size_t count) {
   T *buf = (T *)allocAligned(count * sizeof(T));
@@ -115,7 +131,11 @@ class
         }
       }
       if (!currentBlock) {
-        currentAllocSize = std::max(nBytes, blockSize);
+        // Grow blocks to a huge page so that they take the huge page path.
+        size_t minSize = blockSize;
+        if (getHugePageMode() != HUGE_PAGES_OFF)
+          minSize = std::max(minSize, (size_t)PBRT_HUGE_PAGE_SIZE);
+        currentAllocSize = std::max(nBytes, minSize);
         currentBlock = AllocAligned<uint8_t>(currentAllocSize);
       }
       currentBlockPos = 0;
@@ -30,7 +30,8 @@
 #include "utils/comm.h"
 
 int main(int argc, char** argv) {
-  int required = MPI_THREAD_FUNNELED;
+  // serialized for the optional progress thread (--comm-thread)
+  int required = MPI_THREAD_SERIALIZED;
   int provided;
   MPI_Init_thread(&argc, &argv, required, &provided);
 
@@ -42,7 +43,8 @@ int main(int argc, char** argv) {
   google::InstallFailureSignalHandler();
 #endif
 
-  CHECK_EQ(provided, required) << "MPI_THREAD_FUNNELED not available.";
+  CHECK_GE(provided, MPI_THREAD_FUNNELED)
+      << "MPI_THREAD_FUNNELED not available.";
 
 #ifdef SPRAY_GLOG_CHECK
   LOG(INFO) << "rank " << spray::mpi::worldRank()
@@ -82,6 +84,9 @@ int main(int argc, char** argv) {
     } else {
       LOG(FATAL) << "not allowed to set cache size in in-situ mode";
     }
+  } else if (cfg.partition == spray::Config::HYBRID) {
+    // threads load domains concurrently, which the lru cache does not allow
+    LOG(FATAL) << "hybrid partition unsupported, use spray_insitu_singlethread";
   } else {
     LOG(FATAL) << "unsupported partition " << cfg.partition;
   }
@@ -66,6 +66,18 @@ int main(int argc, char** argv) {
   typedef spray::insitu::SingleThreadTracer<ShaderPtT> TracerPtT;
   typedef spray::SprayRenderer<TracerPtT> RenderPtT;
 
+  // hybrid: owned domains plus an lru cache of remote domains
+  typedef spray::LruCache LruCacheT;
+  typedef spray::Scene<LruCacheT> SceneLruT;
+
+  typedef spray::insitu::ShaderAo<SceneLruT> ShaderAoLruT;
+  typedef spray::insitu::SingleThreadTracer<ShaderAoLruT> TracerAoLruT;
+  typedef spray::SprayRenderer<TracerAoLruT> RenderAoLruT;
+
+  typedef spray::insitu::ShaderPt<SceneLruT> ShaderPtLruT;
+  typedef spray::insitu::SingleThreadTracer<ShaderPtLruT> TracerPtLruT;
+  typedef spray::SprayRenderer<TracerPtLruT> RenderPtLruT;
+
   spray::Config cfg;
   cfg.parse(argc, argv);
 
@@ -83,6 +95,19 @@ int main(int argc, char** argv) {
     } else {
       LOG(FATAL) << "not allowed to set cache size in in-situ mode";
     }
+  } else if (cfg.partition == spray::Config::HYBRID) {
+    CHECK_GT(cfg.cache_size, 0) << "cache size for remote domains required";
+    CHECK(cfg.repartition == 0.f && cfg.replicas == 0)
+        << "repartitioning and replicas unsupported in hybrid mode";
+    if (cfg.ao_mode) {
+      RenderAoLruT render;
+      render.init(cfg);
+      render.run();
+    } else {
+      RenderPtLruT render;
+      render.init(cfg);
+      render.run();
+    }
   } else {
     LOG(FATAL) << "unsupported partition " << cfg.partition;
   }
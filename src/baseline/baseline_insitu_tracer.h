@@ -43,6 +43,7 @@
 #include "baseline/baseline_schedulers.h"
 #include "baseline/baseline_tilers.h"
 #include "display/image.h"
+#include "render/adaptive_sampler.h"
 #include "render/arena_queue.h"
 #include "render/block_buffer.h"
 #include "render/camera.h"
@@ -75,6 +76,10 @@ class InsituTracer {
   void init(const Config &cfg, const Camera &camera, SceneType *scene,
             HdrImage *image);
 
+  void setAdaptiveSampler(const AdaptiveSampler *sampler) {
+    CHECK(sampler == nullptr) << "adaptive sampling unsupported";
+  }
+
   void trace();
   void traceInOmp() {
     std::cout << "[warning] tracing in omp parallel region unsupported\n";
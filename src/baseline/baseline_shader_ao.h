@@ -81,7 +81,7 @@ class ShaderAo {
 
     for (int i = 0; i < samples_; ++i) {
       RandomSampler_init(sampler, rayin.pixid * (i + 1));
-      bsdf->sampleRandom(normal_ff, &sampler, &wi, &pdf);
+      bsdf->sampleRandom(normal_ff, RandomSampler_get2D(sampler), &wi, &pdf);
 
       costheta = glm::clamp(glm::dot(normal_ff, wi), 0.f, 1.f);
       Lr = surf_radiance * (SPRAY_ONE_OVER_PI * costheta * ao_weight / pdf);
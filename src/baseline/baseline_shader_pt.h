@@ -28,7 +28,10 @@
 #include "baseline/baseline_ray.h"
 #include "render/arena_queue.h"
 #include "render/light.h"
+#include "render/light_sampler.h"
+#include "render/path_sampler.h"
 #include "render/reflection.h"
+#include "render/roulette.h"
 #include "render/scene.h"
 #include "utils/math.h"
 #include "utils/util.h"
@@ -42,12 +45,20 @@ class ShaderPt {
   typedef SceneT SceneType;
 
   void init(const spray::Config &cfg, const SceneT *scene) {
+    sampler_type_ = cfg.sampler;
+    num_pixel_samples_ = cfg.pixel_samples;
     bounces_ = cfg.bounces;
     samples_ = cfg.ao_samples;
     scene_ = scene;
     lights_ = scene->getLights();  // copy lights
     ks_ = cfg.ks;
     shininess_ = cfg.shininess;
+    light_selection_ = cfg.light_selection;
+    num_sampled_lights_ = cfg.sampled_lights;
+    rr_depth_ = cfg.rr_depth;
+    if (light_selection_ == spray::Config::LIGHT_SELECTION_POWER) {
+      light_sampler_.init(lights_);
+    }
   }
 
   bool isAo() { return false; }
@@ -87,29 +98,85 @@ class ShaderPt {
     bool delta_dist = bsdf->isDelta();
 
     int next_ray_depth = rayin.depth + 1;
-    spray::RandomSampler light_sampler;
-    spray::RandomSampler_init(light_sampler, rayin.samid * next_ray_depth);
+    PathSampler light_sampler;
+    initSampler(rayin, next_ray_depth, SAMPLER_STREAM_LIGHT, &light_sampler);
 
     if (!delta_dist) {
-      for (std::size_t l = 0; l < lights_.size(); ++l) {
-        if (lights_[l]->isAreaLight()) {
-          for (int s = 0; s < samples_; ++s) {
+      if (light_selection_ == spray::Config::LIGHT_SELECTION_POWER) {
+        for (int k = 0; k < num_sampled_lights_; ++k) {
+          float pmf;
+          int l = light_sampler_.sample(light_sampler.get1D(), &pmf);
+          float scale = 1.0f / (pmf * num_sampled_lights_);
+
+          glm::vec2 u = light_sampler.get2D();
+          if (spray::sampleDirect(*lights_[l], u, pos, normal_ff, wo,
+                                  surf_radiance, ks_, shininess_, Lin, scale,
+                                  &wi, &Lr)) {
+            if (!scene_->occluded(pos, wi, rtc_ray)) {
+              DRay *dray = arena->Alloc<DRay>(1, false);
+              DRayUtil::makeShadowRay(rayin, pos, wi, Lr, t_hit, dray);
+
+              domain_isector->intersect(id, dray, sqs);
+#ifdef SPRAY_GLOG_CHECK
+              CHECK(sqs->empty(id));
+#endif
+              // no more domain
+              if (!DRayUtil::hasCurrentDomain(dray)) {
+                retire_buf->commit(dray->pixid, Lr);
+              }
+            }
+          }
+        }
+      } else {
+        for (std::size_t l = 0; l < lights_.size(); ++l) {
+          if (lights_[l]->isAreaLight()) {
+            for (int s = 0; s < samples_; ++s) {
+              // sample() returns normalized direction
+              glm::vec2 u = light_sampler.get2D();
+              light_radiance = lights_[l]->sampleArea(u, normal_ff, &wi, &pdf);
+              if (pdf > 0.0f) {
+                // evaluate direct lighting
+                costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
+                Lr = Lin *
+                     blinnPhong(costheta, surf_radiance, ks_, shininess_,
+                                light_radiance, wi, normal_ff, wo) *
+                     (1.0f / (pdf * samples_));
+
+                if (hasPositive(Lr)) {
+                  // intersect domains
+                  if (!scene_->occluded(pos, wi, rtc_ray)) {  // occluded
+                    DRay *dray = arena->Alloc<DRay>(1, false);
+                    DRayUtil::makeShadowRay(rayin, pos, wi, Lr, t_hit, dray);
+
+                    domain_isector->intersect(id, dray, sqs);
+#ifdef SPRAY_GLOG_CHECK
+                    CHECK(sqs->empty(id));
+#endif
+                    // no more domain
+                    if (!DRayUtil::hasCurrentDomain(dray)) {
+                      retire_buf->commit(dray->pixid, Lr);
+                    }
+                  }
+                }
+              }
+            }
+          } else {  // point light
             // sample() returns normalized direction
-            light_radiance =
-                lights_[l]->sampleArea(light_sampler, normal_ff, &wi, &pdf);
+            light_radiance = lights_[l]->sample(pos, &wi, &pdf);
             if (pdf > 0.0f) {
               // evaluate direct lighting
               costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
               Lr = Lin *
                    blinnPhong(costheta, surf_radiance, ks_, shininess_,
                               light_radiance, wi, normal_ff, wo) *
-                   (1.0f / (pdf * samples_));
+                   (1.0f / pdf);
 
               if (hasPositive(Lr)) {
                 // intersect domains
                 if (!scene_->occluded(pos, wi, rtc_ray)) {  // occluded
                   DRay *dray = arena->Alloc<DRay>(1, false);
                   DRayUtil::makeShadowRay(rayin, pos, wi, Lr, t_hit, dray);
+                  // LOG(FATAL) << "[shadow ray]" << *dray;
 
                   domain_isector->intersect(id, dray, sqs);
 #ifdef SPRAY_GLOG_CHECK
@@ -123,35 +190,6 @@ class ShaderPt {
               }
             }
           }
-        } else {  // point light
-          // sample() returns normalized direction
-          light_radiance = lights_[l]->sample(pos, &wi, &pdf);
-          if (pdf > 0.0f) {
-            // evaluate direct lighting
-            costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
-            Lr = Lin *
-                 blinnPhong(costheta, surf_radiance, ks_, shininess_,
-                            light_radiance, wi, normal_ff, wo) *
-                 (1.0f / pdf);
-
-            if (hasPositive(Lr)) {
-              // intersect domains
-              if (!scene_->occluded(pos, wi, rtc_ray)) {  // occluded
-                DRay *dray = arena->Alloc<DRay>(1, false);
-                DRayUtil::makeShadowRay(rayin, pos, wi, Lr, t_hit, dray);
-                // LOG(FATAL) << "[shadow ray]" << *dray;
-
-                domain_isector->intersect(id, dray, sqs);
-#ifdef SPRAY_GLOG_CHECK
-                CHECK(sqs->empty(id));
-#endif
-                // no more domain
-                if (!DRayUtil::hasCurrentDomain(dray)) {
-                  retire_buf->commit(dray->pixid, Lr);
-                }
-              }
-            }
-          }
         }
       }
     }
@@ -191,10 +229,10 @@ class ShaderPt {
           }
         }
       } else {
-        spray::RandomSampler sampler;
-        spray::RandomSampler_init(sampler, rayin.samid * next_ray_depth);
-        //
-        bsdf->sampleRandom(normal_ff, &sampler, &wi, &pdf);
+        PathSampler sampler;
+        initSampler(rayin, next_ray_depth, SAMPLER_STREAM_BSDF, &sampler);
+
+        bsdf->sampleRandom(normal_ff, sampler.get2D(), &wi, &pdf);
         costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
         Lr = Lin * surf_radiance * SPRAY_ONE_OVER_PI * costheta / pdf;
         if (hasPositive(Lr))
@@ -204,21 +242,40 @@ class ShaderPt {
   }
 
  private:
+  //! Seeds a sampler for a stream of the vertex at the given depth.
+  void initSampler(const DRay &rayin, int depth, int stream,
+                   PathSampler *sampler) const {
+    sampler->init(sampler_type_, rayin.pixid, rayin.samid % num_pixel_samples_,
+                  pathSamplerStream(depth, stream));
+  }
+
   void genRadianceRay(int depth, const DRay &rin, const glm::vec3 &org,
                       const glm::vec3 &dir, const glm::vec3 &w,
                       spray::MemoryArena *arena, DRayQ *temp_q) {
+    PathSampler sampler;
+    initSampler(rin, depth, SAMPLER_STREAM_ROULETTE, &sampler);
+
+    glm::vec3 weight = w;
+    if (!russianRoulette(&sampler, depth, rr_depth_, &weight)) return;
+
     DRay *r = arena->Alloc<DRay>(1, false);
-    DRayUtil::makeRadianceRay(depth, rin, org, dir, w, r);
+    DRayUtil::makeRadianceRay(depth, rin, org, dir, weight, r);
     temp_q->push(r);
   }
 
  private:
   const SceneT *scene_;
   std::vector<Light *> lights_;  // copied lights
+  int sampler_type_;             // PathSampler::Type
+  int num_pixel_samples_;
   int bounces_;
   int samples_;
   glm::vec3 ks_;
   float shininess_;
+  int light_selection_;
+  int num_sampled_lights_;
+  int rr_depth_;
+  spray::LightSampler light_sampler_;
 };
 
 }  // namespace baseline
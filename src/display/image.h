@@ -180,6 +180,19 @@ struct HdrImage {
 #endif
   }
 
+  //! Sums the image over all ranks and leaves the result on every rank.
+  void compositeAll() {
+    int count = (w * h) << 2;
+#ifdef SPRAY_TIMING
+    tStartMPI(TIMER_SYNC_IMAGE);
+#endif
+    MPI_Allreduce(MPI_IN_PLACE, buf, count, MPI_FLOAT, MPI_SUM,
+                  MPI_COMM_WORLD);
+#ifdef SPRAY_TIMING
+    tStop(TIMER_SYNC_IMAGE);
+#endif
+  }
+
   void writePpm(const char* filename) {
     std::stringstream header;
     header << "P3" << std::endl;
@@ -21,14 +21,17 @@
 #pragma once
 
 #include <mpi.h>
+#include <condition_variable>
 #include <cstdint>
-#include <list>
+#include <mutex>
 #include <queue>
+#include <thread>
 #include <vector>
 
 #include "glog/logging.h"
 #include "pbrt/memory.h"
 
+#include "insitu/insitu_msg_pool.h"
 #include "insitu/insitu_work.h"
 #include "insitu/insitu_work_stats.h"
 #include "utils/comm.h"
@@ -51,19 +54,12 @@ class DefaultReceiver {
 
  public:
   DefaultReceiver() {}
-  DefaultReceiver(MessageQ* radiance_q, MessageQ* shadow_q)
-      : rq_(radiance_q), sq_(shadow_q) {}
-  void set(MessageQ* radiance_q, MessageQ* shadow_q) {
-    rq_ = radiance_q;
-    sq_ = shadow_q;
-  }
+  DefaultReceiver(MessageQ* q) : q_(q) {}
+  void set(MessageQ* q) { q_ = q; }
 
   void operator()(int tag, msg_word_t* msg) {
-    if (tag == Work::SEND_RADIANCE_RAYS) {
-      rq_->push(msg);
-
-    } else if (tag == Work::SEND_SHADOW_RAYS) {
-      sq_->push(msg);
+    if (tag == Work::SEND_RAYS) {
+      q_->push(msg);
 
     } else {
       LOG(FATAL) << "unknown mpi tag : " << tag;
@@ -71,8 +67,7 @@ class DefaultReceiver {
   }
 
  private:
-  MessageQ* rq_;
-  MessageQ* sq_;
+  MessageQ* q_;
 };
 
 template <typename ReceiverT>
@@ -81,23 +76,76 @@ class Comm {
   typedef std::queue<SendQItem*> SendQ;
 
  public:
-  void init();
-  void run(const WorkStats& work_stats, MemoryArena* mem, ReceiverT* receiver);
+  Comm() : progress_state_(PROGRESS_OFF) {}
+  ~Comm() { stopProgressThread(); }
+
+  void init(int nranks);
+  void run(const WorkStats& work_stats, ReceiverT* receiver);
+
+  /**
+   * Rewinds the send buffers of the round before the previous one, whose
+   * sends waitForSend() has completed. Called once per round before
+   * allocating send messages from getSendPool().
+   */
+  void beginSendRound() { send_pool_.beginRound(); }
+  MsgPool* getSendPool() { return &send_pool_; }
+
+  //! Returns and clears the buffer reuse counts of both pools.
+  void takeBufferStats(uint64_t* num_reused, uint64_t* num_allocated);
+
+  /**
+   * Starts a progress thread that runs exchange rounds in the background
+   * (see runAsync()). The calling thread must not make MPI calls while a
+   * round is in flight, so MPI_THREAD_SERIALIZED is sufficient.
+   */
+  void startProgressThread();
+  void stopProgressThread();
+
+  /**
+   * Runs waitForSend() and run() on the progress thread and returns
+   * immediately. receiver must not be used by other threads until wait()
+   * returns.
+   */
+  void runAsync(const WorkStats& work_stats, ReceiverT* receiver);
+
+  //! Waits for the round started by runAsync().
+  void wait();
 
   bool emptySendQ() const { return send_q_.empty(); }
   void pushSendQ(SendQItem* item) { send_q_.push(item); }
 
  private:
   void mpiIsendWords(SendQItem* item);
-  void serveRecv(const MPI_Status& status, MemoryArena* mem,
-                 ReceiverT* receiver);
+  void serveRecv(const MPI_Status& status, ReceiverT* receiver);
 
  public:
   void waitForSend();
 
  private:
-  std::list<MPI_Request> mpi_requests_;
+  std::vector<MPI_Request> mpi_requests_;
   SendQ send_q_;
+
+  MsgPool send_pool_;  // two rounds in flight: see beginSendRound()
+  MsgPool recv_pool_;  // consumed within the round
+
+ private:
+  void progressLoop();
+
+  enum ProgressState {
+    PROGRESS_OFF,
+    PROGRESS_IDLE,
+    PROGRESS_RUN,
+    PROGRESS_EXIT
+  };
+
+  std::thread progress_thread_;
+  std::mutex progress_mutex_;
+  std::condition_variable progress_cv_;
+  int progress_state_;
+
+  // arguments of the round in flight
+  const WorkStats* async_work_stats_;
+  ReceiverT* async_receiver_;
 };
 
 }  // namespace insitu
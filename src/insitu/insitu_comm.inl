@@ -25,6 +25,21 @@
 namespace spray {
 namespace insitu {
 
+template <typename ReceiverT>
+void Comm<ReceiverT>::init(int nranks) {
+  send_pool_.resize(nranks, 2);
+  recv_pool_.resize(nranks, 1);
+}
+
+template <typename ReceiverT>
+void Comm<ReceiverT>::takeBufferStats(uint64_t* num_reused,
+                                      uint64_t* num_allocated) {
+  *num_reused = send_pool_.getNumReused() + recv_pool_.getNumReused();
+  *num_allocated = send_pool_.getNumAllocated() + recv_pool_.getNumAllocated();
+  send_pool_.resetStats();
+  recv_pool_.resetStats();
+}
+
 template <typename ReceiverT>
 void Comm<ReceiverT>::mpiIsendWords(SendQItem* item) {
   mpi_requests_.push_back(MPI_Request());
@@ -33,14 +48,13 @@ void Comm<ReceiverT>::mpiIsendWords(SendQItem* item) {
 }
 
 template <typename ReceiverT>
-void Comm<ReceiverT>::serveRecv(const MPI_Status& status, MemoryArena* mem,
+void Comm<ReceiverT>::serveRecv(const MPI_Status& status,
                                 ReceiverT* receiver) {
   int tag = status.MPI_TAG;
   int msg_count;
   MPI_Get_count(&status, MPI_WORD_T, &msg_count);
 
-  msg_word_t* msg = mem->Alloc<msg_word_t>(msg_count);
-  CHECK_NOTNULL(msg);
+  msg_word_t* msg = recv_pool_.get(status.MPI_SOURCE, msg_count);
 
   MPI_Recv(msg, msg_count, MPI_WORD_T, status.MPI_SOURCE, status.MPI_TAG,
            MPI_COMM_WORLD, MPI_STATUS_IGNORE);
@@ -49,11 +63,13 @@ void Comm<ReceiverT>::serveRecv(const MPI_Status& status, MemoryArena* mem,
 }
 
 template <typename ReceiverT>
-void Comm<ReceiverT>::run(const WorkStats& work_stats, MemoryArena* mem,
-                          ReceiverT* receiver) {
+void Comm<ReceiverT>::run(const WorkStats& work_stats, ReceiverT* receiver) {
   MPI_Status status;
   int flag;
 
+  // the messages of the previous round have been consumed
+  recv_pool_.beginRound();
+
   int num_blocks_recved = 0;
   bool recv_done = work_stats.recvDone(num_blocks_recved);
 
@@ -67,7 +83,7 @@ void Comm<ReceiverT>::run(const WorkStats& work_stats, MemoryArena* mem,
     CHECK(!(recv_done && flag));
 #endif
     if (!recv_done && flag) {
-      serveRecv(status, mem, receiver);
+      serveRecv(status, receiver);
       ++num_blocks_recved;
       recv_done = work_stats.recvDone(num_blocks_recved);
     }
@@ -78,8 +94,7 @@ void Comm<ReceiverT>::run(const WorkStats& work_stats, MemoryArena* mem,
 
       int t = item->getType();
 #ifdef SPRAY_GLOG_CHECK
-      CHECK((t == Work::SEND_SHADOW_RAYS) || (t == Work::SEND_RADIANCE_RAYS))
-          << t;
+      CHECK_EQ(t, Work::SEND_RAYS);
 #endif
       mpiIsendWords(item);
     } else if (recv_done) {
@@ -93,13 +108,71 @@ void Comm<ReceiverT>::run(const WorkStats& work_stats, MemoryArena* mem,
 
 template <typename ReceiverT>
 void Comm<ReceiverT>::waitForSend() {
-  for (std::list<MPI_Request>::iterator it = mpi_requests_.begin();
-       it != mpi_requests_.end(); ++it) {
-    MPI_Wait(&(*it), MPI_STATUS_IGNORE);
+  if (!mpi_requests_.empty()) {
+    MPI_Waitall(mpi_requests_.size(), &mpi_requests_[0], MPI_STATUSES_IGNORE);
   }
   mpi_requests_.clear();
 }
 
+template <typename ReceiverT>
+void Comm<ReceiverT>::startProgressThread() {
+  if (progress_state_ != PROGRESS_OFF) return;
+  progress_state_ = PROGRESS_IDLE;
+  progress_thread_ = std::thread(&Comm<ReceiverT>::progressLoop, this);
+}
+
+template <typename ReceiverT>
+void Comm<ReceiverT>::stopProgressThread() {
+  if (progress_state_ == PROGRESS_OFF) return;
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(progress_mutex_);
+    progress_state_ = PROGRESS_EXIT;
+  }
+  progress_cv_.notify_all();
+  progress_thread_.join();
+  progress_state_ = PROGRESS_OFF;
+}
+
+template <typename ReceiverT>
+void Comm<ReceiverT>::runAsync(const WorkStats& work_stats,
+                               ReceiverT* receiver) {
+  {
+    std::lock_guard<std::mutex> lock(progress_mutex_);
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_EQ(progress_state_, PROGRESS_IDLE);
+#endif
+    async_work_stats_ = &work_stats;
+    async_receiver_ = receiver;
+    progress_state_ = PROGRESS_RUN;
+  }
+  progress_cv_.notify_all();
+}
+
+template <typename ReceiverT>
+void Comm<ReceiverT>::wait() {
+  std::unique_lock<std::mutex> lock(progress_mutex_);
+  progress_cv_.wait(lock, [this] { return progress_state_ != PROGRESS_RUN; });
+}
+
+template <typename ReceiverT>
+void Comm<ReceiverT>::progressLoop() {
+  std::unique_lock<std::mutex> lock(progress_mutex_);
+  while (1) {
+    progress_cv_.wait(lock,
+                      [this] { return progress_state_ != PROGRESS_IDLE; });
+    if (progress_state_ == PROGRESS_EXIT) break;
+
+    lock.unlock();
+    waitForSend();
+    run(*async_work_stats_, async_receiver_);
+    lock.lock();
+
+    progress_state_ = PROGRESS_IDLE;
+    progress_cv_.notify_all();
+  }
+}
+
 }  // namespace insitu
 }  // namespace spray
 
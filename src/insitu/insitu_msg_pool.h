@@ -0,0 +1,151 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "glog/logging.h"
+#include "pbrt/memory.h"
+
+#include "utils/comm.h"
+
+namespace spray {
+namespace insitu {
+
+/**
+ * Message buffers reused across exchange rounds and frames.
+ *
+ * Each peer owns a ring of generations, each of which holds the buffers
+ * handed out for that peer in one round. beginRound() advances the ring and
+ * rewinds the next generation, so a buffer is reused num_generations rounds
+ * after it was handed out. Buffers only grow, so that steady-state rounds
+ * allocate nothing and keep their addresses (and the interconnect's memory
+ * registrations) stable.
+ */
+class MsgPool {
+  struct Buffer {
+    msg_word_t* words;
+    std::size_t capacity;  // in words
+  };
+
+  struct Generation {
+    std::vector<std::vector<Buffer>> buffers;  // per-peer
+    std::vector<std::size_t> num_used;         // per-peer
+  };
+
+ public:
+  MsgPool() : gen_(0), num_reused_(0), num_allocated_(0) {}
+  ~MsgPool() { release(); }
+
+  MsgPool(const MsgPool&) = delete;
+  MsgPool& operator=(const MsgPool&) = delete;
+
+  /**
+   * Sets up the ring.
+   *
+   * \param nranks Number of peers.
+   * \param num_generations Number of rounds a buffer stays in use, e.g. 2
+   * for send buffers that are waited for in the following round.
+   */
+  void resize(int nranks, int num_generations) {
+    release();
+    gens_.resize(num_generations);
+    for (auto& g : gens_) {
+      g.buffers.resize(nranks);
+      g.num_used.resize(nranks, 0);
+    }
+    gen_ = 0;
+  }
+
+  void beginRound() {
+    gen_ = (gen_ + 1) % gens_.size();
+    auto& used = gens_[gen_].num_used;
+    for (auto& n : used) n = 0;
+  }
+
+  //! Returns a buffer of at least word_count words for the current round.
+  msg_word_t* get(int peer, std::size_t word_count) {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(peer, gens_[gen_].buffers.size());
+#endif
+    auto& buffers = gens_[gen_].buffers[peer];
+    std::size_t& n = gens_[gen_].num_used[peer];
+
+    if (n == buffers.size()) {
+      buffers.push_back({nullptr, 0});
+    }
+
+    Buffer& b = buffers[n++];
+    if (b.capacity < word_count) {
+      FreeAligned(b.words);
+      // grow geometrically so that slowly growing rounds settle quickly
+      b.capacity = std::max(word_count, b.capacity + (b.capacity >> 1));
+      b.words = AllocAligned<msg_word_t>(b.capacity);
+      CHECK_NOTNULL(b.words);
+      ++num_allocated_;
+    } else {
+      ++num_reused_;
+    }
+    return b.words;
+  }
+
+  //! Number of get() calls served by an existing buffer.
+  uint64_t getNumReused() const { return num_reused_; }
+  //! Number of get() calls that allocated or grew a buffer.
+  uint64_t getNumAllocated() const { return num_allocated_; }
+
+  void resetStats() {
+    num_reused_ = 0;
+    num_allocated_ = 0;
+  }
+
+  std::size_t getBytes() const {
+    std::size_t words = 0;
+    for (const auto& g : gens_) {
+      for (const auto& buffers : g.buffers) {
+        for (const auto& b : buffers) words += b.capacity;
+      }
+    }
+    return words * sizeof(msg_word_t);
+  }
+
+ private:
+  void release() {
+    for (auto& g : gens_) {
+      for (auto& buffers : g.buffers) {
+        for (auto& b : buffers) FreeAligned(b.words);
+        buffers.clear();
+      }
+    }
+  }
+
+ private:
+  std::vector<Generation> gens_;
+  std::size_t gen_;
+
+  uint64_t num_reused_;
+  uint64_t num_allocated_;
+};
+
+}  // namespace insitu
+}  // namespace spray
@@ -37,10 +37,12 @@
 #include "insitu/insitu_comm.h"
 #include "insitu/insitu_isector.h"
 #include "insitu/insitu_ray.h"
+#include "insitu/insitu_ray_codec.h"
 #include "insitu/insitu_tcontext.h"
 #include "insitu/insitu_vbuf.h"
 #include "insitu/insitu_work.h"
 #include "insitu/insitu_work_stats.h"
+#include "render/adaptive_sampler.h"
 #include "render/camera.h"
 #include "render/config.h"
 #include "render/data_partition.h"
@@ -50,9 +52,10 @@
 #include "render/reflection.h"
 #include "render/spray.h"
 #include "render/tile.h"
+#include "utils/barrier.h"
 #include "utils/comm.h"
+#include "utils/numa.h"
 #include "utils/profiler_util.h"
-#include "utils/scan.h"
 
 namespace spray {
 namespace insitu {
@@ -75,6 +78,11 @@ class MultiThreadTracer {
   void init(const Config &cfg, const Camera &camera, SceneType *scene,
             HdrImage *image);
 
+  //! Traces only the active pixels of the sampler from now on.
+  void setAdaptiveSampler(const AdaptiveSampler *sampler) {
+    adaptive_ = sampler;
+  }
+
  private:
   typedef TContext<ShaderT> TContextType;
 
@@ -93,8 +101,12 @@ class MultiThreadTracer {
 
  private:
   void sendRays(int tid, TContextType *tcontext);
-  void send(bool shadow, int tid, int domain_id, int dest, std::size_t num_rays,
-            TContextType *tcontext);
+  void allocSendItems(spray::MemoryArena *mem);
+  void pushSendItems();
+  void runComm(spray::MemoryArena *mem);
+  void startComm();
+  void finishComm(spray::MemoryArena *mem);
+  void collectRecvMsgs(spray::MemoryArena *mem);
   // void procLocalQs(int tid, int ray_depth, TContextType *tcontext);
   // void procRecvQs(int ray_depth, TContextType *tcontext);
   // void procRecvRads(int ray_depth, int id, Ray *rays, int64_t count,
@@ -104,16 +116,14 @@ class MultiThreadTracer {
 
   // void procCachedRq(int ray_depth, TContextType *tcontext);
 
-  void populateRadWorkStats(TContextType *tcontext);
-  void populateWorkStats(TContextType *tcontext);
+  void populateRadWorkStats(int tid, TContextType *tcontext);
+  void populateWorkStats(int tid, TContextType *tcontext);
+
+  void createTileWork(int tid, TContextType *tcontext);
 
-  void createTileWork(TContextType *tcontext);
+  void assignRecvRaysToThreads(int tid, TContextType *tcontext);
 
-  void assignRecvRaysToThreads(TContextType *tcontext);
-  void assignRecvRadianceRaysToThreads(int id, Ray *rays, int64_t count,
-                                       TContextType *tcontext);
-  void assignRecvShadowRaysToThreads(int id, Ray *rays, int64_t count,
-                                     TContextType *tcontext);
+  void rebalanceDomains();
 
  private:
   const spray::Camera *camera_;
@@ -122,17 +132,32 @@ class MultiThreadTracer {
   SceneType *scene_;
   spray::HdrImage *image_;
 
-  std::queue<msg_word_t *> recv_rq_;
-  std::queue<msg_word_t *> recv_sq_;
+  std::queue<msg_word_t *> recv_q_;
   DefaultReceiver comm_recv_;
 
-  msg_word_t *recv_message_;
+  std::vector<msg_word_t *> recv_msgs_;
 
   WorkStats work_stats_;  // number of blocks to process
 
   spray::ThreadStatus thread_status_;
-  spray::InclusiveScan<std::size_t> scan_;
-  WorkSendMsg<Ray, MsgHeader> *send_q_item_;
+  spray::SenseBarrier barrier_;
+
+  std::vector<std::vector<std::size_t>> send_offsets_;  // [tid][2 * id + shad]
+  std::vector<SendQItem *> send_items_;                 // [dest]
+  std::vector<MsgBlock> send_blocks_;  // directory of the message being built
+
+  bool comm_thread_;  // exchange rays on a progress thread (--comm-thread)
+
+  // packed rays (--pack-rays): send_offsets_ are in bytes then
+  bool pack_rays_;
+  std::vector<std::vector<RayPacker>> packers_;        // [tid][2 * id + shad]
+  std::vector<std::vector<std::size_t>> send_counts_;  // [tid][2 * id + shad]
+
+  std::vector<Ray *> recv_rays_;  // unpacked rays of recv_msgs_
+
+  float repartition_;                  // --repartition
+  int max_replicas_;                   // --replicas
+  std::vector<int64_t> domain_costs_;  // summed over tcontexts_
 
  private:
   spray::Tile mytile_;
@@ -143,11 +168,15 @@ class MultiThreadTracer {
 
   spray::TileList tile_list_;
 
+  const spray::AdaptiveSampler *adaptive_;
+  std::vector<int> active_pixels_;  // active pixels of the stripe
+
  private:
   int rank_;
   int num_ranks_;
   int num_domains_;
   int num_pixel_samples_;
+  int sampler_type_;  // PathSampler::Type
   int num_bounces_;
   int num_threads_;
   int num_lights_;
@@ -41,12 +41,14 @@ void MultiThreadTracer<ShaderT>::init(const Config &cfg, const Camera &camera,
 
   lights_ = scene->getLights();  // copy lights
   image_ = image;
+  adaptive_ = nullptr;
 
   // settings
   rank_ = rank;
   num_ranks_ = nranks;
   num_domains_ = ndomains;
   num_pixel_samples_ = cfg.pixel_samples;
+  sampler_type_ = cfg.sampler;
   num_bounces_ = cfg.bounces;
   num_threads_ = cfg.nthreads;
   image_w_ = cfg.image_w;
@@ -60,7 +62,17 @@ void MultiThreadTracer<ShaderT>::init(const Config &cfg, const Camera &camera,
   CHECK_GT(image_w_, 0);
   CHECK_GT(image_h_, 0);
 
-  if (nranks > 0) comm_recv_.set(&recv_rq_, &recv_sq_);
+  if (nranks > 0) comm_recv_.set(&recv_q_);
+  comm_.init(nranks);
+
+  comm_thread_ = cfg.comm_thread && nranks > 1;
+  if (comm_thread_) {
+    int provided;
+    MPI_Query_thread(&provided);
+    CHECK_GE(provided, MPI_THREAD_SERIALIZED)
+        << "--comm-thread requires MPI_THREAD_SERIALIZED.";
+    comm_.startProgressThread();
+  }
 
   // shader
   shader_.init(cfg, scene);
@@ -76,11 +88,16 @@ void MultiThreadTracer<ShaderT>::init(const Config &cfg, const Camera &camera,
     std::size_t num_lights = lights_.size();
 
     total_num_light_samples = 0;
-    for (std::size_t i = 0; i < lights_.size(); ++i) {
-      if (lights_[i]->isAreaLight()) {
-        total_num_light_samples += cfg.ao_samples;
-      } else {
-        ++total_num_light_samples;
+    if (cfg.light_selection == Config::LIGHT_SELECTION_POWER) {
+      // one shadow ray per picked light
+      total_num_light_samples = cfg.sampled_lights;
+    } else {
+      for (std::size_t i = 0; i < lights_.size(); ++i) {
+        if (lights_[i]->isAreaLight()) {
+          total_num_light_samples += cfg.ao_samples;
+        } else {
+          ++total_num_light_samples;
+        }
       }
     }
   }
@@ -90,15 +107,23 @@ void MultiThreadTracer<ShaderT>::init(const Config &cfg, const Camera &camera,
 
   CHECK(!tile_list_.empty());
 
+  CHECK_LE(total_num_light_samples, SPRAY_INSITU_RAY_MAX_LIGHTS);
+
   work_stats_.resize(nranks, cfg.nthreads, ndomains);
 
   // vbuf_.resize(tile_list_.getLargestBlockingTile(), cfg.pixel_samples,
   //              total_num_light_samples);
 
+  numa::checkThreadBinding();
+
   tcontexts_.resize(cfg.nthreads);
   thread_vbufs_.resize(cfg.nthreads);
 
-  for (std::size_t i = 0; i < tcontexts_.size(); ++i) {
+  // each thread sets up its own context and vbuf, so that first touch places
+  // them on the thread's socket
+#pragma omp parallel num_threads(cfg.nthreads)
+  {
+    int i = omp_get_thread_num();
     thread_vbufs_[i].resize(tile_list_.getLargestBlockingTile(),
                             cfg.pixel_samples, total_num_light_samples);
 
@@ -107,175 +132,271 @@ void MultiThreadTracer<ShaderT>::init(const Config &cfg, const Camera &camera,
   }
 
   thread_status_.resize(cfg.nthreads);
-  scan_.resize(cfg.nthreads);
+  barrier_.resize(cfg.nthreads);
+
+  send_offsets_.resize(cfg.nthreads);
+  for (auto &offsets : send_offsets_) {
+    offsets.resize(ndomains << 1, 0);
+  }
+  send_items_.resize(nranks, nullptr);
+
+  repartition_ = cfg.repartition;
+  max_replicas_ = cfg.replicas;
+  domain_costs_.resize(ndomains, 0);
+
+  pack_rays_ = cfg.pack_rays;
+  if (pack_rays_) {
+    packers_.resize(cfg.nthreads);
+    send_counts_.resize(cfg.nthreads);
+    for (int i = 0; i < cfg.nthreads; ++i) {
+      packers_[i].resize(ndomains << 1);
+      send_counts_[i].resize(ndomains << 1, 0);
+    }
+  }
 }
 
 template <typename ShaderT>
-void MultiThreadTracer<ShaderT>::populateRadWorkStats(TContextType *tcontext) {
+void MultiThreadTracer<ShaderT>::populateRadWorkStats(int tid,
+                                                      TContextType *tcontext) {
   tcontext->populateRadWorkStats();
-#pragma omp barrier
-#pragma omp single
-  {
+  barrier_.waitMaster(tid, [&] {
     work_stats_.reduceRadianceThreadWorkStats<TContextType>(rank_, partition_,
                                                             tcontexts_);
-  }
+    work_stats_.startReduce();
+  });
 }
 
 template <typename ShaderT>
-void MultiThreadTracer<ShaderT>::populateWorkStats(TContextType *tcontext) {
+void MultiThreadTracer<ShaderT>::populateWorkStats(int tid,
+                                                   TContextType *tcontext) {
   tcontext->populateWorkStats();
-#pragma omp barrier
-#pragma omp single
-  {
+  barrier_.waitMaster(tid, [&] {
     work_stats_.reduceThreadWorkStats<TContextType>(rank_, partition_,
                                                     tcontexts_);
-  }
+    work_stats_.startReduce();
+  });
 }
 
 template <typename ShaderT>
 void MultiThreadTracer<ShaderT>::sendRays(int tid, TContextType *tcontext) {
+  // publish per-domain ray counts of this thread
+  auto &offsets = send_offsets_[tid];
   for (int id = 0; id < num_domains_; ++id) {
-    int dest = partition_->rank(id);
-    if (rank_ != dest) {
-      auto num_rads = tcontext->getRqSize(id);
-      scan_.set(tid, num_rads);
-#pragma omp barrier
-#pragma omp single
-      { scan_.scan(); }
-
-      if (scan_.sum()) {
-        send(false, tid, id, dest, num_rads, tcontext);
+    if (partition_->rank(id) != rank_) {
+      if (pack_rays_) {
+        auto &packers = packers_[tid];
+        auto &counts = send_counts_[tid];
+        for (int shadow = 0; shadow < 2; ++shadow) {
+          int i = (id << 1) + shadow;
+          tcontext->packRays(shadow, id, &packers[i]);
+          counts[i] = packers[i].getCount();
+          offsets[i] = packers[i].getBytes();
+        }
+      } else {
+        offsets[id << 1] = tcontext->getRqSize(id);
+        offsets[(id << 1) + 1] = tcontext->getSqSize(id);
       }
+    }
+  }
 
-#pragma omp barrier
+  barrier_.wait(tid, [&] { allocSendItems(tcontexts_[0].getMemIn()); });
 
-      auto num_shads = tcontext->getSqSize(id);
-      scan_.set(tid, num_shads);
+  // copy rays into the messages at this thread's offsets
+  for (int id = 0; id < num_domains_; ++id) {
+    SendQItem *item = send_items_[partition_->rank(id)];
+    if (!item) continue;
 
-#pragma omp barrier
-#pragma omp single
-      { scan_.scan(); }
+    uint8_t *rays =
+        RayMsg::getRays(item->getPayload(), item->getHeader().num_blocks);
 
-      if (scan_.sum()) {
-        send(true, tid, id, dest, num_shads, tcontext);
+    for (int shadow = 0; shadow < 2; ++shadow) {
+      int i = (id << 1) + shadow;
+      if (pack_rays_) {
+        packers_[tid][i].encode(&rays[offsets[i]]);
+      } else {
+        tcontext->sendRays(shadow, id, &((Ray *)rays)[offsets[i]]);
       }
     }
-#pragma omp barrier
   }
 }
 
 template <typename ShaderT>
-void MultiThreadTracer<ShaderT>::send(bool shadow, int tid, int domain_id,
-                                      int dest, std::size_t num_rays,
-                                      TContextType *tcontext) {
-#pragma omp master
-  {
-    MsgHeader hout;
-    hout.domain_id = domain_id;
-    hout.payload_count = scan_.sum();
+void MultiThreadTracer<ShaderT>::allocSendItems(spray::MemoryArena *mem) {
+  comm_.beginSendRound();
+
+  // one message per destination, holding a block per domain and ray kind
+  for (int dest = 0; dest < num_ranks_; ++dest) {
+    send_items_[dest] = nullptr;
+    if (dest == rank_) continue;
+
+    send_blocks_.clear();
+    std::size_t num_units = 0;  // rays, or bytes if packed
+    std::size_t num_rays = 0;
+
+    for (int id : partition_->getRoutedDomains(dest)) {
+      for (int shadow = 0; shadow < 2; ++shadow) {
+        int i = (id << 1) + shadow;
+
+        // turn per-thread counts into offsets within the message
+        std::size_t block_offset = num_units;
+        for (auto &offsets : send_offsets_) {
+          std::size_t count = offsets[i];
+          offsets[i] = num_units;
+          num_units += count;
+        }
 
-    int tag = shadow ? Work::SEND_SHADOW_RAYS : Work::SEND_RADIANCE_RAYS;
+        std::size_t block_rays = num_units - block_offset;
+        if (pack_rays_) {
+          block_rays = 0;
+          for (auto &counts : send_counts_) block_rays += counts[i];
+        }
 
-    auto *mem = tcontext->getMemIn();
-    send_q_item_ = ARENA_ALLOC(*mem, SendQItem);
-    send_q_item_->allocate(tag, hout, dest, mem);
+        if (block_rays) {
+          MsgBlock block;
+          block.domain_id = id;
+          block.shadow = shadow;
+          block.offset = block_offset;
+          block.count = block_rays;
+          send_blocks_.push_back(block);
+          num_rays += block_rays;
+        }
+      }
+    }
+
+    if (num_rays) {
+      MsgHeader hout;
+      hout.num_blocks = send_blocks_.size();
+      hout.payload_count = num_rays;
+
+      std::size_t bytes = pack_rays_ ? num_units : num_units * sizeof(Ray);
+#ifdef SPRAY_PROFILING_COUNTERS
+      spray::tAgg(spray::COUNTER_RAY_BYTES_SENT, bytes);
+#endif
+      bytes += RayMsg::directoryBytes(hout.num_blocks);
+
+      SendQItem *item = ARENA_ALLOC(*mem, SendQItem);
+      item->allocateBytes(Work::SEND_RAYS, hout, dest, bytes,
+                          comm_.getSendPool());
+      memcpy(RayMsg::getBlocks(item->getPayload()), &send_blocks_[0],
+             send_blocks_.size() * sizeof(MsgBlock));
+
+      send_items_[dest] = item;
+    }
   }
+}
 
-#pragma omp barrier
+template <typename ShaderT>
+void MultiThreadTracer<ShaderT>::pushSendItems() {
+  for (auto *item : send_items_) {
+    if (item) comm_.pushSendQ(item);
+  }
+}
 
-  Ray *dest_rays = send_q_item_->getPayload();
-  std::size_t target = scan_.get(tid) - num_rays;
+template <typename ShaderT>
+void MultiThreadTracer<ShaderT>::runComm(spray::MemoryArena *mem) {
+  pushSendItems();
 
-  tcontext->sendRays(shadow, domain_id, &dest_rays[target]);
+  comm_.waitForSend();
+  comm_.run(work_stats_, &comm_recv_);
 
-#pragma omp barrier
+  collectRecvMsgs(mem);
+}
 
-#pragma omp master
-  { comm_.pushSendQ(send_q_item_); }
+template <typename ShaderT>
+void MultiThreadTracer<ShaderT>::startComm() {
+  pushSendItems();
+  comm_.runAsync(work_stats_, &comm_recv_);
 }
 
 template <typename ShaderT>
-void MultiThreadTracer<ShaderT>::assignRecvRadianceRaysToThreads(
-    int id, Ray *rays, int64_t count, TContextType *tcontext) {
-#pragma omp for schedule(static, 1)
-  for (auto i = 0; i < count; ++i) {
-    tcontext->pushRadianceRay(id, &rays[i]);
-  }
+void MultiThreadTracer<ShaderT>::finishComm(spray::MemoryArena *mem) {
+  comm_.wait();
+  collectRecvMsgs(mem);
 }
 
 template <typename ShaderT>
-void MultiThreadTracer<ShaderT>::assignRecvShadowRaysToThreads(
-    int id, Ray *rays, int64_t count, TContextType *tcontext) {
-#pragma omp for schedule(static, 1)
-  for (auto i = 0; i < count; ++i) {
-    tcontext->pushShadowRay(id, &rays[i]);
+void MultiThreadTracer<ShaderT>::collectRecvMsgs(spray::MemoryArena *mem) {
+  recv_msgs_.clear();
+  while (!recv_q_.empty()) {
+    recv_msgs_.push_back(recv_q_.front());
+    recv_q_.pop();
+  }
+
+  // storage for the unpacked rays, filled by all threads
+  if (pack_rays_) {
+    MsgHeader *header;
+    Ray *payload;
+
+    recv_rays_.resize(recv_msgs_.size());
+    for (std::size_t m = 0; m < recv_msgs_.size(); ++m) {
+      WorkRecvMsg<Ray, MsgHeader>::decode(recv_msgs_[m], &header, &payload);
+      recv_rays_[m] = mem->Alloc<Ray>(header->payload_count, false);
+    }
   }
 }
 
 template <typename ShaderT>
 void MultiThreadTracer<ShaderT>::assignRecvRaysToThreads(
-    TContextType *tcontext) {
+    int tid, TContextType *tcontext) {
   MsgHeader *header;
   Ray *payload;
 
-  while (1) {
-#pragma omp single
-    {
-      if (!recv_rq_.empty()) {
-        recv_message_ = recv_rq_.front();
-        recv_rq_.pop();
-      } else {
-        recv_message_ = nullptr;
-      }
-    }
-
-    if (recv_message_ == nullptr) {
-      break;
-    }
-
-    WorkRecvMsg<Ray, MsgHeader>::decode(recv_message_, &header, &payload);
+  // every thread walks all messages and takes every num_threads_-th ray, so
+  // no synchronization is needed between messages
+  for (std::size_t m = 0; m < recv_msgs_.size(); ++m) {
+    WorkRecvMsg<Ray, MsgHeader>::decode(recv_msgs_[m], &header, &payload);
     CHECK_NOTNULL(payload);
 
-    assignRecvRadianceRaysToThreads(header->domain_id, payload,
-                                    header->payload_count, tcontext);
-#pragma omp barrier
-  }
+    const MsgBlock *blocks = RayMsg::getBlocks(payload);
+    uint8_t *rays = RayMsg::getRays(payload, header->num_blocks);
 
-#pragma omp barrier
+    int64_t base = 0;  // message-wide index of the block's first ray
+    for (int b = 0; b < header->num_blocks; ++b) {
+      const MsgBlock &block = blocks[b];
 
-  while (1) {
-#pragma omp single
-    {
-      if (!recv_sq_.empty()) {
-        recv_message_ = recv_sq_.front();
-        recv_sq_.pop();
+      // continue the round robin across blocks, so small blocks still spread
+      // over all threads
+      int64_t first = (tid - base) % num_threads_;
+      if (first < 0) first += num_threads_;
+
+      Ray *block_rays;
+      if (pack_rays_) {
+        // each thread unpacks the rays it takes below
+        block_rays = &recv_rays_[m][base];
+        RayCodec::decodeStrided(&rays[block.offset], block.count, first,
+                                num_threads_, block_rays);
       } else {
-        recv_message_ = nullptr;
+        block_rays = &((Ray *)rays)[block.offset];
       }
-    }
 
-    if (recv_message_ == nullptr) {
-      break;
-    }
-
-    WorkRecvMsg<Ray, MsgHeader>::decode(recv_message_, &header, &payload);
-    CHECK_NOTNULL(payload);
+      for (int64_t i = first; i < block.count; i += num_threads_) {
+        if (block.shadow) {
+          tcontext->pushShadowRay(block.domain_id, &block_rays[i]);
+        } else {
+          tcontext->pushRadianceRay(block.domain_id, &block_rays[i]);
+        }
+      }
 
-    assignRecvShadowRaysToThreads(header->domain_id, payload,
-                                  header->payload_count, tcontext);
-#pragma omp barrier
+      base += block.count;
+    }
   }
 }
 
 template <typename ShaderT>
-void MultiThreadTracer<ShaderT>::createTileWork(TContextType *tcontext) {
+void MultiThreadTracer<ShaderT>::createTileWork(int tid,
+                                                TContextType *tcontext) {
 #pragma omp master
   {
     tile_list_.front(&blocking_tile_, &stripe_);
     tile_list_.pop();
 
-    shared_eyes_.num =
-        (std::size_t)(stripe_.w * stripe_.h) * num_pixel_samples_;
+    if (adaptive_) {
+      adaptive_->getActivePixels(blocking_tile_, stripe_, &active_pixels_);
+      shared_eyes_.num = active_pixels_.size() * num_pixel_samples_;
+    } else {
+      shared_eyes_.num =
+          (std::size_t)(stripe_.w * stripe_.h) * num_pixel_samples_;
+    }
     if (shared_eyes_.num) {
       shared_eyes_.rays = tcontext->allocMemIn(shared_eyes_.num);
     } else {
@@ -285,13 +406,22 @@ void MultiThreadTracer<ShaderT>::createTileWork(TContextType *tcontext) {
   }
 #pragma omp barrier
 
+  tcontext->setBlockingTile(blocking_tile_);
+
   // generate eye rays
   if (shared_eyes_.num) {
     glm::vec3 cam_pos = camera_->getPosition();
-    if (num_pixel_samples_ > 1) {  // multi samples
+    if (adaptive_) {
+      spray::insitu::genAdaptiveEyeRays(
+          *camera_, image_w_, cam_pos[0], cam_pos[1], cam_pos[2],
+          num_pixel_samples_, sampler_type_, adaptive_->getPass(),
+          blocking_tile_, active_pixels_, &shared_eyes_);
+
+    } else if (num_pixel_samples_ > 1) {  // multi samples
       spray::insitu::genMultiSampleEyeRays(
           *camera_, image_w_, cam_pos[0], cam_pos[1], cam_pos[2],
-          num_pixel_samples_, blocking_tile_, stripe_, &shared_eyes_);
+          num_pixel_samples_, sampler_type_, blocking_tile_, stripe_,
+          &shared_eyes_);
 
     } else {  // single sample
       spray::insitu::genSingleSampleEyeRays(
@@ -306,10 +436,27 @@ void MultiThreadTracer<ShaderT>::createTileWork(TContextType *tcontext) {
       tcontext->isectDomains(&shared_eyes_.rays[i]);
     }
 
-    populateRadWorkStats(tcontext);
+    populateRadWorkStats(tid, tcontext);
   }
 }
 
+template <typename ShaderT>
+void MultiThreadTracer<ShaderT>::rebalanceDomains() {
+  std::fill(domain_costs_.begin(), domain_costs_.end(), 0);
+  for (auto &t : tcontexts_) {
+    const auto &costs = t.getDomainCosts();
+    for (int id = 0; id < num_domains_; ++id) domain_costs_[id] += costs[id];
+    t.resetDomainCosts();
+  }
+
+  // every rank needs the same costs to arrive at the same assignment
+  MPI_Allreduce(MPI_IN_PLACE, &domain_costs_[0], num_domains_, MPI_INT64_T,
+                MPI_SUM, MPI_COMM_WORLD);
+
+  if (repartition_ > 0.f) scene_->repartition(domain_costs_, repartition_);
+  if (max_replicas_ > 0) scene_->replicate(domain_costs_, max_replicas_);
+}
+
 template <typename ShaderT>
 void MultiThreadTracer<ShaderT>::traceInOmp() {
   const int rank = rank_;
@@ -324,6 +471,8 @@ void MultiThreadTracer<ShaderT>::traceInOmp() {
   TContextType *tcontext = &tcontexts_[tid];
   VBuf *vbuf = &thread_vbufs_[tid];
 
+  if (adaptive_) tcontext->setPass(adaptive_->getPass());
+
   while (!tile_list_.empty()) {
 #pragma omp barrier
 
@@ -331,24 +480,28 @@ void MultiThreadTracer<ShaderT>::traceInOmp() {
     vbuf->resetTbufOut();
     vbuf->resetObuf();
 
-    createTileWork(tcontext);
+    createTileWork(tid, tcontext);
 
     int ray_depth = 0;
 
     while (1) {
-#pragma omp barrier
+      // pack outgoing rays while the block count reduction is in flight.
+      // nothing is packed once all ranks are done.
+      if (nranks > 1) {
+#ifdef SPRAY_GLOG_CHECK
+        CHECK(comm_.emptySendQ());
+#endif
+        sendRays(tid, tcontext);
+      }
 
-#pragma omp master
-      {
-        work_stats_.reduce();
+      barrier_.waitMaster(tid, [&] {
+        work_stats_.finishReduce();
 
         if (work_stats_.allDone()) {
           done_ = 1;
           comm_.waitForSend();
         }
-      }
-
-#pragma omp barrier
+      });
 
       if (done_) {
 #pragma omp single
@@ -366,23 +519,25 @@ void MultiThreadTracer<ShaderT>::traceInOmp() {
 #endif
 
       // send rays (transfer WorkSendMsg's to the comm q)
-      if (nranks > 1) {
-#ifdef SPRAY_GLOG_CHECK
-        CHECK(comm_.emptySendQ());
-#endif
-        sendRays(tid, tcontext);
+      if (nranks > 1 && comm_thread_) {
+        // trace rays of local domains while the progress thread exchanges
+        // rays with the other ranks
+        barrier_.waitMaster(tid, [&] { startComm(); });
 
-#pragma omp barrier
-#pragma omp master
-        {
-          auto *memin = tcontext->getMemIn();
-          comm_.waitForSend();
-          comm_.run(work_stats_, memin, &comm_recv_);
-        }
-#pragma omp barrier
+        tcontext->processRays(rank, ray_depth);
+
+        barrier_.waitMaster(tid,
+                            [&] { finishComm(tcontexts_[0].getMemIn()); });
+
+        assignRecvRaysToThreads(tid, tcontext);
+
+      } else if (nranks > 1) {
+        barrier_.waitMaster(tid,
+                            [&] { runComm(tcontexts_[0].getMemIn()); });
+
+        assignRecvRaysToThreads(tid, tcontext);
       }
 
-      if (nranks > 1) assignRecvRaysToThreads(tcontext);
       tcontext->processRays(rank, ray_depth);
 
 #pragma omp barrier
@@ -394,9 +549,7 @@ void MultiThreadTracer<ShaderT>::traceInOmp() {
         }
       }
 
-#pragma omp barrier
-#pragma omp master
-      {
+      barrier_.waitMaster(tid, [&] {
         if (ray_depth < nbounces && nranks > 1) {
           thread_vbufs_[0].compositeTbuf();
         }
@@ -410,8 +563,7 @@ void MultiThreadTracer<ShaderT>::traceInOmp() {
             t.retireShadows(thread_vbufs_[0]);
           }
         }
-      }
-#pragma omp barrier
+      });
 
       if (ray_depth > 0) {
         vbuf->resetObuf();
@@ -424,20 +576,33 @@ void MultiThreadTracer<ShaderT>::traceInOmp() {
       // refer to tbuf input for correctness
       tcontext->resolveSecondaryRays(thread_vbufs_[0]);
 
-#pragma omp barrier
-
-      populateWorkStats(tcontext);
+      // all threads are done with this bounce when this returns
+      populateWorkStats(tid, tcontext);
 
       tcontext->resetAndSwapMems();
 
       ++ray_depth;
-
-#pragma omp barrier
     }  // while (1)
   }    // while (!tile_list_.empty())
 #pragma omp barrier
 #pragma omp master
-  tile_list_.reset();
+  {
+    tile_list_.reset();
+
+    if ((repartition_ > 0.f || max_replicas_ > 0) && nranks > 1) {
+      rebalanceDomains();
+    }
+#ifdef SPRAY_PROFILING_COUNTERS
+    std::size_t mem_bytes = 0;
+    for (const auto &t : tcontexts_) mem_bytes += t.getMemBytes();
+    spray::tAgg(spray::COUNTER_RAY_MEM, mem_bytes);
+
+    uint64_t num_reused, num_allocated;
+    comm_.takeBufferStats(&num_reused, &num_allocated);
+    spray::tAgg(spray::COUNTER_MSG_BUFFERS_REUSED, num_reused);
+    spray::tAgg(spray::COUNTER_MSG_BUFFERS_ALLOCATED, num_allocated);
+#endif
+  }
 #pragma omp barrier
 }
 
@@ -21,6 +21,8 @@
 #pragma once
 
 #include <omp.h>
+#include <cstdint>
+#include <vector>
 
 #include "embree/random_sampler.h"
 #include "glm/glm.hpp"
@@ -28,21 +30,61 @@
 
 #include "insitu/insitu_ray.h"
 #include "render/camera.h"
+#include "render/path_sampler.h"
 #include "render/spray.h"
 #include "render/tile.h"
 
 namespace spray {
 namespace insitu {
 
+/**
+ * Ray record exchanged between ranks. The pixel ID is not stored; it is
+ * derived from the sample ID and the current blocking tile (see PixelMap),
+ * which keeps the record at 48 bytes.
+ */
 struct SPRAY_ALIGN(16) Ray {
   float org[3];
-  int pixid;
-  float dir[3];
   int samid;
-  float w[3];
+  float dir[3];
   float t;
-  int light;
-  int occluded;
+  float w[3];
+  uint32_t light : 16;  //!< light sample index
+  uint32_t occluded : 1;
+  uint32_t : 15;
+};
+
+//! Maximum number of light samples a ray record can address.
+#define SPRAY_INSITU_RAY_MAX_LIGHTS 65536
+
+/**
+ * Maps sample IDs back to pixel IDs.
+ *
+ * Sample IDs are laid out in blocking-tile order (see genSingleSampleEyeRays
+ * and genMultiSampleEyeRays), so the pixel ID of a ray can be recovered from
+ * its sample ID, the current blocking tile and the image width.
+ */
+class PixelMap {
+ public:
+  PixelMap() : image_w_(0), num_pixel_samples_(1) {}
+
+  void init(int image_w, int num_pixel_samples) {
+    image_w_ = image_w;
+    num_pixel_samples_ = num_pixel_samples;
+  }
+
+  void setBlockingTile(const Tile& blocking_tile) { tile_ = blocking_tile; }
+
+  int pixid(int samid) const {
+    int p = samid / num_pixel_samples_;
+    int y = tile_.y + p / tile_.w;
+    int x = tile_.x + p % tile_.w;
+    return image_w_ * y + x;
+  }
+
+ private:
+  Tile tile_;
+  int image_w_;
+  int num_pixel_samples_;
 };
 
 struct RayData {
@@ -59,8 +101,6 @@ struct RayUtil {
     shadow->org[1] = pos[1];
     shadow->org[2] = pos[2];
 
-    shadow->pixid = ray.pixid;
-
     shadow->dir[0] = dir[0];
     shadow->dir[1] = dir[1];
     shadow->dir[2] = dir[2];
@@ -83,8 +123,6 @@ struct RayUtil {
     rayout->org[1] = pos[1];
     rayout->org[2] = pos[2];
 
-    rayout->pixid = rayin.pixid;
-
     rayout->dir[0] = dir[0];
     rayout->dir[1] = dir[1];
     rayout->dir[2] = dir[2];
@@ -119,8 +157,6 @@ inline void genSingleSampleEyeRays(const Camera& camera, int image_w,
       ray->org[1] = orgy;
       ray->org[2] = orgz;
 
-      ray->pixid = image_w * y + x;
-
       camera.generateRay((float)x, (float)y, ray->dir);
 
       ray->samid =
@@ -137,8 +173,8 @@ inline void genSingleSampleEyeRays(const Camera& camera, int image_w,
 
 inline void genMultiSampleEyeRays(const Camera& camera, int image_w, float orgx,
                                   float orgy, float orgz, int num_pixel_samples,
-                                  spray::Tile blocking_tile, spray::Tile tile,
-                                  RayBuf<Ray>* ray_buf) {
+                                  int sampler_type, spray::Tile blocking_tile,
+                                  spray::Tile tile, RayBuf<Ray>* ray_buf) {
   Ray* rays = ray_buf->rays;
 
 #pragma omp for collapse(3) schedule(static, 1)
@@ -156,13 +192,12 @@ inline void genMultiSampleEyeRays(const Camera& camera, int image_w, float orgx,
         ray->org[1] = orgy;
         ray->org[2] = orgz;
 
-        ray->pixid = image_w * y + x;
-
-        RandomSampler sampler;
-        RandomSampler_init(sampler, ray->pixid, s);
+        PathSampler sampler;
+        sampler.init(sampler_type, image_w * y + x, s, SAMPLER_STREAM_PIXEL);
 
-        float fx = (float)(x) + RandomSampler_get1D(sampler);
-        float fy = (float)(y) + RandomSampler_get1D(sampler);
+        glm::vec2 u = sampler.get2D();
+        float fx = (float)(x) + u.x;
+        float fy = (float)(y) + u.y;
 
         camera.generateRay(fx, fy, ray->dir);
 
@@ -181,5 +216,60 @@ inline void genMultiSampleEyeRays(const Camera& camera, int image_w, float orgx,
   }
 }
 
+/**
+ * Generates eye rays for the given pixels only.
+ *
+ * Sample IDs keep the layout of genMultiSampleEyeRays, and only the ray
+ * buffer is compacted. Pass 0 draws the jitter of genMultiSampleEyeRays and
+ * later passes continue the sample sequence of each pixel.
+ *
+ * \param pixels Offsets of the pixels into the blocking tile.
+ */
+inline void genAdaptiveEyeRays(const Camera& camera, int image_w, float orgx,
+                               float orgy, float orgz, int num_pixel_samples,
+                               int sampler_type, int pass,
+                               spray::Tile blocking_tile,
+                               const std::vector<int>& pixels,
+                               RayBuf<Ray>* ray_buf) {
+  Ray* rays = ray_buf->rays;
+  int npixels = pixels.size();
+
+#pragma omp for collapse(2) schedule(static, 1)
+  for (int i = 0; i < npixels; ++i) {
+    for (int s = 0; s < num_pixel_samples; ++s) {
+      int p = pixels[i];
+      int x = blocking_tile.x + p % blocking_tile.w;
+      int y = blocking_tile.y + p / blocking_tile.w;
+      int bufid = i * num_pixel_samples + s;
+#ifdef SPRAY_GLOG_CHECK
+      CHECK_LT(bufid, ray_buf->num);
+#endif
+      Ray* ray = &rays[bufid];
+      //
+      ray->org[0] = orgx;
+      ray->org[1] = orgy;
+      ray->org[2] = orgz;
+
+      PathSampler sampler;
+      sampler.init(sampler_type, image_w * y + x, pass * num_pixel_samples + s,
+                   SAMPLER_STREAM_PIXEL);
+
+      glm::vec2 u = sampler.get2D();
+      float fx = (float)(x) + u.x;
+      float fy = (float)(y) + u.y;
+
+      camera.generateRay(fx, fy, ray->dir);
+
+      ray->samid = p * num_pixel_samples + s;
+
+      ray->w[0] = 1.f;
+      ray->w[1] = 1.f;
+      ray->w[2] = 1.f;
+
+      ray->t = SPRAY_FLOAT_INF;
+    }
+  }
+}
+
 }  // namespace insitu
 }  // namespace spray
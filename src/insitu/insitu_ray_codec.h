@@ -0,0 +1,456 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "insitu/insitu_ray.h"
+#include "render/spray.h"
+
+namespace spray {
+namespace insitu {
+
+/**
+ * Packed wire encoding of ray records (--pack-rays).
+ *
+ * The rays of a message are encoded in chunks, one per sending thread. A
+ * chunk header holds the bounds of the chunk's ray origins, its smallest
+ * sample ID and a power-of-two scale shared by the throughputs. Each record
+ * then stores
+ *  - the origin quantized to 21 bits per axis within the chunk bounds,
+ *  - the direction in a 32-bit octahedral encoding,
+ *  - t as a float,
+ *  - the throughput as three half floats times the chunk scale,
+ *  - the light index and the occluded bit,
+ *  - the sample ID as a 16-bit offset from the chunk minimum, or 32 bits if
+ *    the chunk spans a wider range.
+ * A record takes 26 or 28 bytes instead of sizeof(Ray). Origins are bounded
+ * per chunk rather than by the destination domain, because forwarded rays
+ * start outside the domain they are sent to. Directions are assumed to be
+ * unit length.
+ *
+ * A chunk's rays may start anywhere in the sender's domains, so its bounds
+ * can span the scene. If a quantization step would exceed
+ * SPRAY_PACKED_RAY_MAX_ORG_STEP, well below SPRAY_RAY_EPSILON, the chunk
+ * keeps its origins as raw floats (31 or 33 bytes per record), so secondary
+ * and shadow rays never start below the surface they leave.
+ *
+ * The shared scale keeps the throughput within the half-float precision of
+ * the chunk's largest value, however bright the light. Only non-finite
+ * values are not preserved.
+ *
+ * Payloads are not compressed further. Quantized records have few repeated
+ * bytes (DEFLATE saves about 2% on the round-trip payloads of
+ * insitu_ray_codec_test.cc), there is no compression library in deps/, and a
+ * compressor would run between tracing and sending on every exchange.
+ */
+struct PackedRayChunk {
+  int32_t count;
+  int32_t samid_base;
+  int32_t record_bytes;
+  int32_t flags;  // PackedRayFlags
+  float org_min[3];
+  float org_scale[3];
+  float w_scale;  // power of two, throughputs are stored divided by it
+};
+
+enum PackedRayFlags {
+  PACKED_RAY_WIDE_SAMID = 1,  // 32-bit sample ID offsets
+  PACKED_RAY_RAW_ORG = 2      // float origins, bounds too wide to quantize
+};
+
+#define SPRAY_PACKED_RAY_ORG_BITS 21
+#define SPRAY_PACKED_RAY_ORG_MAX ((1u << SPRAY_PACKED_RAY_ORG_BITS) - 1)
+#define SPRAY_PACKED_RAY_MAX_ORG_STEP (SPRAY_RAY_EPSILON * 0.125f)
+#define SPRAY_PACKED_RAY_BYTES 26         // 16-bit sample IDs
+#define SPRAY_PACKED_RAY_WIDE_BYTES 28    // 32-bit sample IDs
+#define SPRAY_PACKED_RAY_RAW_ORG_BYTES 5  // added by raw origins
+
+struct RayCodec {
+  inline static uint16_t floatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mag = x & 0x7fffffff;
+
+    if (mag >= 0x7f800000) {  // inf or nan
+      return sign | 0x7c00 | (mag > 0x7f800000 ? 0x200 : 0);
+    }
+    if (mag >= 0x477ff000) return sign | 0x7bff;  // clamp to the half max
+    if (mag < 0x38800000) {                       // subnormal or zero
+      if (mag < 0x33000000) return sign;
+      uint32_t e = mag >> 23;
+      uint32_t m = (mag & 0x7fffff) | 0x800000;
+      uint32_t shift = 126 - e;
+      return sign | ((m + (1u << (shift - 1))) >> shift);
+    }
+    // rebias the exponent and round to nearest even
+    mag += 0xc8000fff + ((mag >> 13) & 1);
+    return sign | (mag >> 13);
+  }
+
+  inline static float halfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t e = (h >> 10) & 0x1f;
+    uint32_t m = h & 0x3ff;
+    uint32_t x;
+
+    if (e == 0) {
+      if (m == 0) {
+        x = sign;
+      } else {  // normalize the subnormal
+        e = 113;
+        while (!(m & 0x400)) {
+          m <<= 1;
+          --e;
+        }
+        x = sign | (e << 23) | ((m & 0x3ff) << 13);
+      }
+    } else if (e == 31) {
+      x = sign | 0x7f800000 | (m << 13);
+    } else {
+      x = sign | ((e + 112) << 23) | (m << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+  }
+
+  inline static float signNotZero(float v) { return v < 0.f ? -1.f : 1.f; }
+
+  inline static uint32_t encodeDirection(const float d[3]) {
+    float l1 = std::fabs(d[0]) + std::fabs(d[1]) + std::fabs(d[2]);
+    float inv = l1 > 0.f ? 1.f / l1 : 0.f;
+    float u = d[0] * inv;
+    float v = d[1] * inv;
+    if (d[2] < 0.f) {  // fold the lower hemisphere
+      float fu = (1.f - std::fabs(v)) * signNotZero(u);
+      float fv = (1.f - std::fabs(u)) * signNotZero(v);
+      u = fu;
+      v = fv;
+    }
+    u = std::min(std::max(u, -1.f), 1.f);
+    v = std::min(std::max(v, -1.f), 1.f);
+    uint32_t qu = (uint32_t)((u * 0.5f + 0.5f) * 65535.f + 0.5f);
+    uint32_t qv = (uint32_t)((v * 0.5f + 0.5f) * 65535.f + 0.5f);
+    return qu | (qv << 16);
+  }
+
+  inline static void decodeDirection(uint32_t q, float d[3]) {
+    float u = (float)(q & 0xffff) * (2.f / 65535.f) - 1.f;
+    float v = (float)(q >> 16) * (2.f / 65535.f) - 1.f;
+    float z = 1.f - std::fabs(u) - std::fabs(v);
+    if (z < 0.f) {
+      float fu = (1.f - std::fabs(v)) * signNotZero(u);
+      float fv = (1.f - std::fabs(u)) * signNotZero(v);
+      u = fu;
+      v = fv;
+    }
+    float inv = 1.f / std::sqrt(u * u + v * v + z * z);
+    d[0] = u * inv;
+    d[1] = v * inv;
+    d[2] = z * inv;
+  }
+
+  //! Size of a chunk of the given header in bytes, padded to message words.
+  inline static std::size_t chunkBytes(const PackedRayChunk& chunk) {
+    std::size_t bytes = sizeof(PackedRayChunk) +
+                        (std::size_t)chunk.count * chunk.record_bytes;
+    return (bytes + 3) & ~(std::size_t)3;
+  }
+
+  //! Record size of a chunk with the given flags.
+  inline static int recordBytes(int flags) {
+    int bytes = (flags & PACKED_RAY_WIDE_SAMID) ? SPRAY_PACKED_RAY_WIDE_BYTES
+                                                : SPRAY_PACKED_RAY_BYTES;
+    if (flags & PACKED_RAY_RAW_ORG) bytes += SPRAY_PACKED_RAY_RAW_ORG_BYTES;
+    return bytes;
+  }
+
+  /**
+   * \param inv Inverse origin steps of the chunk.
+   * \param inv_w Inverse throughput scale of the chunk.
+   */
+  inline static void encode(const PackedRayChunk& chunk, const float inv[3],
+                            float inv_w, const Ray& ray, uint8_t* rec) {
+    if (chunk.flags & PACKED_RAY_RAW_ORG) {
+      uint8_t occluded = ray.occluded;
+      memcpy(rec, ray.org, 12);
+      memcpy(rec + 12, &occluded, 1);
+      rec += 8 + SPRAY_PACKED_RAY_RAW_ORG_BYTES;
+    } else {
+      uint64_t org = 0;
+      for (int i = 0; i < 3; ++i) {
+        float q = (ray.org[i] - chunk.org_min[i]) * inv[i] + .5f;
+        uint64_t qi = (uint64_t)std::min(std::max(q, 0.f),
+                                         (float)SPRAY_PACKED_RAY_ORG_MAX);
+        org |= qi << (i * SPRAY_PACKED_RAY_ORG_BITS);
+      }
+      org |= (uint64_t)ray.occluded << 63;
+      memcpy(rec, &org, 8);
+      rec += 8;
+    }
+
+    uint32_t dir = encodeDirection(ray.dir);
+    uint16_t w[3] = {floatToHalf(ray.w[0] * inv_w),
+                     floatToHalf(ray.w[1] * inv_w),
+                     floatToHalf(ray.w[2] * inv_w)};
+    uint16_t light = ray.light;
+
+    memcpy(rec, &dir, 4);
+    memcpy(rec + 4, &ray.t, 4);
+    memcpy(rec + 8, w, 6);
+    memcpy(rec + 14, &light, 2);
+
+    uint32_t samid = (uint32_t)(ray.samid - chunk.samid_base);
+    if (chunk.flags & PACKED_RAY_WIDE_SAMID) {
+      memcpy(rec + 16, &samid, 4);
+    } else {
+      uint16_t s = samid;
+      memcpy(rec + 16, &s, 2);
+    }
+  }
+
+  inline static void decode(const PackedRayChunk& chunk, const uint8_t* rec,
+                            Ray* ray) {
+    if (chunk.flags & PACKED_RAY_RAW_ORG) {
+      uint8_t occluded;
+      memcpy(ray->org, rec, 12);
+      memcpy(&occluded, rec + 12, 1);
+      ray->occluded = occluded;
+      rec += 8 + SPRAY_PACKED_RAY_RAW_ORG_BYTES;
+    } else {
+      uint64_t org;
+      memcpy(&org, rec, 8);
+      for (int i = 0; i < 3; ++i) {
+        uint32_t q = (org >> (i * SPRAY_PACKED_RAY_ORG_BITS)) &
+                     SPRAY_PACKED_RAY_ORG_MAX;
+        ray->org[i] = chunk.org_min[i] + (float)q * chunk.org_scale[i];
+      }
+      ray->occluded = (uint32_t)(org >> 63);
+      rec += 8;
+    }
+
+    uint32_t dir;
+    uint16_t w[3];
+    uint16_t light;
+
+    memcpy(&dir, rec, 4);
+    memcpy(&ray->t, rec + 4, 4);
+    memcpy(w, rec + 8, 6);
+    memcpy(&light, rec + 14, 2);
+
+    decodeDirection(dir, ray->dir);
+
+    ray->w[0] = halfToFloat(w[0]) * chunk.w_scale;
+    ray->w[1] = halfToFloat(w[1]) * chunk.w_scale;
+    ray->w[2] = halfToFloat(w[2]) * chunk.w_scale;
+    ray->light = light;
+
+    uint32_t samid;
+    if (chunk.flags & PACKED_RAY_WIDE_SAMID) {
+      memcpy(&samid, rec + 16, 4);
+    } else {
+      uint16_t s;
+      memcpy(&s, rec + 16, 2);
+      samid = s;
+    }
+    ray->samid = chunk.samid_base + (int)samid;
+  }
+
+  /**
+   * Decodes the rays of a packed payload whose indices are congruent to
+   * first modulo stride, so that threads can split a message without
+   * synchronization.
+   *
+   * \param payload Chunks written by RayPacker::encode.
+   * \param count Total number of rays in the payload.
+   * \param first The first ray index to decode.
+   * \param stride The distance between decoded ray indices.
+   * \param rays Output array of count rays, indexed as in the payload.
+   */
+  inline static void decodeStrided(const uint8_t* payload, int64_t count,
+                                   int64_t first, int64_t stride, Ray* rays) {
+    int64_t base = 0;
+    while (base < count) {
+      PackedRayChunk chunk;
+      memcpy(&chunk, payload, sizeof(chunk));
+#ifdef SPRAY_GLOG_CHECK
+      CHECK_GT(chunk.count, 0);
+      CHECK_LE(base + chunk.count, count);
+#endif
+      const uint8_t* recs = payload + sizeof(PackedRayChunk);
+
+      int64_t j = (first - base) % stride;
+      if (j < 0) j += stride;
+      for (; j < chunk.count; j += stride) {
+        decode(chunk, recs + j * chunk.record_bytes, &rays[base + j]);
+      }
+
+      base += chunk.count;
+      payload += chunkBytes(chunk);
+    }
+  }
+};
+
+/**
+ * Bounds of the rays of a chunk, from which the chunk layout is fixed.
+ */
+class PackedRayBounds {
+ public:
+  PackedRayBounds() : count_(0) {}
+
+  void add(const Ray& r) {
+    if (count_ == 0) {
+      for (int i = 0; i < 3; ++i) org_min_[i] = org_max_[i] = r.org[i];
+      samid_min_ = samid_max_ = r.samid;
+      w_max_ = 0.f;
+    }
+    for (int i = 0; i < 3; ++i) {
+      org_min_[i] = std::min(org_min_[i], r.org[i]);
+      org_max_[i] = std::max(org_max_[i], r.org[i]);
+      float w = std::fabs(r.w[i]);
+      if (std::isfinite(w)) w_max_ = std::max(w_max_, w);
+    }
+    samid_min_ = std::min(samid_min_, r.samid);
+    samid_max_ = std::max(samid_max_, r.samid);
+    ++count_;
+  }
+
+  /**
+   * Lays out a chunk of the added rays.
+   *
+   * \param chunk The chunk header to fill.
+   * \param inv Inverse origin steps, 0 for flat axes.
+   * \param inv_w Inverse throughput scale.
+   */
+  void layout(PackedRayChunk* chunk, float inv[3], float* inv_w) const {
+    chunk->count = count_;
+    chunk->flags = 0;
+    if (count_ == 0) return;
+
+    for (int i = 0; i < 3; ++i) {
+      float extent = org_max_[i] - org_min_[i];
+      chunk->org_min[i] = org_min_[i];
+      chunk->org_scale[i] = extent / (float)SPRAY_PACKED_RAY_ORG_MAX;
+      inv[i] = extent > 0.f ? 1.f / chunk->org_scale[i] : 0.f;
+      if (chunk->org_scale[i] > SPRAY_PACKED_RAY_MAX_ORG_STEP) {
+        chunk->flags |= PACKED_RAY_RAW_ORG;
+      }
+    }
+
+    chunk->samid_base = samid_min_;
+    if ((samid_max_ - samid_min_) > 0xffff) {
+      chunk->flags |= PACKED_RAY_WIDE_SAMID;
+    }
+    chunk->record_bytes = RayCodec::recordBytes(chunk->flags);
+
+    // the largest throughput lands in [2^14, 2^15), within the half range
+    int e = w_max_ > 0.f ? std::ilogb(w_max_) - 14 : 0;
+    e = std::min(std::max(e, -100), 100);
+    chunk->w_scale = std::ldexp(1.f, e);
+    *inv_w = std::ldexp(1.f, -e);
+  }
+
+ private:
+  int count_;
+  float org_min_[3];
+  float org_max_[3];
+  int samid_min_;
+  int samid_max_;
+  float w_max_;
+};
+
+/**
+ * Encodes the rays of one queue into a chunk.
+ *
+ * gather() drains the queue and fixes the chunk layout, so that the chunk
+ * size is known before the message is allocated. encode() writes the chunk.
+ */
+class RayPacker {
+ public:
+  void gather(std::queue<Ray*>* q) {
+    rays_.clear();
+    PackedRayBounds bounds;
+    while (!q->empty()) {
+      rays_.push_back(q->front());
+      bounds.add(*q->front());
+      q->pop();
+    }
+    bounds.layout(&chunk_, inv_scale_, &inv_w_scale_);
+  }
+
+  /**
+   * Chunk size in bytes that gather() would produce for the queue. The queue
+   * is rotated in place and keeps its order.
+   */
+  static std::size_t measure(std::queue<Ray*>* q) {
+    std::size_t n = q->size();
+    if (n == 0) return 0;
+
+    PackedRayBounds bounds;
+    for (std::size_t i = 0; i < n; ++i) {
+      Ray* r = q->front();
+      q->pop();
+      bounds.add(*r);
+      q->push(r);
+    }
+
+    PackedRayChunk chunk;
+    float inv[3], inv_w;
+    bounds.layout(&chunk, inv, &inv_w);
+    return RayCodec::chunkBytes(chunk);
+  }
+
+  std::size_t getCount() const { return rays_.size(); }
+
+  //! Chunk size in bytes. Zero if no rays were gathered.
+  std::size_t getBytes() const {
+    return rays_.empty() ? 0 : RayCodec::chunkBytes(chunk_);
+  }
+
+  void encode(uint8_t* dest) const {
+    if (rays_.empty()) return;
+
+    memcpy(dest, &chunk_, sizeof(chunk_));
+    uint8_t* rec = dest + sizeof(PackedRayChunk);
+    for (const Ray* r : rays_) {
+      RayCodec::encode(chunk_, inv_scale_, inv_w_scale_, *r, rec);
+      rec += chunk_.record_bytes;
+    }
+  }
+
+ private:
+  std::vector<Ray*> rays_;
+  PackedRayChunk chunk_;
+  float inv_scale_[3];
+  float inv_w_scale_;
+};
+
+}  // namespace insitu
+}  // namespace spray
@@ -0,0 +1,272 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#include "insitu/insitu_ray_codec.h"
+
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace spray {
+namespace insitu {
+namespace {
+
+// a domain the rays of a chunk may start in
+const float kDomainMin[3] = {-50.f, 10.f, -5.f};
+const float kDomainMax[3] = {50.f, 60.f, 95.f};
+
+// a scene whose domains are spread over the rank that sends a chunk
+const float kSceneMin[3] = {-5000.f, -2000.f, -8000.f};
+const float kSceneMax[3] = {5000.f, 3000.f, 1000.f};
+
+// half floats keep 11 significant bits
+const float kHalfRelError = 1.f / 2048.f;
+
+// 16 bits per octahedral coordinate
+const float kDirError = 1e-4f;
+
+struct RayParams {
+  const float* org_min;
+  const float* org_max;
+  float w_max;
+  int samid_base;
+  int samid_range;
+};
+
+RayParams domainRays(int samid_base, int samid_range) {
+  RayParams p = {kDomainMin, kDomainMax, 4.f, samid_base, samid_range};
+  return p;
+}
+
+void makeRays(int num_rays, const RayParams& p, unsigned seed,
+              std::vector<Ray>* rays) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  std::uniform_real_distribution<float> sym(-1.f, 1.f);
+  std::uniform_int_distribution<int> samid(p.samid_base,
+                                           p.samid_base + p.samid_range - 1);
+  std::uniform_int_distribution<int> light(0, SPRAY_INSITU_RAY_MAX_LIGHTS - 1);
+
+  rays->resize(num_rays);
+  for (auto& r : *rays) {
+    for (int i = 0; i < 3; ++i) {
+      r.org[i] = p.org_min[i] + unit(gen) * (p.org_max[i] - p.org_min[i]);
+    }
+
+    float len;
+    do {
+      for (int i = 0; i < 3; ++i) r.dir[i] = sym(gen);
+      len = std::sqrt(r.dir[0] * r.dir[0] + r.dir[1] * r.dir[1] +
+                      r.dir[2] * r.dir[2]);
+    } while (len < 1e-3f || len > 1.f);
+    for (int i = 0; i < 3; ++i) r.dir[i] /= len;
+
+    r.t = unit(gen) * 100.f;
+    for (int i = 0; i < 3; ++i) r.w[i] = unit(gen) * p.w_max;
+    r.samid = samid(gen);
+    r.light = light(gen);
+    r.occluded = gen() & 1;
+  }
+}
+
+//! Packs the rays in chunks of chunk_size rays, as sending threads do.
+std::vector<uint8_t> pack(std::vector<Ray>* rays, int chunk_size,
+                          std::vector<int>* flags) {
+  std::vector<uint8_t> payload;
+  for (std::size_t first = 0; first < rays->size(); first += chunk_size) {
+    std::size_t last = std::min(rays->size(), first + chunk_size);
+    std::queue<Ray*> q;
+    for (std::size_t i = first; i < last; ++i) q.push(&(*rays)[i]);
+
+    std::size_t measured = RayPacker::measure(&q);
+    EXPECT_EQ(q.size(), last - first);
+    EXPECT_EQ(q.front(), &(*rays)[first]);
+
+    RayPacker packer;
+    packer.gather(&q);
+    EXPECT_TRUE(q.empty());
+    EXPECT_EQ(packer.getCount(), last - first);
+    EXPECT_EQ(packer.getBytes(), measured);
+
+    std::size_t offset = payload.size();
+    payload.resize(offset + packer.getBytes());
+    packer.encode(&payload[offset]);
+
+    PackedRayChunk chunk;
+    memcpy(&chunk, &payload[offset], sizeof(chunk));
+    EXPECT_EQ(chunk.record_bytes, RayCodec::recordBytes(chunk.flags));
+    flags->push_back(chunk.flags);
+  }
+  return payload;
+}
+
+void expectRoundTrip(const std::vector<Ray>& in, const std::vector<Ray>& out) {
+  ASSERT_EQ(in.size(), out.size());
+
+  // wherever the rays of a chunk start, an origin moves by less than a
+  // fraction of the offset that keeps rays off the surface they leave
+  const float org_error = SPRAY_PACKED_RAY_MAX_ORG_STEP;
+  ASSERT_LT(org_error, SPRAY_RAY_EPSILON);
+
+  for (std::size_t k = 0; k < in.size(); ++k) {
+    const Ray& a = in[k];
+    const Ray& b = out[k];
+
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_NEAR(a.org[i], b.org[i], org_error) << "ray " << k;
+      EXPECT_NEAR(a.dir[i], b.dir[i], kDirError) << "ray " << k;
+      EXPECT_NEAR(a.w[i], b.w[i], a.w[i] * kHalfRelError) << "ray " << k;
+    }
+
+    EXPECT_EQ(a.t, b.t);
+    EXPECT_EQ(a.samid, b.samid);
+    EXPECT_EQ(a.light, b.light);
+    EXPECT_EQ(a.occluded, b.occluded);
+  }
+}
+
+TEST(RayCodec, HalfFloat) {
+  EXPECT_EQ(RayCodec::halfToFloat(RayCodec::floatToHalf(0.f)), 0.f);
+  EXPECT_EQ(RayCodec::halfToFloat(RayCodec::floatToHalf(1.f)), 1.f);
+  EXPECT_EQ(RayCodec::halfToFloat(RayCodec::floatToHalf(-2.f)), -2.f);
+
+  // clamped to the largest half
+  EXPECT_EQ(RayCodec::halfToFloat(RayCodec::floatToHalf(1e6f)), 65504.f);
+
+  for (float f = 1e-4f; f < 6e4f; f *= 1.01f) {
+    float h = RayCodec::halfToFloat(RayCodec::floatToHalf(f));
+    EXPECT_NEAR(f, h, f * kHalfRelError) << f;
+  }
+}
+
+TEST(RayCodec, Direction) {
+  std::vector<Ray> rays;
+  makeRays(6000, domainRays(0, 1), 1, &rays);
+
+  // axes and the octahedron's folded edges
+  const float axes[][3] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0},
+                           {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+  for (const auto& a : axes) {
+    Ray r;
+    r.dir[0] = a[0];
+    r.dir[1] = a[1];
+    r.dir[2] = a[2];
+    rays.push_back(r);
+  }
+
+  for (const auto& r : rays) {
+    float d[3];
+    RayCodec::decodeDirection(RayCodec::encodeDirection(r.dir), d);
+    for (int i = 0; i < 3; ++i) EXPECT_NEAR(r.dir[i], d[i], kDirError);
+    EXPECT_NEAR(d[0] * d[0] + d[1] * d[1] + d[2] * d[2], 1.f, 1e-5f);
+  }
+}
+
+TEST(RayCodec, RoundTrip) {
+  std::vector<Ray> rays;
+  makeRays(6000, domainRays(1 << 20, 0x10000), 2, &rays);
+
+  std::vector<int> flags;
+  std::vector<uint8_t> payload = pack(&rays, 1000, &flags);
+  for (int f : flags) EXPECT_EQ(f, 0);
+
+  // tighter than copying the records
+  EXPECT_LT(payload.size(), rays.size() * sizeof(Ray) * 6 / 10);
+
+  std::vector<Ray> out(rays.size());
+  RayCodec::decodeStrided(payload.data(), rays.size(), 0, 1, out.data());
+  expectRoundTrip(rays, out);
+}
+
+TEST(RayCodec, SceneWideOrigins) {
+  // hit points spread over the scene, too far apart to quantize
+  RayParams p = {kSceneMin, kSceneMax, 4.f, 0, 4096};
+  std::vector<Ray> rays;
+  makeRays(3000, p, 5, &rays);
+
+  std::vector<int> flags;
+  std::vector<uint8_t> payload = pack(&rays, 1000, &flags);
+  for (int f : flags) EXPECT_EQ(f, PACKED_RAY_RAW_ORG);
+
+  std::vector<Ray> out(rays.size());
+  RayCodec::decodeStrided(payload.data(), rays.size(), 0, 1, out.data());
+  expectRoundTrip(rays, out);
+}
+
+TEST(RayCodec, BrightThroughput) {
+  // beyond the half range, e.g. bright lights over small pdfs and roulette
+  RayParams p = domainRays(0, 4096);
+  p.w_max = 1e8f;
+  std::vector<Ray> rays;
+  makeRays(3000, p, 6, &rays);
+
+  std::vector<int> flags;
+  std::vector<uint8_t> payload = pack(&rays, 1000, &flags);
+
+  std::vector<Ray> out(rays.size());
+  RayCodec::decodeStrided(payload.data(), rays.size(), 0, 1, out.data());
+  expectRoundTrip(rays, out);
+}
+
+TEST(RayCodec, WideSampleIds) {
+  std::vector<Ray> rays;
+  makeRays(2000, domainRays(0, 1 << 24), 3, &rays);
+
+  std::vector<int> flags;
+  std::vector<uint8_t> payload = pack(&rays, 2000, &flags);
+  ASSERT_EQ(flags.size(), 1);
+  EXPECT_EQ(flags[0], PACKED_RAY_WIDE_SAMID);
+
+  std::vector<Ray> out(rays.size());
+  RayCodec::decodeStrided(payload.data(), rays.size(), 0, 1, out.data());
+  expectRoundTrip(rays, out);
+}
+
+TEST(RayCodec, StridedDecode) {
+  // uneven chunks of both origin encodings, as threads send different rays
+  std::vector<Ray> rays, wide;
+  makeRays(2101, domainRays(5000, 4096), 4, &rays);
+  RayParams p = {kSceneMin, kSceneMax, 4.f, 5000, 4096};
+  makeRays(900, p, 7, &wide);
+  rays.insert(rays.end(), wide.begin(), wide.end());
+
+  std::vector<int> flags;
+  std::vector<uint8_t> payload = pack(&rays, 700, &flags);
+  ASSERT_EQ(flags.size(), 5);
+  EXPECT_EQ(flags[0], 0);
+  EXPECT_EQ(flags[4], PACKED_RAY_RAW_ORG);
+
+  // each of 3 threads decodes every third ray
+  const int kThreads = 3;
+  std::vector<Ray> out(rays.size());
+  for (int t = 0; t < kThreads; ++t) {
+    RayCodec::decodeStrided(payload.data(), rays.size(), t, kThreads,
+                            out.data());
+  }
+  expectRoundTrip(rays, out);
+}
+
+}  // namespace
+}  // namespace insitu
+}  // namespace spray
@@ -29,6 +29,7 @@
 #include "insitu/insitu_ray.h"
 #include "render/config.h"
 #include "render/light.h"
+#include "render/path_sampler.h"
 #include "render/rays.h"
 #include "render/reflection.h"
 #include "render/scene.h"
@@ -43,6 +44,10 @@ class ShaderAo {
   typedef SceneT SceneType;
 
   void init(const spray::Config &cfg, const SceneT *scene) {
+    pass_ = 0;
+    sampler_type_ = cfg.sampler;
+    num_pixel_samples_ = cfg.pixel_samples;
+    pixel_map_.init(cfg.image_w, cfg.pixel_samples);
     bounces_ = cfg.bounces;
     samples_ = cfg.ao_samples;  // number of samples for area lights
     ks_ = cfg.ks;
@@ -53,14 +58,32 @@ class ShaderAo {
 
  private:
   const SceneT *scene_;
+  int pass_;          // progressive pass, offsets the sample index
+  int sampler_type_;  // PathSampler::Type
+  int num_pixel_samples_;
+  PixelMap pixel_map_;  // maps sample IDs of the blocking tile to pixels
   std::vector<Light *> lights_;
   int bounces_;
   int samples_;
   glm::vec3 ks_;
   float shininess_;
 
+  //! Seeds a sampler for a stream of the vertex at the given depth.
+  void initSampler(const Ray &rayin, int depth, int stream,
+                   PathSampler *sampler) const {
+    int s = rayin.samid % num_pixel_samples_;
+    sampler->init(sampler_type_, pixel_map_.pixid(rayin.samid),
+                  pass_ * num_pixel_samples_ + s,
+                  pathSamplerStream(depth, stream));
+  }
+
  public:
   bool isAo() { return true; }
+  void setPass(int pass) { pass_ = pass; }
+  //! Sample IDs are local to the blocking tile. The tile maps them to pixels.
+  void setBlockingTile(const Tile &blocking_tile) {
+    pixel_map_.setBlockingTile(blocking_tile);
+  }
 
  public:
   void operator()(int domain_id, const Ray &rayin,
@@ -109,11 +132,11 @@ void ShaderAo<SceneT>::operator()(int domain_id, const Ray &rayin,
   int next_ray_depth = ray_depth + 1;
 
   const float ao_weight = 1.0f / static_cast<float>(samples_);
-  RandomSampler light_sampler;
+  PathSampler light_sampler;
+  initSampler(rayin, next_ray_depth, SAMPLER_STREAM_LIGHT, &light_sampler);
 
   for (int l = 0; l < samples_; ++l) {
-    RandomSampler_init(light_sampler, rayin.pixid * (l + 1));
-    bsdf->sampleRandom(normal_ff, &light_sampler, &wi, &pdf);
+    bsdf->sampleRandom(normal_ff, light_sampler.get2D(), &wi, &pdf);
 
     costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
     Lr = Lin * surf_radiance * (SPRAY_ONE_OVER_PI * costheta * ao_weight / pdf);
@@ -170,10 +193,10 @@ void ShaderAo<SceneT>::operator()(int domain_id, const Ray &rayin,
         }
       }
     } else {
-      RandomSampler sampler;
-      RandomSampler_init(sampler, rayin.samid * next_ray_depth);
+      PathSampler sampler;
+      initSampler(rayin, next_ray_depth, SAMPLER_STREAM_BSDF, &sampler);
 
-      bsdf->sampleRandom(normal_ff, &sampler, &wi, &pdf);
+      bsdf->sampleRandom(normal_ff, sampler.get2D(), &wi, &pdf);
       costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
       Lr = Lin * surf_radiance * SPRAY_ONE_OVER_PI * costheta / pdf;
       if (hasPositive(Lr)) {
@@ -28,8 +28,11 @@
 #include "insitu/insitu_ray.h"
 #include "render/config.h"
 #include "render/light.h"
+#include "render/light_sampler.h"
+#include "render/path_sampler.h"
 #include "render/rays.h"
 #include "render/reflection.h"
+#include "render/roulette.h"
 #include "render/scene.h"
 #include "utils/util.h"
 
@@ -44,24 +47,56 @@ class ShaderPt {
   typedef SceneT SceneType;
 
   void init(const spray::Config &cfg, const SceneT *scene) {
+    pass_ = 0;
+    sampler_type_ = cfg.sampler;
+    num_pixel_samples_ = cfg.pixel_samples;
+    pixel_map_.init(cfg.image_w, cfg.pixel_samples);
     bounces_ = cfg.bounces;
     samples_ = cfg.ao_samples;  // number of samples for area lights
     ks_ = cfg.ks;
     shininess_ = cfg.shininess;
     scene_ = scene;
     lights_ = scene->getLights();  // copy lights
+    light_selection_ = cfg.light_selection;
+    num_sampled_lights_ = cfg.sampled_lights;
+    rr_depth_ = cfg.rr_depth;
+    if (light_selection_ == spray::Config::LIGHT_SELECTION_POWER) {
+      light_sampler_.init(lights_);
+    }
   }
 
  private:
   const SceneT *scene_;
+  int pass_;          // progressive pass, offsets the sample index
+  int sampler_type_;  // PathSampler::Type
+  int num_pixel_samples_;
+  PixelMap pixel_map_;  // maps sample IDs of the blocking tile to pixels
   std::vector<Light *> lights_;
+  int light_selection_;
+  int num_sampled_lights_;
+  int rr_depth_;
+  spray::LightSampler light_sampler_;
   int bounces_;
   int samples_;
   glm::vec3 ks_;
   float shininess_;
 
+  //! Seeds a sampler for a stream of the vertex at the given depth.
+  void initSampler(const Ray &rayin, int depth, int stream,
+                   PathSampler *sampler) const {
+    int s = rayin.samid % num_pixel_samples_;
+    sampler->init(sampler_type_, pixel_map_.pixid(rayin.samid),
+                  pass_ * num_pixel_samples_ + s,
+                  pathSamplerStream(depth, stream));
+  }
+
  public:
   bool isAo() { return false; }
+  void setPass(int pass) { pass_ = pass; }
+  //! Sample IDs are local to the blocking tile. The tile maps them to pixels.
+  void setBlockingTile(const Tile &blocking_tile) {
+    pixel_map_.setBlockingTile(blocking_tile);
+  }
 
  public:
   void operator()(int domain_id, const Ray &rayin,
@@ -70,12 +105,18 @@ class ShaderPt {
                   std::queue<Ray *> *rq, int ray_depth);
 
  private:
-  void genR2(const Ray &rayin, const glm::vec3 &org, const glm::vec3 &dir,
-             const glm::vec3 &w, float t, spray::MemoryArena *mem,
-             std::queue<Ray *> *rq) {
+  void genR2(int depth, const Ray &rayin, const glm::vec3 &org,
+             const glm::vec3 &dir, const glm::vec3 &w, float t,
+             spray::MemoryArena *mem, std::queue<Ray *> *rq) {
+    PathSampler sampler;
+    initSampler(rayin, depth, SAMPLER_STREAM_ROULETTE, &sampler);
+
+    glm::vec3 weight = w;
+    if (!russianRoulette(&sampler, depth, rr_depth_, &weight)) return;
+
     Ray *r2 = mem->Alloc<Ray>(1, false);
     CHECK_NOTNULL(r2);
-    RayUtil::makeRay(rayin, org, dir, w, t, r2);
+    RayUtil::makeRay(rayin, org, dir, weight, t, r2);
     rq->push(r2);
   }
 };
@@ -111,64 +152,83 @@ void ShaderPt<SceneT>::operator()(int domain_id, const Ray &rayin,
   int next_ray_depth = ray_depth + 1;
 
   if (!delta_dist) {
-    RandomSampler light_sampler;
-    RandomSampler_init(light_sampler, rayin.samid * next_ray_depth);
+    PathSampler light_sampler;
+    initSampler(rayin, next_ray_depth, SAMPLER_STREAM_LIGHT, &light_sampler);
 
     int light_sample_offset = 0;
     int light_sample_id;
 
-    for (int l = 0; l < nlights; ++l) {
-      if (lights_[l]->isAreaLight()) {
-        for (int s = 0; s < samples_; ++s) {
-          // light color
-          light_radiance =
-              lights_[l]->sampleArea(light_sampler, normal_ff, &wi, &pdf);
+    if (light_selection_ == spray::Config::LIGHT_SELECTION_POWER) {
+      // one occlusion slot per pick
+      for (int k = 0; k < num_sampled_lights_; ++k) {
+        float pmf;
+        int l = light_sampler_.sample(light_sampler.get1D(), &pmf);
+        float scale = 1.0f / (pmf * num_sampled_lights_);
+
+        if (sampleDirect(*lights_[l], light_sampler.get2D(), pos, normal_ff,
+                         wo, surf_radiance, ks_, shininess_, Lin, scale, &wi,
+                         &Lr)) {
+          Ray *shadow = mem->Alloc<Ray>(1, false);
+          CHECK_NOTNULL(shadow);
+
+          RayUtil::makeShadow(rayin, k, pos, wi, Lr, isect.tfar, shadow);
+          sq->push(shadow);
+        }
+      }
+    } else {
+      for (int l = 0; l < nlights; ++l) {
+        if (lights_[l]->isAreaLight()) {
+          for (int s = 0; s < samples_; ++s) {
+            // light color
+            light_radiance = lights_[l]->sampleArea(light_sampler.get2D(),
+                                                    normal_ff, &wi, &pdf);
+
+            if (pdf > 0.0f) {
+              costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
+              Lr = Lin *
+                   blinnPhong(costheta, surf_radiance, ks_, shininess_,
+                              light_radiance, wi, normal_ff, wo) *
+                   (1.0f / (pdf * samples_));
+
+              if (hasPositive(Lr)) {
+                // create shadow ray
+                Ray *shadow = mem->Alloc<Ray>(1, false);
+                CHECK_NOTNULL(shadow);
+
+                light_sample_id = light_sample_offset + s;
+
+                RayUtil::makeShadow(rayin, light_sample_id, pos, wi, Lr,
+                                    isect.tfar, shadow);
+
+                sq->push(shadow);
+              }
+            }
+          }
+
+          light_sample_offset += samples_;
+
+        } else {  // point light
+          light_radiance = lights_[l]->sample(pos, &wi, &pdf);
 
           if (pdf > 0.0f) {
             costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
             Lr = Lin *
                  blinnPhong(costheta, surf_radiance, ks_, shininess_,
                             light_radiance, wi, normal_ff, wo) *
-                 (1.0f / (pdf * samples_));
+                 (1.0f / pdf);
 
             if (hasPositive(Lr)) {
-              // create shadow ray
               Ray *shadow = mem->Alloc<Ray>(1, false);
               CHECK_NOTNULL(shadow);
 
-              light_sample_id = light_sample_offset + s;
-
+              light_sample_id = light_sample_offset;
               RayUtil::makeShadow(rayin, light_sample_id, pos, wi, Lr,
                                   isect.tfar, shadow);
-
               sq->push(shadow);
             }
           }
+          ++light_sample_offset;
         }
-
-        light_sample_offset += samples_;
-
-      } else {  // point light
-        light_radiance = lights_[l]->sample(pos, &wi, &pdf);
-
-        if (pdf > 0.0f) {
-          costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
-          Lr = Lin *
-               blinnPhong(costheta, surf_radiance, ks_, shininess_,
-                          light_radiance, wi, normal_ff, wo) *
-               (1.0f / pdf);
-
-          if (hasPositive(Lr)) {
-            Ray *shadow = mem->Alloc<Ray>(1, false);
-            CHECK_NOTNULL(shadow);
-
-            light_sample_id = light_sample_offset;
-            RayUtil::makeShadow(rayin, light_sample_id, pos, wi, Lr, isect.tfar,
-                                shadow);
-            sq->push(shadow);
-          }
-        }
-        ++light_sample_offset;
       }
     }
   }  // if (!delta_dist) {
@@ -201,7 +261,7 @@ void ShaderPt<SceneT>::operator()(int domain_id, const Ray &rayin,
           wi = glm::normalize(wr);
           Lr = Lin * (fr / abs_cos_theta_i);
           if (hasPositive(Lr)) {
-            genR2(rayin, pos, wi, Lr, isect.tfar, mem, rq);
+            genR2(next_ray_depth, rayin, pos, wi, Lr, isect.tfar, mem, rq);
           }
         }
 
@@ -211,19 +271,19 @@ void ShaderPt<SceneT>::operator()(int domain_id, const Ray &rayin,
           wi = glm::normalize(wt);
           Lr = Lin * ((1.0f - fr) / abs_cos_theta_i);
           if (hasPositive(Lr)) {
-            genR2(rayin, pos, wi, Lr, isect.tfar, mem, rq);
+            genR2(next_ray_depth, rayin, pos, wi, Lr, isect.tfar, mem, rq);
           }
         }
       }
     } else {
-      RandomSampler sampler;
-      RandomSampler_init(sampler, rayin.samid * next_ray_depth);
+      PathSampler sampler;
+      initSampler(rayin, next_ray_depth, SAMPLER_STREAM_BSDF, &sampler);
 
-      bsdf->sampleRandom(normal_ff, &sampler, &wi, &pdf);
+      bsdf->sampleRandom(normal_ff, sampler.get2D(), &wi, &pdf);
       costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
       Lr = Lin * surf_radiance * SPRAY_ONE_OVER_PI * costheta / pdf;
       if (hasPositive(Lr)) {
-        genR2(rayin, pos, wi, Lr, isect.tfar, mem, rq);
+        genR2(next_ray_depth, rayin, pos, wi, Lr, isect.tfar, mem, rq);
       }
     }
   }
@@ -36,9 +36,11 @@
 #include "insitu/insitu_comm.h"
 #include "insitu/insitu_isector.h"
 #include "insitu/insitu_ray.h"
+#include "insitu/insitu_ray_codec.h"
 #include "insitu/insitu_vbuf.h"
 #include "insitu/insitu_work.h"
 #include "insitu/insitu_work_stats.h"
+#include "render/adaptive_sampler.h"
 #include "render/camera.h"
 #include "render/data_partition.h"
 #include "render/domain.h"
@@ -70,9 +72,17 @@ class SingleThreadTracer {
   void init(const Config &cfg, const Camera &camera, SceneType *scene,
             HdrImage *image);
 
+  //! Traces only the active pixels of the sampler from now on.
+  void setAdaptiveSampler(const AdaptiveSampler *sampler) {
+    adaptive_ = sampler;
+  }
+
  private:
   ShaderT shader_;
   spray::TileList tile_list_;
+
+  const spray::AdaptiveSampler *adaptive_;
+  std::vector<int> active_pixels_;  // active pixels of the stripe
   Comm<DefaultReceiver> comm_;
   VBuf vbuf_;
 
@@ -81,13 +91,16 @@ class SingleThreadTracer {
   RTCRay rtc_ray_;
 
   Tile blocking_tile_, stripe_;
+  PixelMap pixel_map_;
   RayBuf<Ray> shared_eyes_;
 
  private:
   void sendRays();
-  void send(bool shadow, int domain_id, int dest, std::queue<Ray *> *q);
+  void send(int dest, std::vector<MsgBlock> *blocks);
   void procLocalQs();
+  void procLocalQ(int id);
   void procRecvQs();
+  Ray *unpackRays(const uint8_t *packed, int64_t count);
   void procRads(int id, Ray *rays, int64_t count);
   void procShads(int id, Ray *rays, int64_t count);
 
@@ -104,6 +117,13 @@ class SingleThreadTracer {
   void populateRadWorkStats();
   void populateWorkStats();
 
+  void rebalanceDomains();
+
+  // hybrid mode
+  void pullDomains();
+  void pullDomain(int id);
+  int route(int id) const { return pulled_[id] ? rank_ : partition_->rank(id); }
+
  private:
   const spray::Camera *camera_;
   const spray::InsituPartition *partition_;
@@ -115,8 +135,9 @@ class SingleThreadTracer {
   spray::QVector<Ray *> rqs_;
   spray::QVector<Ray *> sqs_;
 
-  std::queue<msg_word_t *> recv_rq_;
-  std::queue<msg_word_t *> recv_sq_;
+  std::vector<std::vector<MsgBlock>> send_blocks_;  // [dest]
+
+  std::queue<msg_word_t *> recv_q_;
   DefaultReceiver comm_recv_;
 
   std::queue<Ray *> rq2_;
@@ -142,6 +163,19 @@ class SingleThreadTracer {
 
   WorkStats work_stats_;
 
+  bool pack_rays_;                  // --pack-rays
+  std::vector<RayPacker> packers_;  // [(domain << 1) + shadow]
+
+  float repartition_;                  // --repartition
+  int max_replicas_;                   // --replicas
+  std::vector<int64_t> domain_costs_;  // rays traced per domain this frame
+
+  // hybrid mode: remote domains traced here in the current bounce
+  bool hybrid_;
+  std::vector<uint8_t> pulled_;            // [domain]
+  std::vector<int> pulled_ids_;            // domains set in pulled_
+  std::vector<std::size_t> domain_bytes_;  // geometry size per domain
+
   spray::MemoryArena *mem_in_;
   spray::MemoryArena *mem_out_;
   spray::MemoryArena mem_0_;
@@ -155,6 +189,7 @@ class SingleThreadTracer {
   int num_ranks_;
   int num_domains_;
   int num_pixel_samples_;
+  int sampler_type_;  // PathSampler::Type
   double one_over_num_pixel_samples_;
   int num_bounces_;
   int num_threads_;
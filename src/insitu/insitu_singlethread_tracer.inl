@@ -40,16 +40,22 @@ void SingleThreadTracer<ShaderT>::init(const Config &cfg, const Camera &camera,
 
   lights_ = scene->getLights();  // copy lights
   image_ = image;
+  adaptive_ = nullptr;
 
   rank_ = rank;
   num_ranks_ = nranks;
   num_domains_ = ndomains;
   num_pixel_samples_ = cfg.pixel_samples;
+  sampler_type_ = cfg.sampler;
   one_over_num_pixel_samples_ = 1.0 / (double)num_pixel_samples_;
   num_bounces_ = cfg.bounces;
   num_threads_ = cfg.nthreads;
   image_w_ = cfg.image_w;
   image_h_ = cfg.image_h;
+  pack_rays_ = cfg.pack_rays;
+  repartition_ = cfg.repartition;
+  max_replicas_ = cfg.replicas;
+  hybrid_ = (cfg.partition == Config::HYBRID);
 
   CHECK_GT(rank_, -1);
   CHECK_GT(num_ranks_, 0);
@@ -59,7 +65,8 @@ void SingleThreadTracer<ShaderT>::init(const Config &cfg, const Camera &camera,
   CHECK_GT(image_w_, 0);
   CHECK_GT(image_h_, 0);
 
-  if (nranks > 0) comm_recv_.set(&recv_rq_, &recv_sq_);
+  if (nranks > 0) comm_recv_.set(&recv_q_);
+  comm_.init(nranks);
 
   shader_.init(cfg, scene);
 
@@ -73,11 +80,16 @@ void SingleThreadTracer<ShaderT>::init(const Config &cfg, const Camera &camera,
     std::size_t num_lights = lights_.size();
 
     total_num_light_samples = 0;
-    for (std::size_t i = 0; i < lights_.size(); ++i) {
-      if (lights_[i]->isAreaLight()) {
-        total_num_light_samples += cfg.ao_samples;
-      } else {
-        ++total_num_light_samples;
+    if (cfg.light_selection == Config::LIGHT_SELECTION_POWER) {
+      // one shadow ray per picked light
+      total_num_light_samples = cfg.sampled_lights;
+    } else {
+      for (std::size_t i = 0; i < lights_.size(); ++i) {
+        if (lights_[i]->isAreaLight()) {
+          total_num_light_samples += cfg.ao_samples;
+        } else {
+          ++total_num_light_samples;
+        }
       }
     }
   }
@@ -87,8 +99,22 @@ void SingleThreadTracer<ShaderT>::init(const Config &cfg, const Camera &camera,
 
   CHECK(!tile_list_.empty());
 
+  CHECK_LE(total_num_light_samples, SPRAY_INSITU_RAY_MAX_LIGHTS);
+  pixel_map_.init(cfg.image_w, cfg.pixel_samples);
+
   rqs_.resize(ndomains);
   sqs_.resize(ndomains);
+  send_blocks_.resize(nranks);
+  domain_costs_.resize(ndomains, 0);
+
+  pulled_.resize(ndomains, 0);
+  domain_bytes_.resize(ndomains);
+  for (const auto &d : scene->getDomains()) {
+    // vertices, normals, colors and faces held by the mesh buffer
+    domain_bytes_[d.id] = d.num_vertices * (6 * sizeof(float) + 4) +
+                          d.num_faces * 3 * sizeof(uint32_t);
+  }
+  if (pack_rays_) packers_.resize(ndomains << 1);
   work_stats_.resize(nranks, cfg.nthreads, ndomains);
 
   mem_in_ = &mem_0_;
@@ -103,75 +129,129 @@ void SingleThreadTracer<ShaderT>::init(const Config &cfg, const Camera &camera,
 template <typename ShaderT>
 void SingleThreadTracer<ShaderT>::populateRadWorkStats() {
   work_stats_.reset();
-  for (int i = 0; i < num_domains_; ++i) {
-    int dest = partition_->rank(i);
-    if (!rqs_.empty(i)) {
-      work_stats_.addNumDomains(dest, 1);
-    }
+  if (hybrid_) pullDomains();
+  for (int i = rqs_.firstNonEmpty(); i < num_domains_;
+       i = rqs_.nextNonEmpty(i + 1)) {
+    int dest = route(i);
+    work_stats_.addNumDomains(dest, 1);
   }
+  work_stats_.startReduce();
 }
 
 template <typename ShaderT>
 void SingleThreadTracer<ShaderT>::populateWorkStats() {
   work_stats_.reset();
+  if (hybrid_) pullDomains();
 
   int n = 0;
   n += (!cached_rq_.empty());
 
   work_stats_.addNumDomains(rank_, n);
 
-  for (int i = 0; i < num_domains_; ++i) {
-    int dest = partition_->rank(i);
-    n = 0;
-    n += (!rqs_.empty(i));
-    n += (!sqs_.empty(i));
-    if (n) {
-      work_stats_.addNumDomains(dest, n);
-    }
+  for (int i = rqs_.firstNonEmpty(); i < num_domains_;
+       i = rqs_.nextNonEmpty(i + 1)) {
+    int dest = route(i);
+    work_stats_.addNumDomains(dest, 1);
+  }
+
+  for (int i = sqs_.firstNonEmpty(); i < num_domains_;
+       i = sqs_.nextNonEmpty(i + 1)) {
+    int dest = route(i);
+    work_stats_.addNumDomains(dest, 1);
   }
+  work_stats_.startReduce();
 }
 
 template <typename ShaderT>
 void SingleThreadTracer<ShaderT>::sendRays() {
-  for (int i = 0; i < num_domains_; ++i) {
-    int dest = partition_->rank(i);
+  comm_.beginSendRound();
+
+  // directory of the non-empty remote queues, per destination
+  for (auto &blocks : send_blocks_) blocks.clear();
+
+  MsgBlock block;
+  block.offset = 0;
+
+  for (int i = rqs_.firstNonEmpty(); i < num_domains_;
+       i = rqs_.nextNonEmpty(i + 1)) {
+    int dest = route(i);
     if (rank_ != dest) {
-      // rads
-      auto *rq = rqs_.getQ(i);
-      if (!rq->empty()) {
-        send(false, i, dest, rq);
-      }
-      // shads
-      auto *sq = sqs_.getQ(i);
-      if (!sq->empty()) {
-        send(true, i, dest, sq);
-      }
+      block.domain_id = i;
+      block.shadow = 0;
+      block.count = rqs_.size(i);
+      send_blocks_[dest].push_back(block);
+    }
+  }
+  for (int i = sqs_.firstNonEmpty(); i < num_domains_;
+       i = sqs_.nextNonEmpty(i + 1)) {
+    int dest = route(i);
+    if (rank_ != dest) {
+      block.domain_id = i;
+      block.shadow = 1;
+      block.count = sqs_.size(i);
+      send_blocks_[dest].push_back(block);
+    }
+  }
+
+  for (int dest = 0; dest < num_ranks_; ++dest) {
+    if (!send_blocks_[dest].empty()) {
+      send(dest, &send_blocks_[dest]);
     }
   }
 }
 
 template <typename ShaderT>
-void SingleThreadTracer<ShaderT>::send(bool shadow, int domain_id, int dest,
-                                       std::queue<Ray *> *q) {
+void SingleThreadTracer<ShaderT>::send(int dest,
+                                       std::vector<MsgBlock> *blocks) {
   MsgHeader hout;
-  hout.domain_id = domain_id;
-  hout.payload_count = q->size();
+  hout.num_blocks = blocks->size();
+  hout.payload_count = 0;
+
+  // lay out the blocks, packing their rays first if needed
+  std::size_t num_units = 0;  // rays, or bytes if packed
+  for (auto &b : *blocks) {
+    b.offset = num_units;
+    if (pack_rays_) {
+      auto &packer = packers_[(b.domain_id << 1) + b.shadow];
+      packer.gather(b.shadow ? sqs_.getQ(b.domain_id) : rqs_.getQ(b.domain_id));
+      num_units += packer.getBytes();
+    } else {
+      num_units += b.count;
+    }
+    hout.payload_count += b.count;
+  }
 
-  int tag = shadow ? Work::SEND_SHADOW_RAYS : Work::SEND_RADIANCE_RAYS;
+  std::size_t bytes = pack_rays_ ? num_units : num_units * sizeof(Ray);
+#ifdef SPRAY_PROFILING_COUNTERS
+  spray::tAgg(spray::COUNTER_RAY_BYTES_SENT, bytes);
+#endif
+  bytes += RayMsg::directoryBytes(hout.num_blocks);
 
   SendQItem *item = ARENA_ALLOC(*mem_in_, SendQItem);
-  item->allocate(tag, hout, dest, mem_in_);
+  item->allocateBytes(Work::SEND_RAYS, hout, dest, bytes, comm_.getSendPool());
 
-  Ray *dest_rays = item->getPayload();
+  memcpy(RayMsg::getBlocks(item->getPayload()), &(*blocks)[0],
+         blocks->size() * sizeof(MsgBlock));
+  uint8_t *rays = RayMsg::getRays(item->getPayload(), hout.num_blocks);
+
+  for (const auto &b : *blocks) {
+    if (pack_rays_) {
+      packers_[(b.domain_id << 1) + b.shadow].encode(&rays[b.offset]);
+      continue;
+    }
 
-  std::size_t target = 0;
+    auto *q = b.shadow ? sqs_.getQ(b.domain_id) : rqs_.getQ(b.domain_id);
+    Ray *dest_rays = &((Ray *)rays)[b.offset];
 
-  while (!q->empty()) {
-    auto *ray = q->front();
-    q->pop();
+    std::size_t target = 0;
 
-    memcpy(&dest_rays[target], ray, sizeof(Ray));
-    ++target;
+    while (!q->empty()) {
+      auto *ray = q->front();
+      q->pop();
+
+      memcpy(&dest_rays[target], ray, sizeof(Ray));
+      ++target;
+    }
   }
 
   comm_.pushSendQ(item);
@@ -182,54 +262,119 @@ void SingleThreadTracer<ShaderT>::procLocalQs() {
   const auto &ids = partition_->getDomains(rank_);
 
   for (auto id : ids) {
-    auto *rq = rqs_.getQ(id);
-    auto *sq = sqs_.getQ(id);
+    procLocalQ(id);
+  }
 
-    bool rq_empty = rq->empty();
-    bool sq_empty = sq->empty();
+  for (auto id : pulled_ids_) {
+    procLocalQ(id);
+  }
+}
 
-    if (!(rq_empty && sq_empty)) {
-      scene_->load(id, &sinfo_);
+template <typename ShaderT>
+void SingleThreadTracer<ShaderT>::procLocalQ(int id) {
+  auto *rq = rqs_.getQ(id);
+  auto *sq = sqs_.getQ(id);
 
-      while (!rq->empty()) {
-        auto *ray = rq->front();
-        rq->pop();
-        procRad(id, ray);
-      }
+  bool rq_empty = rq->empty();
+  bool sq_empty = sq->empty();
 
-      while (!sq->empty()) {
-        auto *ray = sq->front();
-        sq->pop();
-        procShad(id, ray);
-      }
+  if (!(rq_empty && sq_empty)) {
+    domain_costs_[id] += rq->size() + sq->size();
+    scene_->load(id, &sinfo_);
+
+    while (!rq->empty()) {
+      auto *ray = rq->front();
+      rq->pop();
+      procRad(id, ray);
+    }
+
+    while (!sq->empty()) {
+      auto *ray = sq->front();
+      sq->pop();
+      procShad(id, ray);
     }
   }
 }
 
+template <typename ShaderT>
+void SingleThreadTracer<ShaderT>::pullDomains() {
+  for (auto id : pulled_ids_) pulled_[id] = 0;
+  pulled_ids_.clear();
+
+  for (int i = rqs_.firstNonEmpty(); i < num_domains_;
+       i = rqs_.nextNonEmpty(i + 1)) {
+    pullDomain(i);
+  }
+  for (int i = sqs_.firstNonEmpty(); i < num_domains_;
+       i = sqs_.nextNonEmpty(i + 1)) {
+    pullDomain(i);
+  }
+}
+
+template <typename ShaderT>
+void SingleThreadTracer<ShaderT>::pullDomain(int id) {
+  if (pulled_[id] || partition_->rank(id) == rank_) return;
+
+  // trace locally if loading the geometry moves fewer bytes than sending the
+  // rays, or if the geometry is cached already
+  std::size_t ray_bytes;
+  if (pack_rays_) {
+    ray_bytes = RayPacker::measure(rqs_.getQ(id)) +
+                RayPacker::measure(sqs_.getQ(id));
+  } else {
+    ray_bytes = (rqs_.size(id) + sqs_.size(id)) * sizeof(Ray);
+  }
+
+  if (ray_bytes > domain_bytes_[id] || scene_->isLoaded(id)) {
+    pulled_[id] = 1;
+    pulled_ids_.push_back(id);
+  }
+}
+
 template <typename ShaderT>
 void SingleThreadTracer<ShaderT>::procRecvQs() {
   MsgHeader *header;
   Ray *payload;
 
-  while (!recv_rq_.empty()) {
-    auto *msg = recv_rq_.front();
-    recv_rq_.pop();
+  while (!recv_q_.empty()) {
+    auto *msg = recv_q_.front();
+    recv_q_.pop();
     WorkRecvMsg<Ray, MsgHeader>::decode(msg, &header, &payload);
     CHECK_NOTNULL(payload);
-    procRads(header->domain_id, payload, header->payload_count);
-  }
 
-  while (!recv_sq_.empty()) {
-    auto *msg = recv_sq_.front();
-    recv_sq_.pop();
-    WorkRecvMsg<Ray, MsgHeader>::decode(msg, &header, &payload);
-    CHECK_NOTNULL(payload);
-    procShads(header->domain_id, payload, header->payload_count);
+    const MsgBlock *blocks = RayMsg::getBlocks(payload);
+    uint8_t *rays = RayMsg::getRays(payload, header->num_blocks);
+
+    for (int b = 0; b < header->num_blocks; ++b) {
+      const MsgBlock &block = blocks[b];
+
+      Ray *block_rays;
+      if (pack_rays_) {
+        block_rays = unpackRays(&rays[block.offset], block.count);
+      } else {
+        block_rays = &((Ray *)rays)[block.offset];
+      }
+
+      if (block.shadow) {
+        procShads(block.domain_id, block_rays, block.count);
+      } else {
+        procRads(block.domain_id, block_rays, block.count);
+      }
+    }
   }
 }
 
+template <typename ShaderT>
+Ray *SingleThreadTracer<ShaderT>::unpackRays(const uint8_t *packed,
+                                             int64_t count) {
+  Ray *rays = mem_in_->Alloc<Ray>(count, false);
+  RayCodec::decodeStrided(packed, count, 0, 1, rays);
+  return rays;
+}
+
 template <typename ShaderT>
 void SingleThreadTracer<ShaderT>::procRads(int id, Ray *rays, int64_t count) {
+  domain_costs_[id] += count;
   scene_->load(id, &sinfo_);
   for (auto i = 0; i < count; ++i) {
     auto *ray = &rays[i];
@@ -239,6 +384,7 @@ void SingleThreadTracer<ShaderT>::procRads(int id, Ray *rays, int64_t count) {
 
 template <typename ShaderT>
 void SingleThreadTracer<ShaderT>::procShads(int id, Ray *rays, int64_t count) {
+  domain_costs_[id] += count;
   scene_->load(id, &sinfo_);
   for (auto i = 0; i < count; ++i) {
     auto *ray = &rays[i];
@@ -248,11 +394,12 @@ void SingleThreadTracer<ShaderT>::procShads(int id, Ray *rays, int64_t count) {
 
 template <typename ShaderT>
 void SingleThreadTracer<ShaderT>::procRad(int id, Ray *ray) {
-  bool is_hit = scene_->intersect(sinfo_.rtc_scene, sinfo_.cache_block,
-                                  ray->org, ray->dir, &rtc_isect_);
+  bool is_hit =
+      scene_->intersectGeometry(sinfo_, ray->org, ray->dir, &rtc_isect_);
 
   if (is_hit) {
     if (vbuf_.updateTbufOut(rtc_isect_.tfar, ray)) {
+      scene_->updateIntersection(sinfo_, &rtc_isect_);
       shader_(id, *ray, rtc_isect_, mem_out_, &sq2_, &rq2_, ray_depth_);
       filterSq2(id);
       filterRq2(id);
@@ -263,8 +410,7 @@ void SingleThreadTracer<ShaderT>::procRad(int id, Ray *ray) {
 template <typename ShaderT>
 void SingleThreadTracer<ShaderT>::procShad(int id, Ray *ray) {
   if (!vbuf_.occluded(ray->samid, ray->light)) {
-    bool is_occluded =
-        scene_->occluded(sinfo_.rtc_scene, ray->org, ray->dir, &rtc_ray_);
+    bool is_occluded = scene_->occluded(sinfo_, ray->org, ray->dir, &rtc_ray_);
 
     if (is_occluded) {
       vbuf_.setObuf(ray->samid, ray->light);
@@ -280,10 +426,11 @@ void SingleThreadTracer<ShaderT>::filterRq2(int id) {
   while (!rq2_.empty()) {
     auto *ray = rq2_.front();
     rq2_.pop();
+    ++domain_costs_[id];
     auto *isect = mem_out_->Alloc<spray::RTCRayIntersection>(1, false);
     isect->tfar = SPRAY_FLOAT_INF;
-    bool is_hit = scene_->intersect(sinfo_.rtc_scene, sinfo_.cache_block,
-                                    ray->org, ray->dir, isect);
+    // attributes are interpolated in procCachedRq() if the hit survives
+    scene_->intersectGeometry(sinfo_, ray->org, ray->dir, isect);
     info.isect = isect;
     info.ray = ray;
 
@@ -298,9 +445,9 @@ void SingleThreadTracer<ShaderT>::filterSq2(int id) {
   while (!sq2_.empty()) {
     auto *ray = sq2_.front();
     sq2_.pop();
+    ++domain_costs_[id];
 
-    bool is_occluded =
-        scene_->occluded(sinfo_.rtc_scene, ray->org, ray->dir, &rtc_ray_);
+    bool is_occluded = scene_->occluded(sinfo_, ray->org, ray->dir, &rtc_ray_);
 
     if (is_occluded) {
       ray->occluded = 1;
@@ -355,9 +502,11 @@ void SingleThreadTracer<ShaderT>::procCachedRq() {
     auto *isect = info.isect;
 
     if (vbuf_.updateTbufOut(isect->tfar, ray)) {
+      scene_->load(info.domain_id, &sinfo_);
+      scene_->updateIntersection(sinfo_, isect);
+
       shader_(info.domain_id, *ray, *isect, mem_out_, &sq2_, &rq2_, ray_depth_);
 
-      scene_->load(info.domain_id, &sinfo_);
       filterSq2(info.domain_id);
       filterRq2(info.domain_id);
     }
@@ -373,32 +522,61 @@ void SingleThreadTracer<ShaderT>::procRetireQ() {
     retire_q_.pop();
 
     if (!vbuf_.occluded(ray->samid, ray->light)) {
-      image_->add(ray->pixid, ray->w, one_over_num_pixel_samples_);
+      image_->add(pixel_map_.pixid(ray->samid), ray->w,
+                  one_over_num_pixel_samples_);
     }
   }
 }
 
+template <typename ShaderT>
+void SingleThreadTracer<ShaderT>::rebalanceDomains() {
+  // every rank needs the same costs to arrive at the same assignment
+  MPI_Allreduce(MPI_IN_PLACE, &domain_costs_[0], num_domains_, MPI_INT64_T,
+                MPI_SUM, MPI_COMM_WORLD);
+
+  if (repartition_ > 0.f) scene_->repartition(domain_costs_, repartition_);
+  if (max_replicas_ > 0) scene_->replicate(domain_costs_, max_replicas_);
+
+  std::fill(domain_costs_.begin(), domain_costs_.end(), 0);
+}
+
 template <typename ShaderT>
 void SingleThreadTracer<ShaderT>::trace() {
+  if (adaptive_) shader_.setPass(adaptive_->getPass());
+
   while (!tile_list_.empty()) {
     tile_list_.front(&blocking_tile_, &stripe_);
     tile_list_.pop();
+    pixel_map_.setBlockingTile(blocking_tile_);
+    shader_.setBlockingTile(blocking_tile_);
 
     vbuf_.resetTbufOut();
     vbuf_.resetObuf();
 
-    shared_eyes_.num =
-        (std::size_t)(stripe_.w * stripe_.h) * num_pixel_samples_;
+    if (adaptive_) {
+      adaptive_->getActivePixels(blocking_tile_, stripe_, &active_pixels_);
+      shared_eyes_.num = active_pixels_.size() * num_pixel_samples_;
+    } else {
+      shared_eyes_.num =
+          (std::size_t)(stripe_.w * stripe_.h) * num_pixel_samples_;
+    }
     if (shared_eyes_.num) {
       shared_eyes_.rays = mem_in_->Alloc<Ray>(shared_eyes_.num);
     }
 
     if (shared_eyes_.num) {
       glm::vec3 cam_pos = camera_->getPosition();
-      if (num_pixel_samples_ > 1) {  // multi samples
+      if (adaptive_) {
+        spray::insitu::genAdaptiveEyeRays(
+            *camera_, image_w_, cam_pos[0], cam_pos[1], cam_pos[2],
+            num_pixel_samples_, sampler_type_, adaptive_->getPass(),
+            blocking_tile_, active_pixels_, &shared_eyes_);
+
+      } else if (num_pixel_samples_ > 1) {  // multi samples
         spray::insitu::genMultiSampleEyeRays(
             *camera_, image_w_, cam_pos[0], cam_pos[1], cam_pos[2],
-            num_pixel_samples_, blocking_tile_, stripe_, &shared_eyes_);
+            num_pixel_samples_, sampler_type_, blocking_tile_, stripe_,
+            &shared_eyes_);
 
       } else {  // single sample
         spray::insitu::genSingleSampleEyeRays(
@@ -414,7 +592,16 @@ void SingleThreadTracer<ShaderT>::trace() {
     ray_depth_ = 0;
 
     while (1) {
-      work_stats_.reduce();
+      // pack outgoing rays while the block count reduction is in flight.
+      // nothing is packed once all ranks are done.
+      if (num_ranks_ > 1) {
+#ifdef SPRAY_GLOG_CHECK
+        CHECK(comm_.emptySendQ());
+#endif
+        sendRays();
+      }
+
+      work_stats_.finishReduce();
 
       if (work_stats_.allDone()) {
         procRetireQ();
@@ -423,12 +610,8 @@ void SingleThreadTracer<ShaderT>::trace() {
       }
 
       if (num_ranks_ > 1) {
-#ifdef SPRAY_GLOG_CHECK
-        CHECK(comm_.emptySendQ());
-#endif
-        sendRays();
         comm_.waitForSend();
-        comm_.run(work_stats_, mem_in_, &comm_recv_);
+        comm_.run(work_stats_, &comm_recv_);
       }
 
       procCachedRq();
@@ -463,6 +646,20 @@ void SingleThreadTracer<ShaderT>::trace() {
     }
   }
   tile_list_.reset();
+
+  if ((repartition_ > 0.f || max_replicas_ > 0) && num_ranks_ > 1) {
+    rebalanceDomains();
+  }
+
+#ifdef SPRAY_PROFILING_COUNTERS
+  spray::tAgg(spray::COUNTER_RAY_MEM,
+              mem_0_.TotalAllocated() + mem_1_.TotalAllocated());
+
+  uint64_t num_reused, num_allocated;
+  comm_.takeBufferStats(&num_reused, &num_allocated);
+  spray::tAgg(spray::COUNTER_MSG_BUFFERS_REUSED, num_reused);
+  spray::tAgg(spray::COUNTER_MSG_BUFFERS_ALLOCATED, num_allocated);
+#endif
 }
 
 }  // namespace insitu
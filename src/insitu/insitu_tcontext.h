@@ -24,6 +24,7 @@
 
 #include "insitu/insitu_isector.h"
 #include "insitu/insitu_ray.h"
+#include "insitu/insitu_ray_codec.h"
 #include "insitu/insitu_vbuf.h"
 #include "insitu/insitu_work_stats.h"
 #include "render/config.h"
@@ -96,9 +97,22 @@ class TContext {
 
   spray::MemoryArena* getMemIn() { return mem_in_; }
 
+  //! Bytes held by the ray arenas. Arenas keep their blocks across resets, so
+  //! this is the high-water mark so far.
+  std::size_t getMemBytes() const {
+    return mem_0_.TotalAllocated() + mem_1_.TotalAllocated();
+  }
+
+  void setBlockingTile(const Tile& blocking_tile) {
+    pixel_map_.setBlockingTile(blocking_tile);
+    shader_.setBlockingTile(blocking_tile);
+  }
+
+  void setPass(int pass) { shader_.setPass(pass); }
+
   void isectDomains(Ray* ray) {
 #ifdef SPRAY_GLOG_CHECK
-    CHECK_LT(ray->pixid, image_->w * image_->h);
+    CHECK_LT(ray->samid, vbuf_->getTbufSize());
 #endif
     isector_.intersect(scene_, ray, &rqs_);
   }
@@ -129,6 +143,7 @@ class TContext {
   void retireShadows(const VBuf& vbuf);
 
   void sendRays(bool shadow, int id, Ray* rays);
+  void packRays(bool shadow, int id, RayPacker* packer);
 
   bool isLocalQsEmpty(int id) const {
     return (rqs_.empty(id) && sqs_.empty(id));
@@ -137,6 +152,12 @@ class TContext {
   std::size_t getRqSize(int id) const { return rqs_.size(id); }
   std::size_t getSqSize(int id) const { return sqs_.size(id); }
 
+  //! Rays traced against each domain since the last reset.
+  const std::vector<int64_t>& getDomainCosts() const { return domain_costs_; }
+  void resetDomainCosts() {
+    std::fill(domain_costs_.begin(), domain_costs_.end(), 0);
+  }
+
   // debug
   void flushRqs() { rqs_.flush(); }
 
@@ -182,6 +203,7 @@ class TContext {
   SceneType* scene_;
   VBuf* vbuf_;
   spray::HdrImage* image_;
+  PixelMap pixel_map_;
 
   SceneInfo sinfo_;
 
@@ -196,6 +218,8 @@ class TContext {
   Qvector rqs_;
   Qvector sqs_;
 
+  std::vector<int64_t> domain_costs_;  // rays traced per domain
+
   RayQ rq2_;
   RayQ sq2_;
 
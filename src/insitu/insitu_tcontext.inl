@@ -35,9 +35,11 @@ void TContext<ShaderT>::init(const Config& cfg, int ndomains,
   scene_ = scene;
   vbuf_ = vbuf;
   image_ = image;
+  pixel_map_.init(cfg.image_w, cfg.pixel_samples);
 
   rqs_.resize(ndomains);
   sqs_.resize(ndomains);
+  domain_costs_.resize(ndomains, 0);
 
   shader_.init(cfg, scene);
 
@@ -50,10 +52,9 @@ void TContext<ShaderT>::populateRadWorkStats() {
 #ifdef SPRAY_GLOG_CHECK
   CHECK(work_stats_.empty());
 #endif
-  for (int id = 0; id < num_domains_; ++id) {
-    if (!rqs_.empty(id)) {
-      work_stats_.registerRadianceRayBlock(id);
-    }
+  for (int id = rqs_.firstNonEmpty(); id < num_domains_;
+       id = rqs_.nextNonEmpty(id + 1)) {
+    work_stats_.registerRadianceRayBlock(id);
   }
 }
 
@@ -62,13 +63,13 @@ void TContext<ShaderT>::populateWorkStats() {
 #ifdef SPRAY_GLOG_CHECK
   CHECK(work_stats_.empty());
 #endif
-  for (int id = 0; id < num_domains_; ++id) {
-    if (!rqs_.empty(id)) {
-      work_stats_.registerRadianceRayBlock(id);
-    }
-    if (!sqs_.empty(id)) {
-      work_stats_.registerShadowRayBlock(id);
-    }
+  for (int id = rqs_.firstNonEmpty(); id < num_domains_;
+       id = rqs_.nextNonEmpty(id + 1)) {
+    work_stats_.registerRadianceRayBlock(id);
+  }
+  for (int id = sqs_.firstNonEmpty(); id < num_domains_;
+       id = sqs_.nextNonEmpty(id + 1)) {
+    work_stats_.registerShadowRayBlock(id);
   }
   bool has_cached_block = !cached_rq_.empty();
   work_stats_.registerCachedRayBlock(has_cached_block);
@@ -84,9 +85,11 @@ void TContext<ShaderT>::processRays(int rank, int ray_depth) {
     auto* isect = info.isect;
 
     if (vbuf_->updateTbufOut(isect->tfar, ray)) {
+      scene_->load(info.domain_id, &sinfo_);
+      scene_->updateIntersection(sinfo_, isect);
+
       shader_(info.domain_id, *ray, *isect, mem_out_, &sq2_, &rq2_, ray_depth);
 
-      scene_->load(info.domain_id, &sinfo_);
       filterSq2(info.domain_id);
       filterRq2(info.domain_id);
     }
@@ -105,6 +108,7 @@ void TContext<ShaderT>::processRays(int rank, int ray_depth) {
     bool sq_empty = sq->empty();
 
     if (!(rq_empty && sq_empty)) {
+      domain_costs_[id] += rq->size() + sq->size();
       scene_->load(id, &sinfo_);
 
       while (!rq->empty()) {
@@ -124,10 +128,11 @@ void TContext<ShaderT>::processRays(int rank, int ray_depth) {
 
 template <typename ShaderT>
 void TContext<ShaderT>::processRadiance(int id, int ray_depth, Ray* ray) {
-  bool is_hit = scene_->intersect(sinfo_.rtc_scene, sinfo_.cache_block,
-                                  ray->org, ray->dir, &rtc_isect_);
+  bool is_hit =
+      scene_->intersectGeometry(sinfo_, ray->org, ray->dir, &rtc_isect_);
   if (is_hit) {
     if (vbuf_->updateTbufOut(rtc_isect_.tfar, ray)) {
+      scene_->updateIntersection(sinfo_, &rtc_isect_);
       shader_(id, *ray, rtc_isect_, mem_out_, &sq2_, &rq2_, ray_depth);
       filterSq2(id);
       filterRq2(id);
@@ -138,8 +143,7 @@ void TContext<ShaderT>::processRadiance(int id, int ray_depth, Ray* ray) {
 template <typename ShaderT>
 void TContext<ShaderT>::processShadow(int id, Ray* ray) {
   if (!vbuf_->occluded(ray->samid, ray->light)) {
-    bool is_occluded =
-        scene_->occluded(sinfo_.rtc_scene, ray->org, ray->dir, &rtc_ray_);
+    bool is_occluded = scene_->occluded(sinfo_, ray->org, ray->dir, &rtc_ray_);
 
     if (is_occluded) {
       vbuf_->setObuf(ray->samid, ray->light);
@@ -154,9 +158,9 @@ void TContext<ShaderT>::filterSq2(int id) {
   while (!sq2_.empty()) {
     auto* ray = sq2_.front();
     sq2_.pop();
+    ++domain_costs_[id];
 
-    bool is_occluded =
-        scene_->occluded(sinfo_.rtc_scene, ray->org, ray->dir, &rtc_ray_);
+    bool is_occluded = scene_->occluded(sinfo_, ray->org, ray->dir, &rtc_ray_);
 
     if (is_occluded) {
       ray->occluded = 1;
@@ -174,10 +178,11 @@ void TContext<ShaderT>::filterRq2(int id) {
   while (!rq2_.empty()) {
     auto* ray = rq2_.front();
     rq2_.pop();
+    ++domain_costs_[id];
     auto* isect = mem_out_->Alloc<spray::RTCRayIntersection>(1, false);
     isect->tfar = SPRAY_FLOAT_INF;
-    bool is_hit = scene_->intersect(sinfo_.rtc_scene, sinfo_.cache_block,
-                                    ray->org, ray->dir, isect);
+    // attributes are interpolated in processRays() if the hit survives
+    scene_->intersectGeometry(sinfo_, ray->org, ray->dir, isect);
     info.isect = isect;
     info.ray = ray;
 
@@ -225,7 +230,8 @@ void TContext<ShaderT>::retireUntouched() {
   while (!retire_q_.empty()) {
     auto* ray = retire_q_.front();
     retire_q_.pop();
-    image_->add(ray->pixid, ray->w, one_over_num_pixel_samples_);
+    image_->add(pixel_map_.pixid(ray->samid), ray->w,
+                one_over_num_pixel_samples_);
   }
 }
 
@@ -235,7 +241,8 @@ void TContext<ShaderT>::retireShadows(const VBuf& vbuf) {
     auto* ray = retire_q_.front();
     retire_q_.pop();
     if (!vbuf.occluded(ray->samid, ray->light)) {
-      image_->add(ray->pixid, ray->w, one_over_num_pixel_samples_);
+      image_->add(pixel_map_.pixid(ray->samid), ray->w,
+                  one_over_num_pixel_samples_);
     }
   }
 }
@@ -260,6 +267,11 @@ void TContext<ShaderT>::sendRays(bool shadow, int id, Ray* rays) {
   }
 }
 
+template <typename ShaderT>
+void TContext<ShaderT>::packRays(bool shadow, int id, RayPacker* packer) {
+  packer->gather(shadow ? sqs_.getQ(id) : rqs_.getQ(id));
+}
+
 template <typename ShaderT>
 void TContext<ShaderT>::compositeThreadTbufs(int tid,
                                              std::vector<VBuf>* vbufs) {
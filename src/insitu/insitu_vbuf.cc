@@ -18,10 +18,14 @@
 //                                                                            //
 // ========================================================================== //
 
+#include <algorithm>
+#include <cstring>
+
 #include "glog/logging.h"
 
 #include "insitu/insitu_ray.h"
 #include "insitu/insitu_vbuf.h"
+#include "utils/comm.h"
 
 namespace spray {
 namespace insitu {
@@ -101,6 +105,148 @@ bool VBuf::occluded(int samid, int light) const {
   return ((o >> bit) & 1);
 }
 
+namespace {
+
+template <typename T>
+inline uint64_t packEntry(std::size_t index, T value) {
+  static_assert(sizeof(T) == sizeof(uint32_t), "32-bit vbuf entries only");
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return ((uint64_t)index << 32) | bits;
+}
+
+inline std::size_t entryIndex(uint64_t entry) { return entry >> 32; }
+
+template <typename T>
+inline T entryValue(uint64_t entry) {
+  uint32_t bits = (uint32_t)entry;
+  T value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// exclusive prefix sum of the counts. returns the total.
+inline int makeDispls(const std::vector<int>& counts,
+                      std::vector<int>* displs) {
+  int sum = 0;
+  for (std::size_t i = 0; i < counts.size(); ++i) {
+    (*displs)[i] = sum;
+    sum += counts[i];
+  }
+  return sum;
+}
+
+}  // namespace
+
+template <typename T, typename ReduceT>
+bool VBuf::compositeSparse(T* buf, std::size_t size, T empty, ReduceT reduce) {
+  const int nranks = mpi::size();
+  const int rank = mpi::rank();
+  const std::size_t range = (size + nranks - 1) / nranks;
+
+  send_counts_.resize(nranks);
+  send_displs_.resize(nranks);
+  recv_counts_.resize(nranks);
+  recv_displs_.resize(nranks);
+
+  // count dirty entries per owner
+  for (int r = 0; r < nranks; ++r) send_counts_[r] = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    if (buf[i] != empty) ++send_counts_[i / range];
+  }
+  long num_dirty = makeDispls(send_counts_, &send_displs_);
+
+  long total_dirty;
+  MPI_Allreduce(&num_dirty, &total_dirty, 1, MPI_LONG, MPI_SUM,
+                MPI_COMM_WORLD);
+
+  if ((double)total_dirty > SPRAY_INSITU_VBUF_SPARSE_FILL * (double)size) {
+    return false;
+  }
+
+  // entries are visited in index order, so each owner's block is contiguous
+  send_entries_.resize(num_dirty);
+  std::size_t n = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    if (buf[i] != empty) send_entries_[n++] = packEntry(i, buf[i]);
+  }
+
+  // reduce-scatter by ownership
+  MPI_Alltoall(send_counts_.data(), 1, MPI_INT, recv_counts_.data(), 1,
+               MPI_INT, MPI_COMM_WORLD);
+  int num_recv = makeDispls(recv_counts_, &recv_displs_);
+  recv_entries_.resize(num_recv);
+
+  MPI_Alltoallv(send_entries_.data(), send_counts_.data(),
+                send_displs_.data(), MPI_UINT64_T, recv_entries_.data(),
+                recv_counts_.data(), recv_displs_.data(), MPI_UINT64_T,
+                MPI_COMM_WORLD);
+
+  for (uint64_t e : recv_entries_) {
+    std::size_t i = entryIndex(e);
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_EQ(i / range, (std::size_t)rank);
+#endif
+    buf[i] = reduce(buf[i], entryValue<T>(e));
+  }
+
+  // allgather the reduced dirty entries of the owned range
+  std::size_t begin = std::min(size, rank * range);
+  std::size_t end = std::min(size, begin + range);
+
+  send_entries_.clear();
+  for (std::size_t i = begin; i < end; ++i) {
+    if (buf[i] != empty) send_entries_.push_back(packEntry(i, buf[i]));
+  }
+  int num_send = send_entries_.size();
+
+  MPI_Allgather(&num_send, 1, MPI_INT, recv_counts_.data(), 1, MPI_INT,
+                MPI_COMM_WORLD);
+  num_recv = makeDispls(recv_counts_, &recv_displs_);
+  recv_entries_.resize(num_recv);
+
+  MPI_Allgatherv(send_entries_.data(), num_send, MPI_UINT64_T,
+                 recv_entries_.data(), recv_counts_.data(),
+                 recv_displs_.data(), MPI_UINT64_T, MPI_COMM_WORLD);
+
+  // entries that are empty everywhere are already empty here
+  for (uint64_t e : recv_entries_) {
+    buf[entryIndex(e)] = entryValue<T>(e);
+  }
+  return true;
+}
+
+void VBuf::compositeTbuf() {
+#ifdef SPRAY_TIMING
+  spray::tStartMPI(spray::TIMER_SYNC_VBUF);
+#endif
+  bool sparse =
+      compositeSparse(tbuf_out_, tbuf_size_, SPRAY_FLOAT_INF,
+                      [](float a, float b) { return std::min(a, b); });
+  if (!sparse) {
+    MPI_Allreduce(MPI_IN_PLACE, tbuf_out_, tbuf_size_, MPI_FLOAT, MPI_MIN,
+                  MPI_COMM_WORLD);
+  }
+#ifdef SPRAY_TIMING
+  spray::tStop(spray::TIMER_SYNC_VBUF);
+#endif
+}
+
+void VBuf::compositeObuf() {
+#ifdef SPRAY_TIMING
+  spray::tStartMPI(spray::TIMER_SYNC_VBUF);
+#endif
+  bool sparse = compositeSparse(obuf_, obuf_size_, (uint32_t)0,
+                                [](uint32_t a, uint32_t b) { return a | b; });
+  if (!sparse) {
+    MPI_Allreduce(MPI_IN_PLACE, obuf_, obuf_size_, MPI_UINT32_T, MPI_BOR,
+                  MPI_COMM_WORLD);
+  }
+#ifdef SPRAY_TIMING
+  spray::tStop(spray::TIMER_SYNC_VBUF);
+#endif
+}
+
 void VBuf::colorTbuf(spray::HdrImage* image) {
   float color[3];
   color[0] = color[1] = color[2] = 0.5f;
@@ -32,6 +32,12 @@
 #include "render/tile.h"
 #include "utils/profiler_util.h"
 
+//! Largest fraction of dirty vbuf entries, summed over ranks, for which the
+//! vbuf is composited sparsely.
+#ifndef SPRAY_INSITU_VBUF_SPARSE_FILL
+#define SPRAY_INSITU_VBUF_SPARSE_FILL 0.25
+#endif
+
 namespace spray {
 namespace insitu {
 
@@ -106,27 +112,14 @@ class VBuf {
 
   bool occluded(int samid, int light) const;
 
-  void compositeTbuf() {
-#ifdef SPRAY_TIMING
-    spray::tStartMPI(spray::TIMER_SYNC_VBUF);
-#endif
-    MPI_Allreduce(MPI_IN_PLACE, tbuf_out_, tbuf_size_, MPI_FLOAT, MPI_MIN,
-                  MPI_COMM_WORLD);
-#ifdef SPRAY_TIMING
-    spray::tStop(spray::TIMER_SYNC_VBUF);
-#endif
-  }
+  /**
+   * Min-reduces tbuf_out_ across ranks. Only dirty (non-inf) entries are
+   * exchanged if there are few of them. See compositeSparse().
+   */
+  void compositeTbuf();
 
-  void compositeObuf() {
-#ifdef SPRAY_TIMING
-    spray::tStartMPI(spray::TIMER_SYNC_VBUF);
-#endif
-    MPI_Allreduce(MPI_IN_PLACE, obuf_, obuf_size_, MPI_UINT32_T, MPI_BOR,
-                  MPI_COMM_WORLD);
-#ifdef SPRAY_TIMING
-    spray::tStop(spray::TIMER_SYNC_VBUF);
-#endif
-  }
+  //! Or-reduces the occlusion bits across ranks, sparsely if possible.
+  void compositeObuf();
 
   float getTbufOut(int samid) const { return tbuf_out_[samid]; }
   void setTbufOut(int samid, float t) { tbuf_out_[samid] = t; }
@@ -160,6 +153,20 @@ class VBuf {
 
   std::size_t obufIndex(int samid, int light, std::size_t* bit) const;
 
+  /**
+   * Reduces the dirty entries of buf across ranks in place. Each rank owns a
+   * contiguous range of the buffer. Dirty entries are sent to the owners of
+   * their ranges (reduce-scatter), and the reduced dirty entries of each range
+   * are then gathered by all ranks.
+   *
+   * \param empty Value of an untouched entry.
+   * \return false without touching buf if the dirty entries summed over all
+   *         ranks exceed SPRAY_INSITU_VBUF_SPARSE_FILL of the buffer, in
+   *         which case the caller runs the dense reduction.
+   */
+  template <typename T, typename ReduceT>
+  bool compositeSparse(T* buf, std::size_t size, T empty, ReduceT reduce);
+
  private:
   float* tbuf_0_;
   float* tbuf_1_;
@@ -177,6 +184,14 @@ class VBuf {
   spray::Tile tile_;
   int num_pixel_samples_;
   int total_num_light_samples_;
+
+  // sparse composition. entries are packed as (index << 32 | value bits).
+  std::vector<uint64_t> send_entries_;
+  std::vector<uint64_t> recv_entries_;
+  std::vector<int> send_counts_;
+  std::vector<int> send_displs_;
+  std::vector<int> recv_counts_;
+  std::vector<int> recv_displs_;
 };
 
 }  // namespace insitu
@@ -23,6 +23,8 @@
 #include <mpi.h>
 
 #include "pbrt/memory.h"
+
+#include "insitu/insitu_msg_pool.h"
 #include "utils/comm.h"
 
 namespace spray {
@@ -30,16 +32,38 @@ namespace insitu {
 
 class VBuf;
 
+/**
+ * Ray messages are coalesced per destination rank. A message holds the
+ * header, a directory of num_blocks MsgBlock entries, one per domain and ray
+ * kind, and then the rays of all blocks (see RayMsg).
+ */
 struct MsgHeader {
+  int num_blocks;
+  int64_t payload_count;  // total number of rays
+};
+
+struct MsgBlock {
   int domain_id;
-  int64_t payload_count;
+  int shadow;      // 0: radiance rays, 1: shadow rays
+  int64_t offset;  // in rays, or in bytes if the rays are packed
+  int64_t count;   // number of rays
+};
+
+struct RayMsg {
+  //! Directory size, padded to keep the rays 16-byte aligned.
+  static std::size_t directoryBytes(int num_blocks) {
+    return (num_blocks * sizeof(MsgBlock) + 15) & ~(std::size_t)15;
+  }
+  static MsgBlock* getBlocks(void* payload) { return (MsgBlock*)payload; }
+  static uint8_t* getRays(void* payload, int num_blocks) {
+    return (uint8_t*)payload + directoryBytes(num_blocks);
+  }
 };
 
 class Work {
  public:
   enum Type {
-    SEND_SHADOW_RAYS,
-    SEND_RADIANCE_RAYS,
+    SEND_RAYS,
     MSG_TERMINATE,
   };
 
@@ -87,6 +111,29 @@ class WorkSendMsg : public Work {
     allocMsg(header, mem);
   }
 
+  //! Allocates payload_bytes of payload instead of header.payload_count
+  //! records, for packed encodings of the payload.
+  void allocateBytes(int work_type, const HeaderT& header, int dest,
+                     std::size_t payload_bytes, MemoryArena* mem) {
+    setType(work_type);
+    header_ = header;
+    dest_ = dest;
+    allocMsgBytes(header, payload_bytes, mem);
+  }
+
+  //! Same as above, but takes the message from a pool of reused buffers.
+  void allocateBytes(int work_type, const HeaderT& header, int dest,
+                     std::size_t payload_bytes, MsgPool* pool) {
+    setType(work_type);
+    header_ = header;
+    dest_ = dest;
+
+    std::size_t word_count = wordCount(sizeof(HeaderT) + payload_bytes);
+    msg_ = pool->get(dest, word_count);
+    count_ = static_cast<int>(word_count);
+    setHeader(header);
+  }
+
   const HeaderT& getHeader() const { return header_; }
   PayloadT* getPayload() { return payload_; }
 
@@ -97,20 +144,32 @@ class WorkSendMsg : public Work {
  private:
   // update: msg_, count_, payload_
   void allocMsg(const HeaderT& header, MemoryArena* mem) {
-    std::size_t bytes =
-        sizeof(HeaderT) + (header.payload_count * sizeof(PayloadT));
+    allocMsgBytes(header, header.payload_count * sizeof(PayloadT), mem);
+  }
+
+  void allocMsgBytes(const HeaderT& header, std::size_t payload_bytes,
+                     MemoryArena* mem) {
+    std::size_t bytes = sizeof(HeaderT) + payload_bytes;
 
     allocMem(bytes, mem);
+    setHeader(header);
+  }
 
+  void setHeader(const HeaderT& header) {
     HeaderT* tmp = (HeaderT*)msg_;
     *tmp = header;
     payload_ = (PayloadT*)(tmp + 1);
   }
 
-  void allocMem(std::size_t bytes, MemoryArena* mem) {
+  static std::size_t wordCount(std::size_t bytes) {
     std::size_t word_size = sizeof(msg_word_t);
     std::size_t word_count = (bytes + word_size - 1) / word_size;
     CHECK_LT(word_count, INT_MAX);
+    return word_count;
+  }
+
+  void allocMem(std::size_t bytes, MemoryArena* mem) {
+    std::size_t word_count = wordCount(bytes);
     msg_ = mem->Alloc<msg_word_t>(word_count, false);
     CHECK_NOTNULL(msg_);
     count_ = static_cast<int>(word_count);
@@ -31,53 +31,55 @@
 namespace spray {
 namespace insitu {
 
-void WorkStats::reduce() {
-  if (mpi::size() == 1) {
-    scatter_buf_[0].world_num_blocks_to_proc = reduce_buf_[0];
-    scatter_buf_[0].rank_num_blocks_to_proc = reduce_buf_[0];
-    return;
-  }
+void WorkStats::startReduce() {
+#ifdef SPRAY_GLOG_CHECK
+  CHECK(!reducing_);
+#endif
+  // one coalesced message per destination with any block
+  for (auto& n : reduce_buf_) n = (n > 0);
 
   int rank = mpi::rank();
+  num_blocks_already_owned_ = reduce_buf_[rank];
 
-  int num_blocks_already_owned = reduce_buf_[rank];
-
-#ifdef SPRAY_TIMING
-  spray::tStartMPI(spray::TIMER_SYNC_SCHED);
-#endif
-  if (rank == 0) {
-    MPI_Reduce(MPI_IN_PLACE, &reduce_buf_[0], reduce_buf_.size(), MPI_INT,
-               MPI_SUM, 0, MPI_COMM_WORLD);
-
-    int sum = 0;
-    for (int num_blocks_to_recv : reduce_buf_) {
-      sum += num_blocks_to_recv;
-    }
+  if (mpi::size() == 1) {
+    recv_buf_[0] = reduce_buf_[0];
+    recv_buf_[1] = reduce_buf_[0];
+    reducing_ = true;
+    return;
+  }
 
-    int num_ranks = mpi::size();
+  int local_sum = 0;
+  for (int num_blocks : reduce_buf_) {
+    local_sum += num_blocks;
+  }
 
-    for (int i = 0; i < num_ranks; ++i) {
-      scatter_buf_[i].world_num_blocks_to_proc = sum;
-      scatter_buf_[i].rank_num_blocks_to_proc = reduce_buf_[i];
-    }
+  int num_ranks = mpi::size();
+  for (int i = 0; i < num_ranks; ++i) {
+    send_buf_[i << 1] = reduce_buf_[i];
+    send_buf_[(i << 1) + 1] = local_sum;
+  }
 
-    MPI_Scatter(&scatter_buf_[0], sizeof(ScatterEntry), MPI_UNSIGNED_CHAR,
-                MPI_IN_PLACE /*recvbuf*/, 0 /*recvcount*/, MPI_UNSIGNED_CHAR, 0,
-                MPI_COMM_WORLD);
+  MPI_Ireduce_scatter_block(&send_buf_[0], recv_buf_, 2, MPI_INT, MPI_SUM,
+                            MPI_COMM_WORLD, &request_);
+  reducing_ = true;
+}
 
-  } else {
-    MPI_Reduce(&reduce_buf_[0], nullptr, reduce_buf_.size(), MPI_INT, MPI_SUM,
-               0, MPI_COMM_WORLD);
+void WorkStats::finishReduce() {
+  if (!reducing_) startReduce();
 
-    MPI_Scatter(nullptr, 0, MPI_UNSIGNED_CHAR, &scatter_buf_[rank],
-                sizeof(ScatterEntry), MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+#ifdef SPRAY_TIMING
+  spray::tStart(spray::TIMER_SYNC_SCHED);
+#endif
+  if (request_ != MPI_REQUEST_NULL) {
+    MPI_Wait(&request_, MPI_STATUS_IGNORE);
   }
-
-  num_blocks_to_recv_ =
-      (scatter_buf_[rank].rank_num_blocks_to_proc - num_blocks_already_owned);
 #ifdef SPRAY_TIMING
   spray::tStop(spray::TIMER_SYNC_SCHED);
 #endif
+  reducing_ = false;
+
+  world_num_blocks_to_proc_ = recv_buf_[1];
+  num_blocks_to_recv_ = recv_buf_[0] - num_blocks_already_owned_;
 
 #ifdef SPRAY_GLOG_CHECK
   CHECK_GE(num_blocks_to_recv_, 0);
@@ -35,24 +35,41 @@ class InsituPartition;
 
 namespace insitu {
 
+/**
+ * Cluster-wide message counts for one bounce.
+ *
+ * Each rank counts the ray blocks it sends to every rank. The blocks for one
+ * rank travel in a single coalesced message, so the reduction sums one
+ * message per destination with any block. The counts are summed with a
+ * nonblocking reduce-scatter, so that each rank receives the number of
+ * messages it must receive and the world total without going through a
+ * root rank. startReduce() posts the reduction as soon as the local counts
+ * are known and finishReduce() completes it, so the work issued in between
+ * (e.g. packing outgoing rays) hides the collective latency.
+ */
 class WorkStats {
  private:
-  struct ScatterEntry {
-    int world_num_blocks_to_proc;
-    int rank_num_blocks_to_proc;
-  };
-
   // number of blocks to recv for each rank
-  std::vector<int> reduce_buf_;            // per-rank
-  std::vector<int> block_counters_;        // per-domain
-  std::vector<ScatterEntry> scatter_buf_;  // per-rank
+  std::vector<int> reduce_buf_;      // per-rank
+  std::vector<int> block_counters_;  // per-domain
+
+  // reduce-scatter input: {blocks to rank i, local total} for each rank i
+  std::vector<int> send_buf_;  // per-rank pairs
+  // reduce-scatter output: {blocks to this rank, world total}
+  int recv_buf_[2];
 
  public:
-  WorkStats() : ndomains_(0), num_blocks_to_recv_(0) {}
+  WorkStats()
+      : ndomains_(0),
+        num_blocks_to_recv_(0),
+        num_blocks_already_owned_(0),
+        world_num_blocks_to_proc_(0),
+        reducing_(false),
+        request_(MPI_REQUEST_NULL) {}
 
   void resize(int nranks, int nthreads, int ndomains) {
     reduce_buf_.resize(nranks, 0);
-    scatter_buf_.resize(nranks);
+    send_buf_.resize(nranks << 1, 0);
 
     ndomains_ = ndomains;
     // bug fix: seg faults occuring with the following conditional statement
@@ -75,18 +92,31 @@ class WorkStats {
  private:
   int ndomains_;
   int num_blocks_to_recv_;
+  int num_blocks_already_owned_;
+  int world_num_blocks_to_proc_;
+
+  bool reducing_;
+  MPI_Request request_;
 
  public:
   // cluster level reduction
-  void reduce();
+
+  //! Posts the reduction of the current local counts. Returns immediately.
+  void startReduce();
+
+  /**
+   * Completes the reduction posted by startReduce(). Posts one first if
+   * startReduce() was not called since the last completion, so that every
+   * rank joins the same sequence of collectives.
+   */
+  void finishReduce();
+
   bool recvDone(int num_blocks_recved) const {
     return (num_blocks_recved == num_blocks_to_recv_);
   }
 
  public:
-  bool allDone() const {
-    return (scatter_buf_[mpi::rank()].world_num_blocks_to_proc == 0);
-  }
+  bool allDone() const { return (world_num_blocks_to_proc_ == 0); }
 
  public:
   template <typename TContextT>
@@ -97,7 +97,7 @@ void SceneLoader::parseMaterial(const std::vector<std::string>& tokens) {
     albedo[1] = atof(tokens[3].c_str());
     albedo[2] = atof(tokens[4].c_str());
 
-    d.bsdf = new DiffuseBsdf(albedo);
+    d.bsdf = new Bsdf(Bsdf::makeDiffuse(albedo));
 
   } else if (tokens[1] == "mirror") {
     // mtl mirror reflectance<r g b>
@@ -108,7 +108,7 @@ void SceneLoader::parseMaterial(const std::vector<std::string>& tokens) {
     reflectance[1] = atof(tokens[3].c_str());
     reflectance[2] = atof(tokens[4].c_str());
 
-    d.bsdf = new MirrorBsdf(reflectance);
+    d.bsdf = new Bsdf(Bsdf::makeMirror(reflectance));
 
   } else if (tokens[1] == "glass") {
     // mtl mirror etaA etaB
@@ -117,7 +117,7 @@ void SceneLoader::parseMaterial(const std::vector<std::string>& tokens) {
     float eta_a = atof(tokens[2].c_str());
     float eta_b = atof(tokens[3].c_str());
 
-    d.bsdf = new GlassBsdf(eta_a, eta_b);
+    d.bsdf = new Bsdf(Bsdf::makeGlass(eta_a, eta_b));
 
   } else if (tokens[1] == "transmission") {
     // mtl transmission etaA etaB
@@ -126,7 +126,7 @@ void SceneLoader::parseMaterial(const std::vector<std::string>& tokens) {
     float eta_a = atof(tokens[2].c_str());
     float eta_b = atof(tokens[3].c_str());
 
-    d.bsdf = new TransmissionBsdf(eta_a, eta_b);
+    d.bsdf = new Bsdf(Bsdf::makeTransmission(eta_a, eta_b));
 
   } else {
     LOG(FATAL) << "unknown material type " << tokens[1];
@@ -214,7 +214,7 @@ void SceneLoader::parseLight(const std::vector<std::string>& tokens) {
     radiance[1] = atof(tokens[6].c_str());
     radiance[2] = atof(tokens[7].c_str());
 
-    addLight(new PointLight(position, radiance));
+    addLight(new Light(Light::makePoint(position, radiance)));
 
   } else if (tokens[1] == "diffuse") {
     CHECK_EQ(tokens.size(), 5);
@@ -224,7 +224,7 @@ void SceneLoader::parseLight(const std::vector<std::string>& tokens) {
     radiance[1] = atof(tokens[3].c_str());
     radiance[2] = atof(tokens[4].c_str());
 
-    addLight(new DiffuseHemisphereLight(radiance));
+    addLight(new Light(Light::makeDiffuseHemisphere(radiance)));
 
   } else {
     LOG(FATAL) << "unknown light source " << tokens[1];
@@ -83,6 +83,14 @@ class DomainStats {
     return schedule_[order];
   }
 
+  //! Score of the domain at the given position in the schedule.
+  int64_t getScore(int order) const {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(order, scores_.size());
+#endif
+    return scores_[order].score;
+  }
+
  private:
   void evalScores();
   int64_t getStats(int id, int depth) const;
@@ -0,0 +1,125 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "ooc/ooc_ray.h"
+#include "render/rays.h"
+
+namespace spray {
+namespace ooc {
+
+//! Closest hit of an eye ray. domain is -1 if the ray missed the scene.
+struct PrimaryHit {
+  int domain;
+  float t;
+  uint32_t primID;
+  float u;
+  float v;
+  float Ng[3];
+};
+
+/**
+ * Closest eye-ray hits of the last frame, kept per blocking tile and indexed by
+ * sample ID.
+ *
+ * Eye rays only depend on the camera, so while its version does not change,
+ * the next frame can send each eye ray straight to the domain it hit and skip
+ * the domain traversal and the geometry intersection at bounce 0. A frame
+ * either replays a valid cache or records a new one.
+ */
+class PrimaryHitCache {
+ public:
+  PrimaryHitCache() : valid_(false), camera_version_(0) {}
+
+  void resize(std::size_t num_tiles) {
+    tiles_.resize(num_tiles);
+    valid_ = false;
+  }
+
+  bool valid(unsigned camera_version) const {
+    return (valid_ && camera_version == camera_version_);
+  }
+
+  //! Resets the hits of a blocking tile before recording them.
+  PrimaryHit* beginRecord(int tile, std::size_t num_samples) {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(tile, tiles_.size());
+#endif
+    valid_ = false;
+    std::vector<PrimaryHit>& hits = tiles_[tile];
+    hits.resize(num_samples);
+    for (auto& h : hits) h.domain = -1;
+    return hits.data();
+  }
+
+  PrimaryHit* getTile(int tile) {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(tile, tiles_.size());
+    CHECK(valid_);
+#endif
+    return tiles_[tile].data();
+  }
+
+  //! Marks the recorded frame as reusable for the given camera.
+  void commit(unsigned camera_version) {
+    valid_ = true;
+    camera_version_ = camera_version;
+  }
+
+  static void record(int domain, const RTCRayIntersection& isect,
+                     PrimaryHit* hit) {
+    hit->domain = domain;
+    hit->t = isect.tfar;
+    hit->primID = isect.primID;
+    hit->u = isect.u;
+    hit->v = isect.v;
+    hit->Ng[0] = isect.Ng[0];
+    hit->Ng[1] = isect.Ng[1];
+    hit->Ng[2] = isect.Ng[2];
+  }
+
+  //! Rebuilds the geometric hit of intersectGeometry() from a record.
+  static void restore(const PrimaryHit& hit, const Ray& ray,
+                      RTCRayIntersection* isect) {
+    RTCRayUtil::makeRadianceRay(ray.org, ray.dir, isect);
+    isect->tfar = hit.t;
+    isect->Ng[0] = hit.Ng[0];
+    isect->Ng[1] = hit.Ng[1];
+    isect->Ng[2] = hit.Ng[2];
+    isect->u = hit.u;
+    isect->v = hit.v;
+    isect->geomID = 0;
+    isect->primID = hit.primID;
+  }
+
+ private:
+  std::vector<std::vector<PrimaryHit>> tiles_;
+  bool valid_;
+  unsigned camera_version_;
+};
+
+}  // namespace ooc
+}  // namespace spray
@@ -20,7 +20,7 @@
 
 #include "ooc/ooc_pcontext.h"
 
-#include "utils/scan.h"
+#include "utils/barrier.h"
 
 namespace spray {
 namespace ooc {
@@ -35,24 +35,17 @@ void PContext::resize(int ndomains, int max_num_bounces, int num_threads,
 
   rstats_.resize(ndomains, false /*stats_only*/);
 
-  scans_.resize(4);
-  for (auto& s : scans_) {
-    s.resize(num_threads);
-  }
+  barrier_.resize(num_threads);
 
-  domain_locks_.resize(ndomains);
-  for (int i = 0; i < ndomains; ++i) {
-    omp_init_lock(&domain_locks_[i]);
-  }
+  cur_sinfo_ = 0;
+  prefetch_id_ = -1;
 }
 
 void PContext::mergeStats(const DomainStats& src_stats,
                           DomainStats* dest_stats) {
   //
   for (int id = 0; id < num_domains_; ++id) {
-    omp_set_lock(&domain_locks_[id]);
     dest_stats->addStats(id, src_stats);
-    omp_unset_lock(&domain_locks_[id]);
   }
 }
 
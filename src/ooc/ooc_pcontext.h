@@ -23,6 +23,7 @@
 #include <cstring>
 #include <queue>
 #include <utility>
+#include <vector>
 
 // clang-format off
 #include <embree2/rtcore_ray.h>
@@ -42,8 +43,8 @@
 #include "render/qvector.h"
 #include "render/tile.h"
 #include "render/rays.h"
+#include "utils/barrier.h"
 #include "utils/profiler_util.h"
-#include "utils/scan.h"
 
 namespace spray {
 namespace ooc {
@@ -67,7 +68,6 @@ class PContext {
 
  private:
   int bounce_num_;
-  std::vector<omp_lock_t> domain_locks_;
 
  public:
   void resetAndSwap() { ++bounce_num_; }
@@ -79,83 +79,144 @@ class PContext {
   void mergeStats(const DomainStats& src_stats, DomainStats* dest_stats);
 
  private:
-  std::vector<spray::InclusiveScan<int>> scans_;
-  spray::SceneInfo sinfo_;
+  //! Queue states reduced across threads at the top of each iteration.
+  enum { QS_EMPTY = 0, QS_RETIRE_ONLY, QS_INPUT };
+
+  spray::SenseBarrier barrier_;
+
+  /**
+   * Double-buffered scene info. sinfos_[cur_sinfo_] is the domain being
+   * traced, while thread 0 loads the next scheduled domain into the other one.
+   * prefetch_id_ is the domain in the other buffer, or -1.
+   */
+  spray::SceneInfo sinfos_[2];
+  int cur_sinfo_;
+  int prefetch_id_;
+
+  template <typename SceneT>
+  void loadDomain(SceneT* scene, int id, spray::SceneInfo* sinfo) {
+#ifdef SPRAY_TIMING
+    spray::tStart(spray::TIMER_LOAD);
+#endif
+    scene->load(id, sinfo);
+#ifdef SPRAY_TIMING
+    spray::tStop(spray::TIMER_LOAD);
+#endif
+  }
 
  public:
   template <typename SceneT, typename ShaderT>
   void isectPrims(SceneT* scene, ShaderT& shader,
-                  TContext<SceneT, ShaderT>* tcontext);
+                  std::vector<TContext<SceneT, ShaderT>>* tcontexts);
+
+ private:
+  //! Runs the published chunks of the calling thread first and then steals
+  //! chunks from the other threads.
+  template <typename SceneT, typename ShaderT>
+  void isectChunks(int tid, SceneT* scene, const spray::SceneInfo& sinfo,
+                   std::vector<TContext<SceneT, ShaderT>>* tcontexts);
 };
 
+template <typename SceneT, typename ShaderT>
+void PContext::isectChunks(int tid, SceneT* scene,
+                           const spray::SceneInfo& sinfo,
+                           std::vector<TContext<SceneT, ShaderT>>* tcontexts) {
+  const int num_threads = tcontexts->size();
+  RTCRay* rtc_ray = &(*tcontexts)[tid].getRTCRay();
+
+  for (int i = 0; i < num_threads; ++i) {
+    auto* victim = &(*tcontexts)[(tid + i) % num_threads];
+    int chunk;
+    while ((chunk = victim->claimChunk()) >= 0) {
+      victim->isectChunk(chunk, scene, sinfo, rtc_ray);
+    }
+  }
+}
+
 template <typename SceneT, typename ShaderT>
 void PContext::isectPrims(SceneT* scene, ShaderT& shader,
-                          TContext<SceneT, ShaderT>* tcontext) {
+                          std::vector<TContext<SceneT, ShaderT>>* tcontexts) {
   int tid = omp_get_thread_num();
+  auto* tcontext = &(*tcontexts)[tid];
   int ray_depth = 0;
+  int pending;
 
   do {
     tcontext->procPendingQ(scene);
     tcontext->resetVBuf();
 
     while (1) {
-      bool sqs_in_empty = tcontext->sqsInEmpty();
-      bool rqs_empty = tcontext->rqsEmpty();
+      bool input_empty = tcontext->sqsInEmpty() && tcontext->rqsEmpty();
       bool retire_q_empty = tcontext->retireQEmpty();
 
-      bool all_empty = sqs_in_empty && rqs_empty && retire_q_empty;
-      scans_[0].set(tid, all_empty);
-#pragma omp barrier
-#pragma omp single
-      { scans_[0].scan(); }
+      int state = input_empty ? (retire_q_empty ? QS_EMPTY : QS_RETIRE_ONLY)
+                              : QS_INPUT;
 
-      if (scans_[0].sum() == scans_[0].size()) {  // all qs empty
+      state = barrier_.reduceMax(tid, state, [&](int global_state) {
+        if (global_state == QS_INPUT) {
+          rstats_.reset();
+          for (auto& t : *tcontexts) {
+            mergeStats(t.getRstats(), &rstats_);
+          }
+          rstats_.schedule();
+        }
+      });
+
+      if (state == QS_EMPTY) {  // all qs empty
 #ifdef SPRAY_GLOG_CHECK
         CHECK(tcontext->commitQEmpty());
 #endif
         break;
       }
 
-      bool input_empty = sqs_in_empty && rqs_empty;
-      scans_[1].set(tid, input_empty);
-#pragma omp barrier
-#pragma omp single
-      { scans_[1].scan(); }
-
-      if (scans_[1].sum() < scans_[1].size()) {  // input q not empty
-#pragma omp single
-        { rstats_.reset(); }
-        mergeStats(tcontext->getRstats(), &rstats_);
-#pragma omp barrier
-
-#pragma omp single
-        { rstats_.schedule(); }
+      if (state == QS_INPUT) {  // input q not empty
+        // loading the next domain must not evict the one being traced
+        const bool pipelined = (scene->getCacheCapacity() > 1);
 
         for (int i = 0; i < num_domains_; ++i) {
           //
           int id = rstats_.getDomainId(i);
 
           tcontext->filterQs(id);
-          scans_[2].set(tid, tcontext->allFilterQsEmpty());
-#pragma omp barrier
-#pragma omp single
-          { scans_[2].scan(); }
-
-          if (scans_[2].sum() < scans_[2].size()) {
-#pragma omp single
-            {
-#ifdef SPRAY_TIMING
-              spray::tStart(spray::TIMER_LOAD);
-#endif
-              scene->load(id, &sinfo_);
-#ifdef SPRAY_TIMING
-              spray::tStop(spray::TIMER_LOAD);
-#endif
+          tcontext->prepareChunks();
+
+          // the previous domain is done once every thread gets here, so the
+          // next one can be loaded in the same episode
+          int has_rays = barrier_.reduceMax(
+              tid, !tcontext->allFilterQsEmpty(), [&](int any) {
+                if (any) {
+                  if (prefetch_id_ == id) {
+                    cur_sinfo_ ^= 1;
+                  } else {
+                    loadDomain(scene, id, &sinfos_[cur_sinfo_]);
+                  }
+                }
+                // only domains that had rays when scheduled are prefetched.
+                // the others may still get rays from this pass, and those
+                // are loaded on demand.
+                prefetch_id_ = -1;
+                if (any && pipelined && i + 1 < num_domains_ &&
+                    rstats_.getScore(i + 1) > 0) {
+                  prefetch_id_ = rstats_.getDomainId(i + 1);
+                }
+                for (auto& t : *tcontexts) {
+                  t.publishChunks();
+                }
+              });
+
+          if (has_rays) {
+            spray::SceneInfo& sinfo = sinfos_[cur_sinfo_];
+
+            // thread 0 loads the next domain while the others trace this one.
+            // its chunks get stolen in the meantime.
+            if (tid == 0 && prefetch_id_ >= 0) {
+              loadDomain(scene, prefetch_id_, &sinfos_[cur_sinfo_ ^ 1]);
             }
 
-            tcontext->procFilterQs(id, scene, sinfo_, shader, ray_depth);
+            isectChunks(tid, scene, sinfo, tcontexts);
+            tcontext->waitForChunks();
+            tcontext->procFilterQs(id, scene, sinfo, shader, ray_depth);
           }
-#pragma omp barrier
         }
       }
 
@@ -171,13 +232,9 @@ void PContext::isectPrims(SceneT* scene, ShaderT& shader,
 
     ray_depth += SPRAY_HISTORY_SIZE;
 
-    scans_[3].set(tid, tcontext->pendingQEmpty());
-#pragma omp barrier
-#pragma omp single
-    { scans_[3].scan(); }
+    pending = barrier_.reduceMax(tid, !tcontext->pendingQEmpty());
 
-  } while (scans_[3].sum() <
-           scans_[3].size());  // while all pending Qs not empty
+  } while (pending);  // while any pending q not empty
 }
 
 }  // namespace ooc
@@ -20,25 +20,37 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include "render/spray.h"
 
 namespace spray {
 namespace ooc {
 
+/**
+ * Speculative ray record. Small integer fields are packed into a single word
+ * so that the record fits in 64 bytes with the default history size.
+ */
 struct SPRAY_ALIGN(16) Ray {
   float org[3];
   int pixid;
   float dir[3];
   int samid;
   float w[3];
-  int depth;
+  uint32_t depth : 8;  //!< virtual depth (index into history)
+  uint32_t committed : 1;
+  uint32_t occluded : 1;
+  uint32_t cached : 1;  //!< eye ray with a hit from the primary hit cache
+  uint32_t : 5;
+  uint32_t light : 16;  //!< light or ao sample index
   float history[SPRAY_HISTORY_SIZE];
-  float tdom;  // distance to domain only used for sending rays
-  int committed;
-  int light;
-  int occluded;
 };
 
+static_assert(SPRAY_HISTORY_SIZE < 256, "history size exceeds ray depth bits");
+
+//! Maximum number of light samples a ray record can address.
+#define SPRAY_OOC_RAY_MAX_LIGHTS 65536
+
 struct RayData {
   Ray* ray;
   float tdom;
@@ -80,6 +92,7 @@ struct RayUtil {
     shadow->committed = 0;
     shadow->light = light;
     shadow->occluded = 0;
+    shadow->cached = 0;
   }
 
   inline static void makeRay(const Ray& rayin, const glm::vec3& pos,
@@ -109,6 +122,7 @@ struct RayUtil {
     rayout->history[rayin.depth] = t;
 
     rayout->committed = 0;
+    rayout->cached = 0;
   }
 
   inline static bool update(float t, Ray* ray) {
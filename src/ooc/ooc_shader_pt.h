@@ -29,8 +29,11 @@
 #include "ooc/ooc_ray.h"
 #include "render/config.h"
 #include "render/light.h"
+#include "render/light_sampler.h"
+#include "render/path_sampler.h"
 #include "render/rays.h"
 #include "render/reflection.h"
+#include "render/roulette.h"
 #include "render/scene.h"
 #include "utils/util.h"
 
@@ -43,24 +46,49 @@ class ShaderPt {
   typedef SceneT SceneType;
 
   void init(const spray::Config &cfg, const SceneT *scene) {
+    pass_ = 0;
+    sampler_type_ = cfg.sampler;
+    num_pixel_samples_ = cfg.pixel_samples;
     bounces_ = cfg.bounces;
     samples_ = cfg.ao_samples;  // number of samples for area lights
     ks_ = cfg.ks;
     shininess_ = cfg.shininess;
     scene_ = scene;
     lights_ = scene->getLights();  // copy lights
+    light_selection_ = cfg.light_selection;
+    num_sampled_lights_ = cfg.sampled_lights;
+    rr_depth_ = cfg.rr_depth;
+    if (light_selection_ == spray::Config::LIGHT_SELECTION_POWER) {
+      light_sampler_.init(lights_);
+    }
   }
 
  private:
   const SceneT *scene_;
+  int pass_;          // progressive pass, offsets the sample index
+  int sampler_type_;  // PathSampler::Type
+  int num_pixel_samples_;
   std::vector<Light *> lights_;
+  int light_selection_;
+  int num_sampled_lights_;
+  int rr_depth_;
+  spray::LightSampler light_sampler_;
   int bounces_;
   int samples_;
   glm::vec3 ks_;
   float shininess_;
 
+  //! Seeds a sampler for a stream of the vertex at the given depth.
+  void initSampler(const Ray &rayin, int depth, int stream,
+                   PathSampler *sampler) const {
+    int s = rayin.samid % num_pixel_samples_;
+    sampler->init(sampler_type_, rayin.pixid, pass_ * num_pixel_samples_ + s,
+                  pathSamplerStream(depth, stream));
+  }
+
  public:
   bool isAo() { return false; }
+  void setPass(int pass) { pass_ = pass; }
 
  public:
   void operator()(int domain_id, const Ray &rayin,
@@ -70,21 +98,28 @@ class ShaderPt {
                   int ray_depth);
 
  private:
-  void genR2(const Ray &rayin, const glm::vec3 &org, const glm::vec3 &dir,
-             const glm::vec3 &w, float t, spray::MemoryArena *mem,
-             std::queue<Ray *> *rq, std::queue<Ray *> *pending_q) {
+  void genR2(int depth, const Ray &rayin, const glm::vec3 &org,
+             const glm::vec3 &dir, const glm::vec3 &w, float t,
+             spray::MemoryArena *mem, std::queue<Ray *> *rq,
+             std::queue<Ray *> *pending_q) {
+    PathSampler sampler;
+    initSampler(rayin, depth, SAMPLER_STREAM_ROULETTE, &sampler);
+
+    glm::vec3 weight = w;
+    if (!russianRoulette(&sampler, depth, rr_depth_, &weight)) return;
+
     Ray *r2 = mem->Alloc<Ray>(1, false);
     CHECK_NOTNULL(r2);
 
     int next_virtual_depth = rayin.depth + 1;
     if (next_virtual_depth == SPRAY_HISTORY_SIZE) {
-      RayUtil::makeRay(rayin, org, dir, w, t, r2, 0);
+      RayUtil::makeRay(rayin, org, dir, weight, t, r2, 0);
       pending_q->push(r2);
 #ifdef SPRAY_GLOG_CHECK
       CHECK_EQ(r2->depth, 0);
 #endif
     } else {
-      RayUtil::makeRay(rayin, org, dir, w, t, r2, next_virtual_depth);
+      RayUtil::makeRay(rayin, org, dir, weight, t, r2, next_virtual_depth);
       rq->push(r2);
     }
   }
@@ -126,50 +161,68 @@ void ShaderPt<SceneT>::operator()(int domain_id, const Ray &rayin,
 #endif
 
   if (!delta_dist) {
-    RandomSampler light_sampler;
-    RandomSampler_init(light_sampler, rayin.samid * next_actual_depth);
-
-    for (int l = 0; l < nlights; ++l) {
-      if (lights_[l]->isAreaLight()) {
-        for (int s = 0; s < samples_; ++s) {
-          light_radiance =
-              lights_[l]->sampleArea(light_sampler, normal_ff, &wi, &pdf);
-
+    PathSampler light_sampler;
+    initSampler(rayin, next_actual_depth, SAMPLER_STREAM_LIGHT, &light_sampler);
+
+    if (light_selection_ == spray::Config::LIGHT_SELECTION_POWER) {
+      for (int k = 0; k < num_sampled_lights_; ++k) {
+        float pmf;
+        int l = light_sampler_.sample(light_sampler.get1D(), &pmf);
+        float scale = 1.0f / (pmf * num_sampled_lights_);
+
+        if (sampleDirect(*lights_[l], light_sampler.get2D(), pos, normal_ff,
+                         wo, surf_radiance, ks_, shininess_, Lin, scale, &wi,
+                         &Lr)) {
+          Ray *shadow = mem->Alloc<Ray>(1, false);
+          CHECK_NOTNULL(shadow);
+
+          RayUtil::makeShadow(rayin, l, pos, wi, Lr, isect.tfar, shadow);
+          sq->push(shadow);
+        }
+      }
+    } else {
+      for (int l = 0; l < nlights; ++l) {
+        if (lights_[l]->isAreaLight()) {
+          for (int s = 0; s < samples_; ++s) {
+            light_radiance = lights_[l]->sampleArea(light_sampler.get2D(),
+                                                    normal_ff, &wi, &pdf);
+
+            if (pdf > 0.0f) {
+              costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
+              Lr = Lin *
+                   blinnPhong(costheta, surf_radiance, ks_, shininess_,
+                              light_radiance, wi, normal_ff, wo) *
+                   (1.0f / (pdf * samples_));
+
+              if (hasPositive(Lr)) {
+                Ray *shadow = mem->Alloc<Ray>(1, false);
+                CHECK_NOTNULL(shadow);
+
+                RayUtil::makeShadow(rayin, l, pos, wi, Lr, isect.tfar, shadow);
+
+                sq->push(shadow);
+              }
+            }
+          }
+        } else {  // point light
+          light_radiance = lights_[l]->sample(pos, &wi, &pdf);
           if (pdf > 0.0f) {
+            // evaluate direct lighting
             costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
             Lr = Lin *
                  blinnPhong(costheta, surf_radiance, ks_, shininess_,
                             light_radiance, wi, normal_ff, wo) *
-                 (1.0f / (pdf * samples_));
+                 (1.0f / pdf);
 
             if (hasPositive(Lr)) {
               Ray *shadow = mem->Alloc<Ray>(1, false);
               CHECK_NOTNULL(shadow);
 
               RayUtil::makeShadow(rayin, l, pos, wi, Lr, isect.tfar, shadow);
-
               sq->push(shadow);
             }
           }
         }
-      } else {  // point light
-        light_radiance = lights_[l]->sample(pos, &wi, &pdf);
-        if (pdf > 0.0f) {
-          // evaluate direct lighting
-          costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
-          Lr = Lin *
-               blinnPhong(costheta, surf_radiance, ks_, shininess_,
-                          light_radiance, wi, normal_ff, wo) *
-               (1.0f / pdf);
-
-          if (hasPositive(Lr)) {
-            Ray *shadow = mem->Alloc<Ray>(1, false);
-            CHECK_NOTNULL(shadow);
-
-            RayUtil::makeShadow(rayin, l, pos, wi, Lr, isect.tfar, shadow);
-            sq->push(shadow);
-          }
-        }
       }
     }
   }  // if (!delta_dist) {
@@ -198,7 +251,8 @@ void ShaderPt<SceneT>::operator()(int domain_id, const Ray &rayin,
           wi = glm::normalize(wr);
           Lr = Lin * (fr / abs_cos_theta_i);
           if (hasPositive(Lr)) {
-            genR2(rayin, pos, wi, Lr, isect.tfar, mem, rq, pending_q);
+            genR2(next_actual_depth, rayin, pos, wi, Lr, isect.tfar, mem, rq,
+                  pending_q);
           }
         }
 
@@ -208,19 +262,21 @@ void ShaderPt<SceneT>::operator()(int domain_id, const Ray &rayin,
           wi = glm::normalize(wt);
           Lr = Lin * ((1.0f - fr) / abs_cos_theta_i);
           if (hasPositive(Lr)) {
-            genR2(rayin, pos, wi, Lr, isect.tfar, mem, rq, pending_q);
+            genR2(next_actual_depth, rayin, pos, wi, Lr, isect.tfar, mem, rq,
+                  pending_q);
           }
         }
       }
     } else {
-      RandomSampler sampler;
-      RandomSampler_init(sampler, rayin.samid * next_actual_depth);
+      PathSampler sampler;
+      initSampler(rayin, next_actual_depth, SAMPLER_STREAM_BSDF, &sampler);
 
-      bsdf->sampleRandom(normal_ff, &sampler, &wi, &pdf);
+      bsdf->sampleRandom(normal_ff, sampler.get2D(), &wi, &pdf);
       costheta = glm::clamp(glm::dot(normal_ff, wi), 0.0f, 1.0f);
       Lr = Lin * surf_radiance * SPRAY_ONE_OVER_PI * costheta / pdf;
       if (hasPositive(Lr)) {
-        genR2(rayin, pos, wi, Lr, isect.tfar, mem, rq, pending_q);
+        genR2(next_actual_depth, rayin, pos, wi, Lr, isect.tfar, mem, rq,
+              pending_q);
       }
     }
   }
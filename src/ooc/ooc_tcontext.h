@@ -21,9 +21,12 @@
 #pragma once
 
 #include <omp.h>
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
 #include <queue>
 #include <utility>
+#include <vector>
 
 // clang-format off
 #include <embree2/rtcore_ray.h>
@@ -35,6 +38,7 @@
 #include "pbrt/memory.h"
 
 #include "ooc/ooc_domain_stats.h"
+#include "ooc/ooc_hit_cache.h"
 #include "ooc/ooc_isector.h"
 #include "ooc/ooc_ray.h"
 #include "ooc/ooc_vbuf.h"
@@ -44,6 +48,11 @@
 #include "display/image.h"
 #include "utils/scan.h"
 
+//! Number of filtered rays per work-stealing chunk.
+#ifndef SPRAY_OOC_STEAL_CHUNK_SIZE
+#define SPRAY_OOC_STEAL_CHUNK_SIZE 64
+#endif
+
 namespace spray {
 namespace ooc {
 
@@ -59,6 +68,13 @@ class TContext {
 
     commit_q_ = &commit_retire_q0_;
     retire_q_ = &commit_retire_q1_;
+
+    num_chunks_ = 0;
+    next_chunk_ = 0;
+    num_chunks_done_ = 0;
+
+    primary_hits_ = nullptr;
+    replay_primary_hits_ = false;
   }
 
  public:
@@ -84,6 +100,12 @@ class TContext {
   void resetMemIn() { mem_in_->Reset(); }
   void swapMems() { std::swap(mem_in_, mem_out_); }
 
+  //! Bytes held by the ray arenas. Arenas keep their blocks across resets, so
+  //! this is the high-water mark so far.
+  std::size_t getMemBytes() const {
+    return mem_0_.TotalAllocated() + mem_1_.TotalAllocated();
+  }
+
  public:
   template <typename T>
   T* allocMemIn(std::size_t size) {
@@ -119,6 +141,31 @@ class TContext {
     isector_.intersect(scene, ray, &rqs_, &rstats_);
   }
 
+  //! Queues an eye ray for the domain of its cached hit. Misses are dropped.
+  void enqCachedRad(Ray* ray) {
+    const PrimaryHit& hit = primary_hits_[ray->samid];
+    if (hit.domain < 0) return;
+
+    ray->cached = 1;
+
+    RayData data;
+    data.ray = ray;
+    data.tdom = hit.t;
+    data.dom_depth = 0;
+    rqs_.push(hit.domain, data);
+    rstats_.increment(hit.domain, 0 /*depth*/);
+  }
+
+  /**
+   * Sets the primary hits of the blocking tile. Eye rays either record their
+   * closest hits into them or, if replay is true, take their hits from them.
+   * nullptr disables the cache.
+   */
+  void setPrimaryHits(PrimaryHit* hits, bool replay) {
+    primary_hits_ = hits;
+    replay_primary_hits_ = replay;
+  }
+
   spray::RTCRayIntersection& getRTCIsect() { return rtc_isect_; }
   RTCRay& getRTCRay() { return rtc_ray_; }
 
@@ -127,14 +174,17 @@ class TContext {
   spray::RTCRayIntersection rtc_isect_;
   RTCRay rtc_ray_;
 
+  PrimaryHit* primary_hits_;  // hits of the blocking tile, indexed by samid
+  bool replay_primary_hits_;
+
  private:
   std::queue<Ray*> sq2_;
   std::queue<Ray*> rq2_;
   std::queue<Ray*> pending_q_;
 
-  std::queue<Ray*> frq_;
-  std::queue<Ray*> fsq_in_;
-  std::queue<Ray*> fsq_out_;
+  std::vector<Ray*> frq_;
+  std::vector<Ray*> fsq_in_;
+  std::vector<Ray*> fsq_out_;
 
   std::queue<Ray*> commit_retire_q0_;
   std::queue<Ray*> commit_retire_q1_;
@@ -181,16 +231,80 @@ class TContext {
 
  private:
   void filterRqs(int id);
-  void filterSqs(int id, QVector<RayData>* sqs, std::queue<Ray*>* fsq);
+  void filterSqs(int id, QVector<RayData>* sqs, std::vector<Ray*>* fsq);
 
  public:
+  /**
+   * Filtered rays are published as fixed-size chunks. Any thread can claim a
+   * chunk and run the intersection or occlusion tests in it, since those only
+   * read the rays. The results are then consumed by the owning thread, which
+   * is the only one that touches the ray history, the vbuf and the output
+   * queues.
+   *
+   * Sizes the result buffers for the filtered queues. Called by the owner.
+   */
+  void prepareChunks() {
+    std::size_t num_rays = frq_.size() + fsq_in_.size() + fsq_out_.size();
+    hits_.resize(num_rays);
+    isects_.resize(frq_.size());
+  }
+
+  /**
+   * Opens the chunks for claiming. This must not overlap with a claimChunk()
+   * call left over from the previous domain, so it is called while all threads
+   * are held at a barrier.
+   */
+  void publishChunks() {
+    num_chunks_ = (int)((hits_.size() + SPRAY_OOC_STEAL_CHUNK_SIZE - 1) /
+                        SPRAY_OOC_STEAL_CHUNK_SIZE);
+    next_chunk_ = 0;
+    num_chunks_done_ = 0;
+  }
+
+  //! Claims an unprocessed chunk. Returns -1 if there is none left.
+  int claimChunk() {
+    int chunk;
+#pragma omp atomic capture
+    chunk = next_chunk_++;
+    return chunk < num_chunks_ ? chunk : -1;
+  }
+
+  /**
+   * Tests the rays in the given chunk against the loaded domain.
+   *
+   * \param rtc_ray Scratch ray of the calling thread.
+   */
+  void isectChunk(int chunk, SceneT* scene, const SceneInfo& sinfo,
+                  RTCRay* rtc_ray);
+
+  //! Waits until the other threads finish the chunks they claimed from this
+  //! context. Called by the owner.
+  void waitForChunks() const {
+    int num_done;
+    do {
+#pragma omp atomic read seq_cst
+      num_done = num_chunks_done_;
+    } while (num_done < num_chunks_);
+#pragma omp flush
+  }
+
   void procFilterQs(int id, SceneT* scene, SceneInfo& sinfo, ShaderT& shader,
                     int ray_depth) {
     procRads(id, scene, sinfo, shader, ray_depth);
-    procShads(scene, sinfo, &fsq_in_, retire_q_);
-    procShads(scene, sinfo, &fsq_out_, commit_q_);
+    procShads(frq_.size(), &fsq_in_, retire_q_);
+    procShads(frq_.size() + fsq_in_.size(), &fsq_out_, commit_q_);
+    frq_.clear();
+    fsq_in_.clear();
+    fsq_out_.clear();
   }
 
+ private:
+  std::vector<uint8_t> hits_;  // per-ray results of the published rays
+  std::vector<spray::RTCRayIntersection> isects_;  // frq_ hit records
+  int num_chunks_;
+  int next_chunk_;
+  int num_chunks_done_;
+
  private:
   void procRads(int id, SceneT* scene, SceneInfo& sinfo, ShaderT& shader,
                 int ray_depth);
@@ -199,7 +313,7 @@ class TContext {
 
   void procRads2(SceneT* scene, SceneInfo& sinfo);
 
-  void procShads(SceneT* scene, SceneInfo& sinfo, std::queue<Ray*>* qin,
+  void procShads(std::size_t offset, const std::vector<Ray*>* qin,
                  std::queue<Ray*>* qout);
 
  public:
@@ -29,18 +29,19 @@ template <typename SceneT, typename ShaderT>
 void TContext<SceneT, ShaderT>::procRads(int id, SceneT* scene,
                                          SceneInfo& sinfo, ShaderT& shader,
                                          int ray_depth) {
-  //
-  while (!frq_.empty()) {
-    Ray* r = frq_.front();
-    frq_.pop();
-
-    bool is_hit = scene->intersect(sinfo.rtc_scene, sinfo.cache_block, r->org,
-                                   r->dir, &rtc_isect_);
-
-    if (is_hit) {
-      if (vbuf_.update(rtc_isect_.tfar, r)) {
-        shader(id, *r, rtc_isect_, mem_out_, &sq2_, &rq2_, &pending_q_,
-               ray_depth);
+  for (std::size_t i = 0; i < frq_.size(); ++i) {
+    Ray* r = frq_[i];
+
+    if (hits_[i]) {
+      spray::RTCRayIntersection& isect = isects_[i];
+      if (vbuf_.update(isect.tfar, r)) {
+        // the last update of an eye ray is its closest hit
+        if (primary_hits_ && !replay_primary_hits_ && ray_depth == 0 &&
+            r->depth == 0) {
+          PrimaryHitCache::record(id, isect, &primary_hits_[r->samid]);
+        }
+        scene->updateIntersection(sinfo, &isect);
+        shader(id, *r, isect, mem_out_, &sq2_, &rq2_, &pending_q_, ray_depth);
         procShads2(id, scene, sinfo);
         procRads2(scene, sinfo);
       }
@@ -49,14 +50,45 @@ void TContext<SceneT, ShaderT>::procRads(int id, SceneT* scene,
 }
 
 template <typename SceneT, typename ShaderT>
-void TContext<SceneT, ShaderT>::procShads(SceneT* scene, SceneInfo& sinfo,
-                                          std::queue<Ray*>* qin,
+void TContext<SceneT, ShaderT>::isectChunk(int chunk, SceneT* scene,
+                                           const SceneInfo& sinfo,
+                                           RTCRay* rtc_ray) {
+  const std::size_t num_rads = frq_.size();
+  const std::size_t num_shads_in = fsq_in_.size();
+
+  std::size_t begin = (std::size_t)chunk * SPRAY_OOC_STEAL_CHUNK_SIZE;
+  std::size_t end =
+      std::min(begin + SPRAY_OOC_STEAL_CHUNK_SIZE, hits_.size());
+
+  for (std::size_t i = begin; i < end; ++i) {
+    if (i < num_rads) {
+      Ray* r = frq_[i];
+      if (r->cached) {
+        PrimaryHitCache::restore(primary_hits_[r->samid], *r, &isects_[i]);
+        hits_[i] = 1;
+      } else {
+        hits_[i] =
+            scene->intersectGeometry(sinfo, r->org, r->dir, &isects_[i]);
+      }
+    } else {
+      std::size_t j = i - num_rads;
+      Ray* r = (j < num_shads_in) ? fsq_in_[j] : fsq_out_[j - num_shads_in];
+      hits_[i] = scene->occluded(sinfo, r->org, r->dir, rtc_ray);
+    }
+  }
+
+#pragma omp flush
+#pragma omp atomic update seq_cst
+  ++num_chunks_done_;
+}
+
+template <typename SceneT, typename ShaderT>
+void TContext<SceneT, ShaderT>::procShads(std::size_t offset,
+                                          const std::vector<Ray*>* qin,
                                           std::queue<Ray*>* qout) {
-  while (!qin->empty()) {
-    Ray* r = qin->front();
-    qin->pop();
-    bool is_occluded =
-        scene->occluded(sinfo.rtc_scene, r->org, r->dir, &rtc_ray_);
+  for (std::size_t i = 0; i < qin->size(); ++i) {
+    Ray* r = (*qin)[i];
+    bool is_occluded = hits_[offset + i];
 
     if (is_occluded) {
       r->occluded = 1;
@@ -75,8 +107,7 @@ void TContext<SceneT, ShaderT>::procShads2(int id, SceneT* scene,
   while (!sq2_.empty()) {
     Ray* r = sq2_.front();
     sq2_.pop();
-    bool is_occluded =
-        scene->occluded(sinfo.rtc_scene, r->org, r->dir, &rtc_ray_);
+    bool is_occluded = scene->occluded(sinfo, r->org, r->dir, &rtc_ray_);
     if (!is_occluded) {
       if (!isector_.intersect(id, scene, r, sqs_out_,
                               &rstats_)) {  // unoccluded
@@ -145,7 +176,7 @@ void TContext<SceneT, ShaderT>::filterRqs(int id) {
     rstats_.decrement(id, data.dom_depth);
 
     if (data.tdom <= r->history[r->depth] && vbuf_.correct(*r)) {
-      frq_.push(r);
+      frq_.push_back(r);
     }
     rq->pop();
   }
@@ -153,7 +184,7 @@ void TContext<SceneT, ShaderT>::filterRqs(int id) {
 
 template <typename SceneT, typename ShaderT>
 void TContext<SceneT, ShaderT>::filterSqs(int id, QVector<RayData>* sqs,
-                                          std::queue<Ray*>* fsq) {
+                                          std::vector<Ray*>* fsq) {
   auto* sq = sqs->getQ(id);
 
   while (!sq->empty()) {
@@ -163,7 +194,7 @@ void TContext<SceneT, ShaderT>::filterSqs(int id, QVector<RayData>* sqs,
     rstats_.decrement(id, data.dom_depth);
 
     if (!r->occluded && vbuf_.correct(*r)) {
-      fsq->push(r);
+      fsq->push_back(r);
     }
     sq->pop();
   }
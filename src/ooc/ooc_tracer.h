@@ -34,16 +34,20 @@
 #include "glog/logging.h"
 
 #include "display/image.h"
+#include "ooc/ooc_hit_cache.h"
 #include "ooc/ooc_pcontext.h"
 #include "ooc/ooc_ray.h"
 #include "ooc/ooc_tcontext.h"
+#include "render/adaptive_sampler.h"
 #include "render/camera.h"
 #include "render/domain.h"
 #include "render/light.h"
+#include "render/path_sampler.h"
 #include "render/reflection.h"
 #include "render/scene.h"
 #include "render/spray.h"
 #include "render/tile.h"
+#include "utils/numa.h"
 #include "utils/profiler_util.h"
 
 namespace spray {
@@ -62,6 +66,11 @@ class Tracer {
   void init(const Config &cfg, const Camera &camera, SceneType *scene,
             HdrImage *image);
 
+  //! Traces only the active pixels of the sampler from now on.
+  void setAdaptiveSampler(const AdaptiveSampler *sampler) {
+    adaptive_ = sampler;
+  }
+
  private:
   typedef TContext<SceneType, ShaderT> TContextType;
 
@@ -74,8 +83,17 @@ class Tracer {
                      spray::Tile tile, RayBuf<Ray> *ray_buf);
   void genMultiEyes(int image_w, float orgx, float orgy, float orgz,
                     spray::Tile tile, RayBuf<Ray> *ray_buf);
+  void genAdaptiveEyes(int image_w, float orgx, float orgy, float orgz,
+                       spray::Tile tile, RayBuf<Ray> *ray_buf);
 
   void isectDomsRads(RayBuf<Ray> buf, TContextType *tc);
+  void enqCachedRads(RayBuf<Ray> buf, TContextType *tc);
+
+  //! Decides whether the frame records or replays the primary hits.
+  void beginPrimaryHits();
+  //! Hands the primary hits of the current blocking tile to the threads.
+  void setPrimaryHits(int tile);
+  void endPrimaryHits();
   void isectPrimsRads(TContextType *tc);
 
  private:
@@ -87,15 +105,24 @@ class Tracer {
   // spray::Tile image_tile_;
   // spray::Tile mytile_;
   spray::Tile blocking_tile_;
+  int blocking_tile_index_;
   RayBuf<Ray> shared_eyes_;
 
   spray::ImageScheduleTileList tile_list_;
 
+  const spray::AdaptiveSampler *adaptive_;
+  std::vector<int> active_pixels_;  // active pixels of the blocking tile
+
+  bool cache_primary_hits_;
+  bool replay_primary_hits_;  // this frame reuses the hits of the last one
+  PrimaryHitCache primary_hits_;
+
  private:
   int rank_;
   int num_ranks_;
   int num_domains_;
   int num_pixel_samples_;
+  int sampler_type_;  // PathSampler::Type
   int num_bounces_;
   int num_threads_;
   int image_w_;
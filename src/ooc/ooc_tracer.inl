@@ -39,11 +39,15 @@ void Tracer<ShaderT>::init(const Config &cfg, const Camera &camera,
 
   lights_ = scene->getLights();
   image_ = image;
+  adaptive_ = nullptr;
+  cache_primary_hits_ = cfg.cache_primary_hits;
+  replay_primary_hits_ = false;
 
   rank_ = rank;
   num_ranks_ = nranks;
   num_domains_ = ndomains;
   num_pixel_samples_ = cfg.pixel_samples;
+  sampler_type_ = cfg.sampler;
   num_bounces_ = cfg.bounces;
   num_threads_ = cfg.nthreads;
   image_w_ = cfg.image_w;
@@ -66,16 +70,38 @@ void Tracer<ShaderT>::init(const Config &cfg, const Camera &camera,
     CHECK_GT(lights_.size(), 0);
     num_lights = lights_.size();
   }
+  CHECK_LE(num_lights, SPRAY_OOC_RAY_MAX_LIGHTS);
 
   pcontext_.resize(ndomains, cfg.bounces, cfg.nthreads, cfg.pixel_samples,
                    num_lights, image_);
 
-  tile_list_.init(cfg.image_w, cfg.image_h, cfg.pixel_samples, nranks, rank,
-                  cfg.maximum_num_screen_space_samples_per_rank);
-  CHECK(!tile_list_.empty());
+  if (cfg.steal_tiles > 0 && nranks > 1) {
+    tile_list_.initShared(cfg.image_w, cfg.image_h, cfg.pixel_samples, nranks,
+                          cfg.steal_tiles,
+                          cfg.maximum_num_screen_space_samples_per_rank);
+  } else {
+    tile_list_.init(cfg.image_w, cfg.image_h, cfg.pixel_samples, nranks, rank,
+                    cfg.maximum_num_screen_space_samples_per_rank);
+    CHECK(!tile_list_.empty());
+  }
+
+  // a rank only holds the hits of the tiles it claimed in the last frame
+  if (cache_primary_hits_ && tile_list_.isShared()) {
+    LOG_IF(WARNING, rank == 0)
+        << "--cache-primary-hits is ignored with --steal-tiles";
+    cache_primary_hits_ = false;
+  }
+
+  if (cache_primary_hits_) primary_hits_.resize(tile_list_.size());
+
+  numa::checkThreadBinding();
 
+  // each thread sizes its own context, so that first touch places the vbuf
+  // and queues on the thread's socket
   tcontexts_.resize(cfg.nthreads);
-  for (auto &tc : tcontexts_) {
+#pragma omp parallel num_threads(cfg.nthreads)
+  {
+    auto &tc = tcontexts_[omp_get_thread_num()];
     tc.resize(ndomains, cfg.pixel_samples, tile_list_.getLargestBlockingTile(),
               image_, cfg.bounces);
   }
@@ -117,6 +143,7 @@ void Tracer<ShaderT>::genSingleEyes(int image_w, float orgx, float orgy,
       ray->depth = 0;
       ray->history[0] = SPRAY_FLOAT_INF;
       ray->committed = 0;
+      ray->cached = 0;
     }
   }
 }
@@ -148,11 +175,12 @@ void Tracer<ShaderT>::genMultiEyes(int image_w, float orgx, float orgy,
 
         ray->pixid = pixid;
 
-        RandomSampler sampler;
-        RandomSampler_init(sampler, bufid);
+        PathSampler sampler;
+        sampler.init(sampler_type_, pixid, s, SAMPLER_STREAM_PIXEL);
 
-        float fx = (float)(x) + RandomSampler_get1D(sampler);
-        float fy = (float)(y) + RandomSampler_get1D(sampler);
+        glm::vec2 u = sampler.get2D();
+        float fx = (float)(x) + u.x;
+        float fy = (float)(y) + u.y;
 
         camera_->generateRay(fx, fy, ray->dir);
 
@@ -166,11 +194,70 @@ void Tracer<ShaderT>::genMultiEyes(int image_w, float orgx, float orgy,
 
         ray->history[0] = SPRAY_FLOAT_INF;
         ray->committed = 0;
+        ray->cached = 0;
       }
     }
   }
 }
 
+template <typename ShaderT>
+void Tracer<ShaderT>::genAdaptiveEyes(int image_w, float orgx, float orgy,
+                                      float orgz, spray::Tile tile,
+                                      RayBuf<Ray> *ray_buf) {
+  Ray *rays = ray_buf->rays;
+
+  int nsamples = num_pixel_samples_;
+  int npixels = active_pixels_.size();
+  int pass = adaptive_->getPass();
+
+  // sample IDs keep the layout of genMultiEyes, so the vbuf is indexed the
+  // same way. only the ray buffer is compacted.
+#pragma omp for collapse(2) schedule(static, 1)
+  for (int i = 0; i < npixels; ++i) {
+    for (int s = 0; s < nsamples; ++s) {
+      int p = active_pixels_[i];
+      int x = tile.x + p % tile.w;
+      int y = tile.y + p / tile.w;
+      int bufid = nsamples * i + s;
+      int samid = nsamples * p + s;
+      int pixid = y * image_w + x;
+#ifdef SPRAY_GLOG_CHECK
+      CHECK_LT(bufid, ray_buf->num);
+#endif
+      Ray *ray = &rays[bufid];
+
+      ray->org[0] = orgx;
+      ray->org[1] = orgy;
+      ray->org[2] = orgz;
+
+      ray->pixid = pixid;
+
+      // later passes continue the sample sequence of the pixel
+      PathSampler sampler;
+      sampler.init(sampler_type_, pixid, pass * nsamples + s,
+                   SAMPLER_STREAM_PIXEL);
+
+      glm::vec2 u = sampler.get2D();
+      float fx = (float)(x) + u.x;
+      float fy = (float)(y) + u.y;
+
+      camera_->generateRay(fx, fy, ray->dir);
+
+      ray->samid = samid;
+
+      ray->w[0] = 1.f;
+      ray->w[1] = 1.f;
+      ray->w[2] = 1.f;
+
+      ray->depth = 0;
+
+      ray->history[0] = SPRAY_FLOAT_INF;
+      ray->committed = 0;
+      ray->cached = 0;
+    }
+  }
+}
+
 template <typename ShaderT>
 void Tracer<ShaderT>::isectDomsRads(RayBuf<Ray> buf, TContextType *tc) {
   tc->resetRstats();
@@ -181,17 +268,60 @@ void Tracer<ShaderT>::isectDomsRads(RayBuf<Ray> buf, TContextType *tc) {
   }
 }
 
+template <typename ShaderT>
+void Tracer<ShaderT>::enqCachedRads(RayBuf<Ray> buf, TContextType *tc) {
+  tc->resetRstats();
+#pragma omp for schedule(static, 1)
+  for (std::size_t i = 0; i < buf.num; ++i) {
+    tc->enqCachedRad(&buf.rays[i]);
+  }
+}
+
+template <typename ShaderT>
+void Tracer<ShaderT>::beginPrimaryHits() {
+  // adaptive passes jitter the eye rays differently each time
+  if (!cache_primary_hits_ || adaptive_) {
+    replay_primary_hits_ = false;
+    return;
+  }
+  replay_primary_hits_ = primary_hits_.valid(camera_->getVersion());
+}
+
+template <typename ShaderT>
+void Tracer<ShaderT>::setPrimaryHits(int tile) {
+  PrimaryHit *hits = nullptr;
+  if (cache_primary_hits_ && !adaptive_) {
+    hits = replay_primary_hits_
+               ? primary_hits_.getTile(tile)
+               : primary_hits_.beginRecord(tile, shared_eyes_.num);
+  }
+  for (auto &t : tcontexts_) t.setPrimaryHits(hits, replay_primary_hits_);
+}
+
+template <typename ShaderT>
+void Tracer<ShaderT>::endPrimaryHits() {
+  if (cache_primary_hits_ && !adaptive_ && !replay_primary_hits_) {
+    primary_hits_.commit(camera_->getVersion());
+  }
+}
+
 template <typename ShaderT>
 void Tracer<ShaderT>::trace() {
+  if (adaptive_) shader_.setPass(adaptive_->getPass());
+  beginPrimaryHits();
+
 #pragma omp parallel
   {
     while (!tile_list_.empty()) {
 #pragma omp barrier
-#pragma omp single
+      // pop() may claim the next tile over MPI, so it runs on the main thread
+#pragma omp master
       {
+        blocking_tile_index_ = tile_list_.getIndex();
         blocking_tile_ = tile_list_.front();
         tile_list_.pop();
       }
+#pragma omp barrier
 
       TContextType *tcontext = &tcontexts_[omp_get_thread_num()];
       tcontext->resetMems();
@@ -200,20 +330,32 @@ void Tracer<ShaderT>::trace() {
       {
         pcontext_.reset();
 
-        shared_eyes_.num = (std::size_t)(blocking_tile_.w * blocking_tile_.h) *
-                           num_pixel_samples_;
+        if (adaptive_) {
+          adaptive_->getActivePixels(blocking_tile_, blocking_tile_,
+                                     &active_pixels_);
+          shared_eyes_.num = active_pixels_.size() * num_pixel_samples_;
+        } else {
+          shared_eyes_.num =
+              (std::size_t)(blocking_tile_.w * blocking_tile_.h) *
+              num_pixel_samples_;
 #ifdef SPRAY_GLOG_CHECK
-        CHECK(shared_eyes_.num);
+          CHECK(shared_eyes_.num);
 #endif
+        }
         if (shared_eyes_.num) {
           shared_eyes_.rays =
               tcontext->template allocMemIn<Ray>(shared_eyes_.num);
         }
+        setPrimaryHits(blocking_tile_index_);
       }
 
       if (shared_eyes_.num) {
         glm::vec3 cam_pos = camera_->getPosition();
-        if (num_pixel_samples_ > 1) {
+        if (adaptive_) {
+          genAdaptiveEyes(image_w_, cam_pos[0], cam_pos[1], cam_pos[2],
+                          blocking_tile_, &shared_eyes_);
+
+        } else if (num_pixel_samples_ > 1) {
           genMultiEyes(image_w_, cam_pos[0], cam_pos[1], cam_pos[2],
                        blocking_tile_, &shared_eyes_);
 
@@ -223,25 +365,44 @@ void Tracer<ShaderT>::trace() {
         }
 
 #pragma omp barrier
-        isectDomsRads(shared_eyes_, tcontext);
+        if (replay_primary_hits_) {
+          enqCachedRads(shared_eyes_, tcontext);
+        } else {
+          isectDomsRads(shared_eyes_, tcontext);
+        }
 #pragma omp barrier
       }
 
-      pcontext_.isectPrims<SceneType, ShaderT>(scene_, shader_, tcontext);
+      pcontext_.isectPrims<SceneType, ShaderT>(scene_, shader_, &tcontexts_);
     }
   }
   tile_list_.reset();
+  endPrimaryHits();
+#ifdef SPRAY_PROFILING_COUNTERS
+  std::size_t mem_bytes = 0;
+  for (const auto &t : tcontexts_) mem_bytes += t.getMemBytes();
+  spray::tAgg(spray::COUNTER_RAY_MEM, mem_bytes);
+#endif
 }
 
 template <typename ShaderT>
 void Tracer<ShaderT>::traceInOmp() {
+#pragma omp single
+  {
+    if (adaptive_) shader_.setPass(adaptive_->getPass());
+    beginPrimaryHits();
+  }
+
   while (!tile_list_.empty()) {
 #pragma omp barrier
-#pragma omp single
+    // pop() may claim the next tile over MPI, so it runs on the main thread
+#pragma omp master
     {
+      blocking_tile_index_ = tile_list_.getIndex();
       blocking_tile_ = tile_list_.front();
       tile_list_.pop();
     }
+#pragma omp barrier
 
     TContextType *tcontext = &tcontexts_[omp_get_thread_num()];
     tcontext->resetMems();
@@ -250,20 +411,32 @@ void Tracer<ShaderT>::traceInOmp() {
     {
       pcontext_.reset();
 
-      shared_eyes_.num = (std::size_t)(blocking_tile_.w * blocking_tile_.h) *
-                         num_pixel_samples_;
+      if (adaptive_) {
+        adaptive_->getActivePixels(blocking_tile_, blocking_tile_,
+                                   &active_pixels_);
+        shared_eyes_.num = active_pixels_.size() * num_pixel_samples_;
+      } else {
+        shared_eyes_.num =
+            (std::size_t)(blocking_tile_.w * blocking_tile_.h) *
+            num_pixel_samples_;
 #ifdef SPRAY_GLOG_CHECK
-      CHECK(shared_eyes_.num);
+        CHECK(shared_eyes_.num);
 #endif
+      }
       if (shared_eyes_.num) {
         shared_eyes_.rays =
             tcontext->template allocMemIn<Ray>(shared_eyes_.num);
       }
+      setPrimaryHits(blocking_tile_index_);
     }
 
     if (shared_eyes_.num) {
       glm::vec3 cam_pos = camera_->getPosition();
-      if (num_pixel_samples_ > 1) {
+      if (adaptive_) {
+        genAdaptiveEyes(image_w_, cam_pos[0], cam_pos[1], cam_pos[2],
+                        blocking_tile_, &shared_eyes_);
+
+      } else if (num_pixel_samples_ > 1) {
         genMultiEyes(image_w_, cam_pos[0], cam_pos[1], cam_pos[2],
                      blocking_tile_, &shared_eyes_);
 
@@ -273,14 +446,27 @@ void Tracer<ShaderT>::traceInOmp() {
       }
 
 #pragma omp barrier
-      isectDomsRads(shared_eyes_, tcontext);
+      if (replay_primary_hits_) {
+        enqCachedRads(shared_eyes_, tcontext);
+      } else {
+        isectDomsRads(shared_eyes_, tcontext);
+      }
 #pragma omp barrier
     }
 
-    pcontext_.isectPrims<SceneType, ShaderT>(scene_, shader_, tcontext);
+    pcontext_.isectPrims<SceneType, ShaderT>(scene_, shader_, &tcontexts_);
   }
-#pragma omp single
-  tile_list_.reset();
+#pragma omp master
+  {
+    tile_list_.reset();
+    endPrimaryHits();
+#ifdef SPRAY_PROFILING_COUNTERS
+    std::size_t mem_bytes = 0;
+    for (const auto &t : tcontexts_) mem_bytes += t.getMemBytes();
+    spray::tAgg(spray::COUNTER_RAY_MEM, mem_bytes);
+#endif
+  }
+#pragma omp barrier
 }
 
 }  // namespace ooc
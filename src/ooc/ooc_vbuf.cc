@@ -39,7 +39,7 @@ void VBuf::resize(const spray::Tile& tile, int num_pixel_samples) {
 }
 
 bool VBuf::correct(const Ray& ray) const {
-  const auto ray_depth = ray.depth;
+  const int ray_depth = ray.depth;
   auto offset = (std::size_t)ray.samid * SPRAY_SPECU_HISTORY_SIZE;
   bool correct = true;
   for (int i = 0; i < ray_depth; ++i) {
@@ -52,14 +52,14 @@ bool VBuf::correct(const Ray& ray) const {
 }
 
 bool VBuf::update(float t, Ray* ray) {
-  const auto ray_depth = ray->depth;
+  const int ray_depth = ray->depth;
   int update_pos = ray_depth;
 
   const auto offset = (std::size_t)ray->samid * SPRAY_SPECU_HISTORY_SIZE;
 
   // scan past t values only (history check)
   // so no checking for camera rays
-  for (unsigned i = 0; i < ray_depth; ++i) {
+  for (int i = 0; i < ray_depth; ++i) {
     auto local_t = ray->history[i];
     auto global_t = tbuf_[offset + i];
 
@@ -103,7 +103,7 @@ bool VBuf::update(float t, Ray* ray) {
   }
 
   if (updated) {
-    for (unsigned i = ray_depth + 1; i < SPRAY_SPECU_HISTORY_SIZE; ++i) {
+    for (int i = ray_depth + 1; i < SPRAY_SPECU_HISTORY_SIZE; ++i) {
       tbuf_[offset + i] = SPRAY_FLOAT_INF;
     }
   }
@@ -0,0 +1,168 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#include "render/adaptive_sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "utils/math.h"
+
+// luminance below which the error is measured in absolute terms
+#define SPRAY_ADAPTIVE_MIN_LUMINANCE 1e-3f
+
+namespace spray {
+
+void AdaptiveSampler::init(int image_w, int image_h, int num_pixel_samples,
+                           float threshold, int min_passes,
+                           std::size_t ray_budget) {
+  CHECK_GT(num_pixel_samples, 0);
+  CHECK_GT(threshold, 0.f);
+
+  image_w_ = image_w;
+  image_h_ = image_h;
+  num_pixel_samples_ = num_pixel_samples;
+  threshold_ = threshold;
+  // the variance needs two passes
+  min_passes_ = std::max(2, min_passes);
+
+  max_active_ = 0;
+  if (ray_budget) {
+    max_active_ = std::max((std::size_t)1, ray_budget / num_pixel_samples);
+  }
+
+  std::size_t npixels = (std::size_t)image_w * image_h;
+
+  PixelStats zero;
+  zero.sum = glm::vec3(0.f);
+  zero.mean = 0.f;
+  zero.m2 = 0.f;
+  zero.n = 0;
+  stats_.assign(npixels, zero);
+  active_.resize(npixels);
+
+  pass_ = 0;
+  select();
+}
+
+void AdaptiveSampler::getActivePixels(const Tile& blocking_tile,
+                                      const Tile& tile,
+                                      std::vector<int>* pixels) const {
+  pixels->clear();
+  for (int y = tile.y; y < tile.y + tile.h; ++y) {
+    int pixid_offset = y * image_w_;
+    int bufid_offset = blocking_tile.w * (y - blocking_tile.y);
+    for (int x = tile.x; x < tile.x + tile.w; ++x) {
+      if (active_[pixid_offset + x]) {
+        pixels->push_back(bufid_offset + (x - blocking_tile.x));
+      }
+    }
+  }
+}
+
+void AdaptiveSampler::update(const HdrImage& image) {
+  CHECK_EQ(image.w, image_w_);
+  CHECK_EQ(image.h, image_h_);
+
+  const int npixels = image_w_ * image_h_;
+
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < npixels; ++i) {
+    if (!active_[i]) continue;
+
+    glm::vec3 c(image.buf[i].r, image.buf[i].g, image.buf[i].b);
+    float l = luminance(c);
+
+    // welford's update
+    PixelStats& s = stats_[i];
+    ++s.n;
+    float delta = l - s.mean;
+    s.mean += delta / s.n;
+    s.m2 += delta * (l - s.mean);
+    s.sum += c;
+  }
+
+  ++pass_;
+  select();
+}
+
+void AdaptiveSampler::resolve(HdrImage* image) const {
+  const int npixels = image_w_ * image_h_;
+
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < npixels; ++i) {
+    const PixelStats& s = stats_[i];
+    glm::vec3 c = s.n ? s.sum / (float)s.n : glm::vec3(0.f);
+    image->set(i, &c[0]);
+  }
+}
+
+float AdaptiveSampler::getError(const PixelStats& s) const {
+  if (s.n < min_passes_) return std::numeric_limits<float>::infinity();
+
+  float variance = s.m2 / (s.n - 1);
+  float std_error = std::sqrt(variance / s.n);
+  return std_error / std::max(s.mean, SPRAY_ADAPTIVE_MIN_LUMINANCE);
+}
+
+void AdaptiveSampler::select() {
+  candidates_.clear();
+
+  const int npixels = image_w_ * image_h_;
+  for (int i = 0; i < npixels; ++i) {
+    const PixelStats& s = stats_[i];
+    float error = getError(s);
+    if (error > threshold_) {
+      Candidate c;
+      c.error = error;
+      c.n = s.n;
+      c.pixid = i;
+      candidates_.push_back(c);
+    }
+  }
+
+  // over budget: pixels short of min_passes first (fewest passes first), then
+  // the largest errors. pixel IDs break ties so that every rank agrees.
+  if (max_active_ && candidates_.size() > max_active_) {
+    const int min_passes = min_passes_;
+    auto higher = [min_passes](const Candidate& a, const Candidate& b) {
+      if (a.n < min_passes || b.n < min_passes) {
+        if (a.n != b.n) return a.n < b.n;
+      } else if (a.error != b.error) {
+        return a.error > b.error;
+      }
+      return a.pixid < b.pixid;
+    };
+    std::nth_element(candidates_.begin(), candidates_.begin() + max_active_,
+                     candidates_.end(), higher);
+    candidates_.resize(max_active_);
+  }
+
+  std::fill(active_.begin(), active_.end(), 0);
+  for (const auto& c : candidates_) active_[c.pixid] = 1;
+
+  num_active_ = candidates_.size();
+}
+
+}  // namespace spray
@@ -0,0 +1,136 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glog/logging.h"
+
+#include "display/image.h"
+#include "render/tile.h"
+
+namespace spray {
+
+/**
+ * Progressive adaptive sampling across frames.
+ *
+ * Each frame is a pass that renders pixel_samples samples for every active
+ * pixel. The pass image of a pixel is one sample of its estimator, so the
+ * running mean and variance of the pass luminance give a per-pixel standard
+ * error. A pixel stays active until its relative error drops below the
+ * threshold. If the active pixels exceed the eye ray budget of a pass, the
+ * ones with the largest error are kept.
+ *
+ * All ranks update the sampler with the same composited pass image, so they
+ * agree on the active pixels without further communication.
+ */
+class AdaptiveSampler {
+ public:
+  AdaptiveSampler()
+      : image_w_(0),
+        image_h_(0),
+        num_pixel_samples_(1),
+        threshold_(0.f),
+        min_passes_(2),
+        max_active_(0),
+        num_active_(0),
+        pass_(0) {}
+
+  /**
+   * Activates every pixel for the first pass.
+   *
+   * \param threshold Relative standard error below which a pixel converges.
+   * \param min_passes Passes a pixel takes before its error is trusted.
+   * \param ray_budget Eye rays per pass. 0 for no limit.
+   */
+  void init(int image_w, int image_h, int num_pixel_samples, float threshold,
+            int min_passes, std::size_t ray_budget);
+
+  //! Index of the pass to be rendered next.
+  int getPass() const { return pass_; }
+
+  std::size_t getNumActive() const { return num_active_; }
+
+  bool converged() const { return num_active_ == 0; }
+
+  bool isActive(int pixid) const {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(pixid, (int)active_.size());
+#endif
+    return active_[pixid] != 0;
+  }
+
+  /**
+   * Collects the active pixels of a tile.
+   *
+   * \param blocking_tile The blocking tile that sample IDs are laid out in.
+   * \param tile A part of the blocking tile.
+   * \param pixels Offsets of the active pixels into the blocking tile.
+   */
+  void getActivePixels(const Tile& blocking_tile, const Tile& tile,
+                       std::vector<int>* pixels) const;
+
+  /**
+   * Accumulates a pass and selects the pixels of the next pass.
+   *
+   * \param image Radiance of the pass, averaged over the pixel samples.
+   */
+  void update(const HdrImage& image);
+
+  //! Writes the accumulated mean of every pixel into the image.
+  void resolve(HdrImage* image) const;
+
+ private:
+  struct PixelStats {
+    glm::vec3 sum;  // sum of pass radiance
+    float mean;     // running mean of pass luminance
+    float m2;       // sum of squared deviations of pass luminance
+    int n;          // number of passes
+  };
+
+  struct Candidate {
+    float error;
+    int n;
+    int pixid;
+  };
+
+  float getError(const PixelStats& s) const;
+  void select();
+
+ private:
+  int image_w_;
+  int image_h_;
+  int num_pixel_samples_;
+  float threshold_;
+  int min_passes_;
+  std::size_t max_active_;  // active pixels per pass, 0 for no limit
+
+  std::vector<PixelStats> stats_;
+  std::vector<uint8_t> active_;
+  std::vector<Candidate> candidates_;
+  std::size_t num_active_;
+  int pass_;
+};
+
+}  // namespace spray
@@ -25,15 +25,21 @@
 #include "glog/logging.h"
 #include "pbrt/memory3.h"
 
+#include "utils/bitset.h"
+
 namespace spray {
 
 template <typename T>
 class ArenaQ;
 
+/**
+ * Per-domain arena queues. An occupancy bitset tracks exactly which queues
+ * hold items, so emptiness checks and domain loops skip empty queues.
+ */
 template <typename T>
 class ArenaQs {
  public:
-  ArenaQs() : qs_(nullptr) {}
+  ArenaQs() : qs_(nullptr), size_(0) {}
   ~ArenaQs() { delete[] qs_; }
 
   void resize(int array_size) {
@@ -43,6 +49,7 @@ class ArenaQs {
     delete[] qs_;
     size_ = array_size;
     qs_ = new MemoryArena3[array_size];
+    occupied_.resize(array_size);
   }
 
   T* allocate(int i, std::size_t count) {
@@ -57,6 +64,7 @@ class ArenaQs {
     CHECK_LT(i, size_);
 #endif
     qs_[i].template copy<T>(src);
+    occupied_.set(i);
   }
 
   void push(int i, const T& src) {
@@ -64,6 +72,7 @@ class ArenaQs {
     CHECK_LT(i, size_);
 #endif
     qs_[i].template copy<T>(&src);
+    occupied_.set(i);
   }
 
   void reset(int i) {
@@ -71,6 +80,7 @@ class ArenaQs {
     CHECK_LT(i, size_);
 #endif
     qs_[i].reset();
+    occupied_.reset(i);
 #ifdef DRT_GLOG_CHECK
     CHECK(qs_[i].empty());
     CHECK_EQ(qs_[i].size<T>(), 0);
@@ -78,33 +88,33 @@ class ArenaQs {
   }
 
   void reset() {
-    for (int i = 0; i < size_; ++i) reset(i);
+    for (int i = 0; i < size_; ++i) qs_[i].reset();
+    occupied_.clear();
   }
 
   bool empty(int i) const {
 #ifdef DRT_GLOG_CHECK
     CHECK_LT(i, size_);
 #endif
-    return qs_[i].empty();
+    return !occupied_.test(i);
   }
 
-  bool empty() const {
-    for (int i = 0; i < size_; ++i) {
-      if (!qs_[i].empty()) return false;
-    }
-    return true;
-  }
+  bool empty() const { return occupied_.none(); }
+
+  //! Returns the first non-empty queue at or after i, or size_ if none.
+  int nextNonEmpty(int i) const { return occupied_.findNext(i); }
+  int firstNonEmpty() const { return occupied_.findFirst(); }
 
   std::size_t size(int i) const {
 #ifdef DRT_GLOG_CHECK
     CHECK_LT(i, size_);
 #endif
-    return qs_[i].template size<T>();
+    return occupied_.test(i) ? qs_[i].template size<T>() : 0;
   }
 
   std::size_t size() const {
     std::size_t c = 0;
-    for (int i = 0; i < size_; ++i) {
+    for (int i = firstNonEmpty(); i < size_; i = nextNonEmpty(i + 1)) {
       c += qs_[i].template size<T>();
     }
     return c;
@@ -122,6 +132,7 @@ class ArenaQs {
     CHECK_LT(i, size_);
 #endif
     qs_[i].template incrementSize<T>(count);
+    if (count) occupied_.set(i);
   }
 
   int getNumValidBlocks(int i) const {
@@ -137,9 +148,16 @@ class ArenaQs {
   friend class ArenaQ<T>;
   MemoryArena3& get(int i) const { return qs_[i]; }
 
+  //! Takes all items of the i-th queue out.
+  void spliceTo(int i, MemoryArena3* dest) {
+    dest->splice(qs_[i]);
+    occupied_.reset(i);
+  }
+
  private:
   MemoryArena3* qs_;
   int size_;
+  OccupancyBitset occupied_;
 };
 
 template <typename T>
@@ -154,7 +172,7 @@ class ArenaQ {
   const std::list<MemBlock>& getBlocks() const { return q_.getBlocks(); }
 
   void splice(ArenaQ* other) { q_.splice(other->q_); }
-  void splice(int i, ArenaQs<T>* other_qs) { q_.splice(other_qs->get(i)); }
+  void splice(int i, ArenaQs<T>* other_qs) { other_qs->spliceTo(i, &q_); }
 
   void incrementSize(std::size_t count) { q_.template incrementSize<T>(count); }
   std::size_t size() const { return q_.template size<T>(); }
@@ -39,6 +39,7 @@ void BlockBuffer::alloc(int ndomains, int max_nblocks) {
   capacity_ = AllocAligned<int>(ndomains);
   size_ = AllocAligned<int>(ndomains);
   ndomains_ = ndomains;
+  occupied_.resize(ndomains);
 
   for (int i = 0; i < ndomains; ++i) {
     block_[i] = AllocAligned<MemBlock>(max_nblocks);
@@ -61,6 +62,11 @@ void BlockBuffer::parallelResetAll() {
   for (int id = 0; id < ndomains_; ++id) {
     size_[id] = 0;
   }
+  std::size_t nwords = occupied_.getNumWords();
+#pragma omp for schedule(static)
+  for (std::size_t w = 0; w < nwords; ++w) {
+    occupied_.resetWord(w);
+  }
 }
 
 void BlockBuffer::reset() {
@@ -73,6 +79,7 @@ void BlockBuffer::reset() {
     }
     size_[id] = 0;
   }
+  occupied_.clear();
 }
 
 void BlockBuffer::reset(int id) {
@@ -83,6 +90,7 @@ void BlockBuffer::reset(int id) {
     blk.buf = nullptr;
   }
   size_[id] = 0;
+  occupied_.reset(id);
 }
 
 // NOTE: this function does not preserve existing items.
@@ -104,6 +112,7 @@ void BlockBuffer::resize(int id, int size) {
       blk.buf = nullptr;
     }
   }
+  occupied_.reset(id);
 }
 
 void BlockBuffer::push(int id, std::size_t block_size, uint8_t* buf) {
@@ -114,6 +123,7 @@ void BlockBuffer::push(int id, std::size_t block_size, uint8_t* buf) {
   // b.capacity = block_capacity;
   b.buf = buf;
   size_[id] = size + 1;
+  if (block_size) occupied_.setAtomic(id);
 }
 
 void BlockBuffer::set(int id, int idx, std::size_t block_size, uint8_t* buf) {
@@ -122,6 +132,7 @@ void BlockBuffer::set(int id, int idx, std::size_t block_size, uint8_t* buf) {
   b.size = block_size;
   // b.capacity = block_capacity;
   b.buf = buf;
+  if (block_size) occupied_.setAtomic(id);
 #ifdef SPRAY_GLOG_CHECK
   CHECK(b.size);
   CHECK_NOTNULL(b.buf);
@@ -133,6 +144,7 @@ void BlockBuffer::append(int id, const MemBlock& block) {
   CHECK_LT(idx, capacity_[id]);
   block_[id][idx] = block;
   size_[id] = idx + 1;
+  if (block.size) occupied_.setAtomic(id);
 }
 
 void BlockBuffer::append(int id, std::size_t block_size,
@@ -144,6 +156,7 @@ void BlockBuffer::append(int id, std::size_t block_size,
   // b.capacity = block_capacity;
   b.buf = buf;
   size_[id] = idx + 1;
+  if (block_size) occupied_.setAtomic(id);
 }
 
 void BlockBuffer::setLastBlock(int id, std::size_t block_size, uint8_t* buf) {
@@ -156,6 +169,7 @@ void BlockBuffer::setLastBlock(int id, std::size_t block_size, uint8_t* buf) {
   CHECK(b.buf == nullptr);
 #endif
   b.buf = buf;
+  if (block_size) occupied_.setAtomic(id);
 }
 
 int BlockBuffer::getNumBlocks(int id) const { return size_[id]; }
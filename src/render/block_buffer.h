@@ -24,6 +24,8 @@
 
 #include "pbrt/memory3.h"
 
+#include "utils/bitset.h"
+
 namespace spray {
 
 class BlockBuffer {
@@ -56,6 +58,7 @@ class BlockBuffer {
     CHECK_NOTNULL(b.buf);
 #endif
     b.size += (count * sizeof(T));
+    if (count) occupied_.setAtomic(id);
   }
 
   void append(int id, const MemBlock& block);
@@ -89,7 +92,7 @@ class BlockBuffer {
   }
 
   bool empty(int id) const {
-    std::size_t num = 0;
+    if (!occupied_.test(id)) return true;
     for (int i = 0; i < size_[id]; ++i) {
       const MemBlock& b = block_[id][i];
       if (b.size) return false;
@@ -98,8 +101,8 @@ class BlockBuffer {
   }
 
   bool empty() const {
-    std::size_t num = 0;
-    for (int i = 0; i < ndomains_; ++i) {
+    for (int i = occupied_.findFirst(); i < ndomains_;
+         i = occupied_.findNext(i + 1)) {
       if (!empty(i)) return false;
     }
     return true;
@@ -124,6 +127,12 @@ class BlockBuffer {
 
   //! Number of domains.
   int ndomains_;
+
+  /**
+   * Per-domain occupancy. A set bit means the domain may hold a non-empty
+   * block; a cleared bit means all its blocks are empty.
+   */
+  OccupancyBitset occupied_;
 };
 
 }  // namespace spray
@@ -31,6 +31,8 @@ namespace spray {
 
 class Camera {
  public:
+  Camera() : version_(0) {}
+
   void init(const glm::vec3 campos, const glm::vec3 lookat,
             const glm::vec3 upvec, float vfov, int image_w, int image_h);
 
@@ -66,6 +68,12 @@ class Camera {
   /** Returns the aspect ratio of the image plane (width / height). */
   float getAspectRatio() const { return image_aspect_ratio_; }
 
+  /**
+   * Returns a counter that changes whenever the camera moves. Eye rays of two
+   * frames with the same version are identical.
+   */
+  unsigned getVersion() const { return version_; }
+
   void generateRay(float x, float y, glm::vec3* org, glm::vec3* dir) const;
   void generateRay(float x, float y, float org[3], float dir[3]) const;
   void generateRay(float x, float y, float dir[3]) const;
@@ -123,6 +131,8 @@ class Camera {
   float image_aspect_ratio_;  ///< Image aspect ratio.
   float image_half_w_;
   float image_half_h_;
+
+  unsigned version_;  ///< Bumped on every (re-)initialization.
 };
 
 inline void Camera::init(const glm::vec3 campos, const glm::vec3 lookat,
@@ -163,6 +173,8 @@ inline void Camera::init(const glm::vec3 campos, const glm::vec3 lookat,
 
   u_vec_ = u;
   v_vec_ = v;
+
+  ++version_;
 }
 
 inline void Camera::reset(const glm::vec3 campos, const glm::vec3 lookat,
@@ -24,7 +24,9 @@
 
 #include "glog/logging.h"
 
+#include "pbrt/memory.h"
 #include "render/light.h"
+#include "render/path_sampler.h"
 #include "render/spray.h"
 #include "utils/util.h"
 
@@ -46,15 +48,25 @@ Config::Config() {
   output_filename = "spray.ppm";
   light_samples = 1;
   bounces = 1;
+  light_selection = LIGHT_SELECTION_ALL;
+  sampled_lights = 1;
+  rr_depth = -1;
 
   // schedule
   partition = IMAGE;
   num_partitions = 1;
+  repartition = 0.f;
+  replicas = 0;
+  steal_tiles = 0;
 
   // visualization
   view_mode = VIEW_MODE_GLFW;
 
   cache_size = -1;
+  cache_primary_hits = false;
+
+  pack_rays = false;
+  comm_thread = false;
 
   // ao settings
   ao_samples = 8;
@@ -62,11 +74,19 @@ Config::Config() {
 
   // pt settings
   pixel_samples = 4;
+  sampler = PathSampler::RANDOM;
+  adaptive_threshold = 0.f;
+  adaptive_min_passes = 4;
+  adaptive_budget = 0;
 
   maximum_num_screen_space_samples_per_rank = 1024 * 1024;
 
   nthreads = 1;
 
+  numa_interleave = false;
+
+  huge_pages = HUGE_PAGES_OFF;
+
   shading = SPRAY_SHADING_LAMBERT;
 
   dev_mode = DEVMODE_NORMAL;
@@ -85,20 +105,48 @@ void Config::printUsage(char** argv) {
       "  --num-partitions <number of partitions>, effective in partition view "
       "mode\n");
   printf("  --partition <image | hybrid | insitu>\n");
+  printf("  --repartition <min. relative gain (0: off)>\n");
+  printf("     rebalance insitu domains between frames by measured cost\n");
+  printf("     when the busiest rank gets at least this much cheaper\n");
+  printf("  --replicas <max. number of hot domains copied to a rank (0)>\n");
+  printf("     spread rays of the costliest insitu domains over copies\n");
+  printf("  --steal-tiles <min. number of image tiles per rank (0: off)>\n");
+  printf("     ranks claim tiles from a shared counter in ooc image mode\n");
   printf("  --cache-size <max. number of domains>\n");
+  printf("     in hybrid mode, cached remote domains on top of owned ones\n");
+  printf("  --cache-primary-hits\n");
+  printf("     reuse eye-ray hits across frames of a static camera\n");
+  printf("  --pack-rays\n");
+  printf("     send quantized rays between ranks in insitu mode (lossy)\n");
+  printf("  --comm-thread\n");
+  printf("     exchange rays on a progress thread in insitu mode\n");
   printf("  --width, -w <image_width>\n");
   printf("  --height, -h <image_height>\n");
   printf("  --frames <number of frames (-1)>\n");
   printf("  --light-samples, <number of light samples (1)>\n");
   printf("  --bounces, <number of bounces (1)>\n");
+  printf("  --light-selection <all | power>\n");
+  printf("     shade every light or pick lights by power at each hit (all)\n");
+  printf("  --sampled-lights <number of lights picked per hit (1)>\n");
+  printf("  --rr-depth <first bounce with russian roulette (-1: off)>\n");
   printf("  --camera-up <upx upy upz>\n");
   printf("  --camera <posx posy posz lookx looky lookz>\n");
   printf("  --ao-samples <number of samples in AO (8)>\n");
   printf("  --pixel-samples <number of pixel samples (4)>\n");
+  printf("  --sampler <random | sobol>\n");
+  printf("     sample generator for pixels, lights and BSDFs (random)\n");
+  printf("  --adaptive-threshold <relative error (0: off)>\n");
+  printf("     render frames as passes over unconverged pixels (film mode)\n");
+  printf("  --adaptive-min-passes <passes before a pixel can converge (4)>\n");
+  printf("  --adaptive-budget <eye rays per pass (0: unlimited)>\n");
   printf(
       "  --max-samples-per-rank <maximum number of screen-space samples per "
       "rank (1048576)>\n");
   printf("  --nthreads <number of threads (1)>\n");
+  printf("  --numa-interleave\n");
+  printf("     interleave mesh buffer pages across NUMA nodes\n");
+  printf("  --huge-pages <off | thp | hugetlb>\n");
+  printf("     back mesh buffers and ray arenas with 2 MB pages (off)\n");
   printf("  --shading <lambert | blinn>\n");
   printf("  --blinn ks_r ks_g ks_b shininess\n");
   printf("  --dev-mode\n");
@@ -128,6 +176,21 @@ void Config::parse(int argc, char** argv) {
       {"blinn", required_argument, 0, 405},
       {"max-samples-per-rank", required_argument, 0, 406},
       {"ply-path", required_argument, 0, 408},
+      {"numa-interleave", no_argument, 0, 409},
+      {"huge-pages", required_argument, 0, 410},
+      {"light-selection", required_argument, 0, 411},
+      {"sampled-lights", required_argument, 0, 412},
+      {"rr-depth", required_argument, 0, 413},
+      {"adaptive-threshold", required_argument, 0, 414},
+      {"adaptive-min-passes", required_argument, 0, 415},
+      {"adaptive-budget", required_argument, 0, 416},
+      {"sampler", required_argument, 0, 417},
+      {"cache-primary-hits", no_argument, 0, 418},
+      {"pack-rays", no_argument, 0, 419},
+      {"comm-thread", no_argument, 0, 420},
+      {"repartition", required_argument, 0, 421},
+      {"replicas", required_argument, 0, 422},
+      {"steal-tiles", required_argument, 0, 423},
       {"dev-mode", no_argument, 0, 1000},
       {0, 0, 0, 0}};
 
@@ -259,6 +322,97 @@ void Config::parse(int argc, char** argv) {
         ply_path = optarg;
       } break;
 
+      case 409: {  // --numa-interleave
+        numa_interleave = true;
+      } break;
+
+      case 410: {  // --huge-pages
+        std::string cfg_huge_pages = optarg;
+        if (cfg_huge_pages == "off") {
+          huge_pages = HUGE_PAGES_OFF;
+        } else if (cfg_huge_pages == "thp") {
+          huge_pages = HUGE_PAGES_THP;
+        } else if (cfg_huge_pages == "hugetlb") {
+          huge_pages = HUGE_PAGES_HUGETLB;
+        } else {
+          LOG(FATAL) << "unsupported huge page mode: " << cfg_huge_pages;
+        }
+      } break;
+
+      case 411: {  // --light-selection
+        std::string cfg_light_selection = optarg;
+        if (cfg_light_selection == "all") {
+          light_selection = LIGHT_SELECTION_ALL;
+        } else if (cfg_light_selection == "power") {
+          light_selection = LIGHT_SELECTION_POWER;
+        } else {
+          LOG(FATAL) << "unsupported light selection: " << cfg_light_selection;
+        }
+      } break;
+
+      case 412: {  // --sampled-lights
+        sampled_lights = atoi(optarg);
+        CHECK_GT(sampled_lights, 0);
+      } break;
+
+      case 413: {  // --rr-depth
+        rr_depth = atoi(optarg);
+      } break;
+
+      case 414: {  // --adaptive-threshold
+        adaptive_threshold = atof(optarg);
+        CHECK_GE(adaptive_threshold, 0.f);
+      } break;
+
+      case 415: {  // --adaptive-min-passes
+        adaptive_min_passes = atoi(optarg);
+        CHECK_GT(adaptive_min_passes, 1);
+      } break;
+
+      case 416: {  // --adaptive-budget
+        adaptive_budget = atol(optarg);
+        CHECK_GE(adaptive_budget, 0);
+      } break;
+
+      case 417: {  // --sampler
+        std::string cfg_sampler = optarg;
+        if (cfg_sampler == "random") {
+          sampler = PathSampler::RANDOM;
+        } else if (cfg_sampler == "sobol") {
+          sampler = PathSampler::SOBOL;
+        } else {
+          LOG(FATAL) << "unsupported sampler: " << cfg_sampler;
+        }
+      } break;
+
+      case 418: {  // --cache-primary-hits
+        cache_primary_hits = true;
+      } break;
+
+      case 419: {  // --pack-rays
+        pack_rays = true;
+      } break;
+
+      case 420: {  // --comm-thread
+        comm_thread = true;
+      } break;
+
+      case 421: {  // --repartition
+        repartition = atof(optarg);
+        CHECK_GE(repartition, 0.f);
+        CHECK_LT(repartition, 1.f);
+      } break;
+
+      case 422: {  // --replicas
+        replicas = atoi(optarg);
+        CHECK_GE(replicas, 0);
+      } break;
+
+      case 423: {  // --steal-tiles
+        steal_tiles = atoi(optarg);
+        CHECK_GE(steal_tiles, 0);
+      } break;
+
       case 1000: {  // --dev-mode
         dev_mode = DEVMODE_DEV;
       } break;
@@ -62,16 +62,29 @@ class Config {
   int light_samples;
   int bounces;
 
+  enum LightSelection { LIGHT_SELECTION_ALL, LIGHT_SELECTION_POWER };
+  int light_selection;
+  int sampled_lights;  // lights picked per hit with LIGHT_SELECTION_POWER
+  int rr_depth;        // first bounce with russian roulette, -1 disables it
+
   // schedule
   enum Partition { IMAGE, HYBRID, INSITU };
   int partition;
   int num_partitions;  // effective when VIEW_MODE_PARTITION used
+  float repartition;   // min. cost gain to rebalance insitu domains, 0: off
+  int replicas;        // max. hot domain copies per rank in insitu mode
+  int steal_tiles;     // min. shared image tiles per rank in ooc mode, 0: off
 
   // view mode
   ViewMode view_mode;
 
   // cache
   int cache_size;
+  bool cache_primary_hits;  // reuse eye-ray hits while the camera is static
+
+  // communication
+  bool pack_rays;    // quantize rays sent between ranks (insitu)
+  bool comm_thread;  // exchange rays on a progress thread (insitu)
 
   // ao settings
   int ao_samples;
@@ -79,12 +92,24 @@ class Config {
 
   // pt settings
   int pixel_samples;
+  int sampler;  // PathSampler::Type
+
+  // adaptive sampling
+  float adaptive_threshold;  // relative error target, 0 disables it
+  int adaptive_min_passes;   // passes before a pixel can converge
+  long adaptive_budget;      // eye rays per pass, 0 for no limit
 
   int maximum_num_screen_space_samples_per_rank;
 
   std::string local_disk_path;
   int nthreads;
 
+  // numa
+  bool numa_interleave;  // interleave mesh buffer pages across sockets
+
+  // huge pages (HugePageMode in pbrt/memory.h)
+  int huge_pages;
+
   enum Shading { SPRAY_SHADING_LAMBERT, SPRAY_SHADING_BLINN };
   int shading;
   float shininess;
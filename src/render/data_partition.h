@@ -21,6 +21,7 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
 #include <list>
 #include <vector>
 
@@ -46,14 +47,28 @@ class InsituPartition {
   };
 
  public:
+  /**
+   * Finds the rank this process sends the rays of a domain to.
+   *
+   * This is the domain's owner unless the domain is replicated (see
+   * replicate()), in which case it is one of the ranks holding a copy.
+   */
   int rank(int id) const {
 #ifdef SPRAY_GLOG_CHECK
     CHECK_LT(id, codes_.size());
 #endif
-    int rank = domain_to_rank_[id];
+    int rank = route_[id];
     return rank;
   }
 
+  //! The rank owning the given domain, ignoring replicas.
+  int owner(int id) const {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(id, codes_.size());
+#endif
+    return domain_to_rank_[id];
+  }
+
   const std::vector<MortonCode>& getCodes() const { return codes_; }
 
   void partition(int ndomains, const std::vector<Domain>& domains,
@@ -216,9 +231,202 @@ class InsituPartition {
   }
 
  public:
+  /**
+   * Rebalances the domains over the ranks by measured per-domain cost.
+   *
+   * The Morton order is cut into contiguous ranges where the cost prefix sum
+   * crosses each rank's equal share, so ranks keep spatially close domains.
+   * The new assignment is taken only if it lowers the cost of the busiest
+   * rank by at least min_gain, which keeps small frame-to-frame fluctuations
+   * from moving domains back and forth.
+   *
+   * \param costs Per-domain costs. Must be identical on all ranks.
+   * \param num_ranks Number of ranks.
+   * \param min_gain Minimum relative reduction of the maximum rank cost.
+   * \return True if the assignment changed.
+   */
+  bool repartition(const std::vector<int64_t>& costs, int num_ranks,
+                   float min_gain) {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_EQ(costs.size(), ndomains_);
+    CHECK_EQ(rank_to_domains_.size(), num_ranks);
+#endif
+    if (ndomains_ < num_ranks) return false;
+
+    std::vector<int64_t> rank_costs(num_ranks, 0);
+    int64_t total = 0;
+    for (int id = 0; id < ndomains_; ++id) {
+      rank_costs[domain_to_rank_[id]] += costs[id];
+      total += costs[id];
+    }
+    if (total == 0) return false;
+
+    int64_t old_max = *std::max_element(rank_costs.begin(), rank_costs.end());
+
+    std::vector<int> domain_to_rank(ndomains_);
+    std::fill(rank_costs.begin(), rank_costs.end(), 0);
+
+    int rank = 0;
+    int rank_size = 0;   // domains assigned to rank so far
+    int64_t prefix = 0;  // cost of the domains before codes_[i]
+
+    for (int i = 0; i < ndomains_; ++i) {
+      int id = codes_[i].domain;
+      int64_t cost = costs[id];
+
+      if (rank_size > 0 && rank < num_ranks - 1) {
+        // move on once the domain's midpoint passes the rank's boundary, or
+        // when the remaining ranks need the remaining domains
+        int64_t boundary = total * (rank + 1) / num_ranks;
+        bool passed = (2 * prefix + cost > 2 * boundary);
+        bool needed = (ndomains_ - i == num_ranks - rank - 1);
+        if (passed || needed) {
+          ++rank;
+          rank_size = 0;
+        }
+      }
+
+      domain_to_rank[id] = rank;
+      rank_costs[rank] += cost;
+      prefix += cost;
+      ++rank_size;
+    }
+
+    int64_t new_max = *std::max_element(rank_costs.begin(), rank_costs.end());
+
+    if ((double)new_max > (1.0 - min_gain) * (double)old_max) return false;
+    if (domain_to_rank == domain_to_rank_) return false;
+
+    domain_to_rank_.swap(domain_to_rank);
+    replicas_.clear();  // copies follow the owners, see replicate()
+    mapDomains(num_ranks);
+    return true;
+  }
+
+  /**
+   * Replicates the most expensive domains onto additional ranks.
+   *
+   * Repeatedly takes the domain with the largest per-copy cost on the
+   * busiest rank that can still be copied and adds a copy on the least-loaded
+   * rank with budget left, assuming a domain's cost splits evenly over its
+   * copies. Only domains costlier than the average domain are copied. Stops
+   * once the busiest rank would no longer get cheaper.
+   *
+   * Rays of a replicated domain stay local if this rank holds a copy.
+   * Otherwise they go to the copy with the least estimated load, assuming
+   * each rank generates an equal part of the domain's rays. Replaces the
+   * replicas of the previous call.
+   *
+   * \param costs Per-domain costs. Must be identical on all ranks.
+   * \param local_rank Rank of this process, whose rays rank() routes.
+   * \param max_replicas Maximum number of copies each rank may take on.
+   */
+  void replicate(const std::vector<int64_t>& costs, int local_rank,
+                 int max_replicas) {
+    int num_ranks = rank_to_domains_.size();
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_EQ(costs.size(), ndomains_);
+    CHECK_LT(local_rank, num_ranks);
+#endif
+    for (auto& r : replicas_) r.clear();
+    replicas_.resize(ndomains_);
+
+    std::vector<double> loads(num_ranks, 0.0);
+    double mean_cost = 0.0;
+    for (int id = 0; id < ndomains_; ++id) {
+      loads[domain_to_rank_[id]] += costs[id];
+      mean_cost += costs[id];
+    }
+    mean_cost /= ndomains_;
+
+    std::vector<int> budgets(num_ranks, max_replicas);
+
+    while (true) {
+      int busiest =
+          std::max_element(loads.begin(), loads.end()) - loads.begin();
+
+      // the busiest rank's domain with the largest cost per copy that can
+      // still go to the least-loaded rank with budget left
+      int hot = -1;
+      int target = -1;
+      double hot_share = 0.0;
+      for (int id = 0; id < ndomains_; ++id) {
+        if (!holds(busiest, id)) continue;
+        double share = costs[id] / (double)getNumCopies(id);
+        if (share <= hot_share || share <= mean_cost) continue;
+
+        int t = -1;
+        for (int r = 0; r < num_ranks; ++r) {
+          if (budgets[r] > 0 && !holds(r, id) &&
+              (t < 0 || loads[r] < loads[t])) {
+            t = r;
+          }
+        }
+        if (t < 0) continue;
+
+        hot = id;
+        target = t;
+        hot_share = share;
+      }
+      if (hot < 0) break;
+
+      double share = costs[hot] / (double)(getNumCopies(hot) + 1);
+      if (loads[target] + share >= loads[busiest]) break;
+
+      loads[domain_to_rank_[hot]] -= hot_share - share;
+      for (int r : replicas_[hot]) loads[r] -= hot_share - share;
+      loads[target] += share;
+
+      replicas_[hot].push_back(target);
+      --budgets[target];
+    }
+
+    mapDomains(num_ranks);
+
+    // route this rank's rays of the replicated domains
+    std::vector<double> copy_loads;
+    for (int id = 0; id < ndomains_; ++id) {
+      if (replicas_[id].empty()) continue;
+
+      std::vector<int> copies(1, domain_to_rank_[id]);
+      copies.insert(copies.end(), replicas_[id].begin(), replicas_[id].end());
+
+      // loads of the copies without this domain
+      double share = costs[id] / (double)copies.size();
+      copy_loads.resize(copies.size());
+      for (std::size_t c = 0; c < copies.size(); ++c) {
+        copy_loads[c] = loads[copies[c]] - share;
+      }
+
+      double sender_share = costs[id] / (double)num_ranks;
+      for (int sender = 0; sender < num_ranks; ++sender) {
+        std::size_t c = std::find(copies.begin(), copies.end(), sender) -
+                        copies.begin();
+        if (c == copies.size()) {
+          c = std::min_element(copy_loads.begin(), copy_loads.end()) -
+              copy_loads.begin();
+        }
+        copy_loads[c] += sender_share;
+        if (sender == local_rank) route_[id] = copies[c];
+      }
+    }
+    mapRoutes();
+  }
+
+  //! Number of ranks holding the given domain, including its owner.
+  std::size_t getNumCopies(int id) const {
+    return replicas_.empty() ? 1 : 1 + replicas_[id].size();
+  }
+
+ public:
+  //! Domains held by the given rank, owned or replicated.
   const std::list<int>& getDomains(int rank) const {
     return rank_to_domains_[rank];
   }
+  //! Domains whose rays this process sends to the given rank.
+  const std::list<int>& getRoutedDomains(int rank) const {
+    return rank_to_routed_domains_[rank];
+  }
   std::size_t getNumDomains(int rank) const {
     return rank_to_domains_[rank].size();
   }
@@ -235,16 +443,42 @@ class InsituPartition {
     }
 #endif
     rank_to_domains_.resize(num_ranks);
+    for (auto& domains : rank_to_domains_) domains.clear();
+    rank_to_routed_domains_.resize(num_ranks);
+
     for (std::size_t id = 0; id < domain_to_rank_.size(); ++id) {
       int rank = domain_to_rank_[id];
       rank_to_domains_[rank].push_back(id);
+      if (!replicas_.empty()) {
+        for (int r : replicas_[id]) rank_to_domains_[r].push_back(id);
+      }
     }
+
+    // rays go to the owners until replicate() picks copies
+    route_ = domain_to_rank_;
+    mapRoutes();
+  }
+
+  void mapRoutes() {
+    for (auto& domains : rank_to_routed_domains_) domains.clear();
+    for (std::size_t id = 0; id < route_.size(); ++id) {
+      rank_to_routed_domains_[route_[id]].push_back(id);
+    }
+  }
+
+  bool holds(int rank, int id) const {
+    if (domain_to_rank_[id] == rank) return true;
+    const auto& r = replicas_[id];
+    return std::find(r.begin(), r.end(), rank) != r.end();
   }
 
  private:
   std::vector<MortonCode> codes_;
-  std::vector<int> domain_to_rank_;
-  std::vector<std::list<int>> rank_to_domains_;
+  std::vector<int> domain_to_rank_;              // owners
+  std::vector<std::vector<int>> replicas_;       // [domain] extra holders
+  std::vector<int> route_;                       // [domain] rays sent to
+  std::vector<std::list<int>> rank_to_domains_;  // held domains
+  std::vector<std::list<int>> rank_to_routed_domains_;
   int ndomains_;
 };
 
@@ -30,9 +30,39 @@
 namespace spray {
 
 struct Domain {
-  Domain() : num_vertices(0), num_faces(0), bsdf(nullptr) {}
+  Domain()
+      : num_vertices(0),
+        num_faces(0),
+        mesh_id(-1),
+        instanced(false),
+        bsdf(nullptr) {}
   ~Domain() { delete bsdf; }
 
+  /**
+   * Transforms a world-space ray into the object space of an instanced
+   * domain. The direction is not normalized so that hit distances stay the
+   * same in both spaces.
+   */
+  void toObjectSpace(const float org[3], const float dir[3], float org_out[3],
+                     float dir_out[3]) const {
+    glm::vec4 o = world_to_object * glm::vec4(org[0], org[1], org[2], 1.0f);
+    glm::vec4 d = world_to_object * glm::vec4(dir[0], dir[1], dir[2], 0.0f);
+    org_out[0] = o.x;
+    org_out[1] = o.y;
+    org_out[2] = o.z;
+    dir_out[0] = d.x;
+    dir_out[1] = d.y;
+    dir_out[2] = d.z;
+  }
+
+  //! Transforms an unnormalized object-space normal of an instanced domain.
+  void normalToWorld(float n[3]) const {
+    glm::vec3 w = normal_to_world * glm::vec3(n[0], n[1], n[2]);
+    n[0] = w.x;
+    n[1] = w.y;
+    n[2] = w.z;
+  }
+
   unsigned id;  // single domain id
   std::size_t num_vertices;
   std::size_t num_faces;
@@ -40,6 +70,12 @@ struct Domain {
   Aabb object_aabb;
   Aabb world_aabb;
   glm::mat4 transform;
+
+  int mesh_id;     // cache entry of the (possibly shared) mesh
+  bool instanced;  // mesh kept in object space and shared with other domains
+  glm::mat4 world_to_object;  // inverse of transform, if instanced
+  glm::mat3 normal_to_world;  // cofactor matrix of transform, if instanced
+
   Bsdf* bsdf;
 };
 
@@ -40,6 +40,11 @@ class InfiniteCache {
   int getCacheSize() const { return capacity_; }
   int getSize() const { return capacity_; }
 
+  bool isLoaded(int domid) const { return status_[domid] == HIT; }
+
+  // nothing is ever evicted
+  void pin(int domid) {}
+
  private:
   enum Status { HIT = -1, MISS = 0 };
 
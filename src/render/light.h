@@ -28,63 +28,61 @@
 
 namespace spray {
 
+/**
+ * Light sources.
+ *
+ * Like Bsdf, a light is a tagged value over the closed set of lights the
+ * scene loader creates. Use the make*() functions to create one.
+ */
 class Light {
  public:
-  virtual glm::vec3 sample(const glm::vec3& p, glm::vec3* wi,
-                           float* pdf) const = 0;
-  virtual ~Light() {}
-  virtual bool isAreaLight() const = 0;
-  virtual glm::vec3 sampleArea(RandomSampler& sampler, const glm::vec3& normal,
-                               glm::vec3* wi, float* pdf) const = 0;
-};
-
-class PointLight : public Light {
- public:
-  PointLight(const glm::vec3& position, const glm::vec3& radiance)
-      : position_(position), radiance_(radiance) {}
-  virtual ~PointLight() {}
+  enum Type { POINT = 0, DIFFUSE_HEMISPHERE };
 
-  glm::vec3 sample(const glm::vec3& p, glm::vec3* wi,
-                   float* pdf) const override {
-    glm::vec3 dir2light = position_ - p;
-    *wi = glm::normalize(dir2light);
-    *pdf = 1.0;
-    return radiance_;
+  static Light makePoint(const glm::vec3& position,
+                         const glm::vec3& radiance) {
+    Light l(POINT, radiance);
+    l.position_ = position;
+    return l;
   }
-  bool isAreaLight() const override { return false; }
 
-  glm::vec3 sampleArea(RandomSampler& sampler, const glm::vec3& normal,
-                       glm::vec3* wi, float* pdf) const override {
-    LOG(FATAL) << "forbidden";
-    return radiance_;
+  static Light makeDiffuseHemisphere(const glm::vec3& radiance) {
+    return Light(DIFFUSE_HEMISPHERE, radiance);
   }
 
- private:
-  glm::vec3 position_;
-  glm::vec3 radiance_;
-};
-
-class DiffuseHemisphereLight : public Light {
- public:
-  DiffuseHemisphereLight(const glm::vec3& radiance) : radiance_(radiance) {}
+  Type getType() const { return type_; }
 
-  virtual ~DiffuseHemisphereLight() {}
+  bool isAreaLight() const { return type_ == DIFFUSE_HEMISPHERE; }
 
-  bool isAreaLight() const override { return true; }
+  const glm::vec3& getRadiance() const { return radiance_; }
 
-  glm::vec3 sample(const glm::vec3& p, glm::vec3* wi,
-                   float* pdf) const override {
-    LOG(FATAL) << "forbidden";
+  //! Samples a point light.
+  glm::vec3 sample(const glm::vec3& p, glm::vec3* wi, float* pdf) const {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_EQ(type_, POINT);
+#endif
+    glm::vec3 dir2light = position_ - p;
+    *wi = glm::normalize(dir2light);
+    *pdf = 1.0;
     return radiance_;
   }
-  glm::vec3 sampleArea(RandomSampler& sampler, const glm::vec3& normal,
-                       glm::vec3* wi, float* pdf) const override {
-    glm::vec2 u = RandomSampler_get2D(sampler);
+
+  //! Samples an area light with a uniform 2D sample.
+  glm::vec3 sampleArea(const glm::vec2& u, const glm::vec3& normal,
+                       glm::vec3* wi, float* pdf) const {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_EQ(type_, DIFFUSE_HEMISPHERE);
+#endif
     getCosineHemisphereSample(u.x, u.y, normal, wi, pdf);
     return radiance_;
   }
 
  private:
+  Light(Type type, const glm::vec3& radiance)
+      : type_(type), position_(0.0f), radiance_(radiance) {}
+
+ private:
+  Type type_;
+  glm::vec3 position_;  // point light
   glm::vec3 radiance_;
 };
 
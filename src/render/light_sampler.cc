@@ -0,0 +1,94 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#include "render/light_sampler.h"
+
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "utils/math.h"
+
+namespace spray {
+
+void LightSampler::init(const std::vector<Light*>& lights) {
+  const int n = lights.size();
+  CHECK_GT(n, 0);
+
+  std::vector<double> power(n);
+  double total = 0.0;
+  for (int i = 0; i < n; ++i) {
+    power[i] = luminance(lights[i]->getRadiance());
+    total += power[i];
+  }
+
+  // all dark: fall back to uniform selection
+  if (total <= 0.0) {
+    for (auto& p : power) p = 1.0;
+    total = (double)n;
+  }
+
+  pmf_.resize(n);
+  prob_.resize(n);
+  alias_.resize(n);
+
+  // scaled probabilities average to one. bins below one are topped up by a
+  // bin above one.
+  std::vector<double> scaled(n);
+  std::vector<int> small, large;
+  for (int i = 0; i < n; ++i) {
+    pmf_[i] = (float)(power[i] / total);
+    scaled[i] = power[i] / total * n;
+    if (scaled[i] < 1.0) {
+      small.push_back(i);
+    } else {
+      large.push_back(i);
+    }
+  }
+
+  while (!small.empty() && !large.empty()) {
+    int s = small.back();
+    small.pop_back();
+    int g = large.back();
+    large.pop_back();
+
+    prob_[s] = (float)scaled[s];
+    alias_[s] = g;
+
+    scaled[g] = (scaled[g] + scaled[s]) - 1.0;
+    if (scaled[g] < 1.0) {
+      small.push_back(g);
+    } else {
+      large.push_back(g);
+    }
+  }
+
+  // leftovers are one up to rounding
+  for (int i : large) {
+    prob_[i] = 1.0f;
+    alias_[i] = i;
+  }
+  for (int i : small) {
+    prob_[i] = 1.0f;
+    alias_[i] = i;
+  }
+}
+
+}  // namespace spray
@@ -0,0 +1,99 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#pragma once
+
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "render/light.h"
+#include "render/reflection.h"
+#include "utils/math.h"
+
+namespace spray {
+
+/**
+ * Picks lights in proportion to their power with Walker's alias method.
+ *
+ * Used instead of looping over every light at every hit, so that a hit
+ * spawns a fixed number of shadow rays no matter how many lights there are.
+ * The radiance luminance of a light is used as its power.
+ */
+class LightSampler {
+ public:
+  void init(const std::vector<Light*>& lights);
+
+  /**
+   * Picks a light in O(1).
+   *
+   * \param u A uniform random number in [0, 1).
+   * \param pmf Probability of picking the returned light.
+   * \return Index of the picked light.
+   */
+  int sample(float u, float* pmf) const {
+    const int n = pmf_.size();
+    float x = u * n;
+    int i = (int)x;
+    if (i > n - 1) i = n - 1;
+    int l = ((x - i) < prob_[i]) ? i : alias_[i];
+    *pmf = pmf_[l];
+    return l;
+  }
+
+ private:
+  std::vector<float> pmf_;   // per-light selection probability
+  std::vector<float> prob_;  // per-bin probability of keeping the bin
+  std::vector<int> alias_;   // per-bin alias
+};
+
+/**
+ * Draws one direct lighting sample of a light at a hit point.
+ *
+ * \param u Uniform 2D sample for area lights. Unused by point lights.
+ * \param scale Weight applied on top of 1/pdf, e.g. 1/(pmf * picks).
+ * \param wi Direction to the light.
+ * \param Lr Weight of the shadow ray along wi.
+ * \return True if the sample contributes and a shadow ray has to be traced.
+ */
+inline bool sampleDirect(const Light& light, const glm::vec2& u,
+                         const glm::vec3& pos, const glm::vec3& normal_ff,
+                         const glm::vec3& wo, const glm::vec3& kd,
+                         const glm::vec3& ks, float shininess,
+                         const glm::vec3& Lin, float scale, glm::vec3* wi,
+                         glm::vec3* Lr) {
+  float pdf;
+  glm::vec3 light_radiance;
+  if (light.isAreaLight()) {
+    light_radiance = light.sampleArea(u, normal_ff, wi, &pdf);
+  } else {
+    light_radiance = light.sample(pos, wi, &pdf);
+  }
+  if (pdf <= 0.0f) return false;
+
+  float costheta = glm::clamp(glm::dot(normal_ff, *wi), 0.0f, 1.0f);
+  *Lr = Lin *
+        blinnPhong(costheta, kd, ks, shininess, light_radiance, *wi, normal_ff,
+                   wo) *
+        (scale / pdf);
+  return hasPositive(*Lr);
+}
+
+}  // namespace spray
@@ -60,6 +60,7 @@ void LruCache::init(int num_domains, int cache_size, bool insitu_mode) {
   for (std::size_t i = 0; i < status_.size(); ++i) {
     status_[i] = MISS;
   }
+  pinned_.assign(ndomains_, false);
 }
 
 bool LruCache::load(int domid, int* cache_block_id) {
@@ -128,10 +129,14 @@ bool LruCache::load(int domid, int* cache_block_id) {
       CHECK_EQ(id_to_block_.size(), capacity_);
       CHECK_EQ(size_, capacity_);
 #endif
-      // evict lru block
-      CacheBlock old_blk = blocks_.front();
+      // evict lru block that is not pinned
+      BlockIter lru_it = blocks_.begin();
+      while (lru_it != blocks_.end() && pinned_[lru_it->domain]) ++lru_it;
+      CHECK(lru_it != blocks_.end()) << "all cache blocks pinned";
 
-      blocks_.pop_front();
+      CacheBlock old_blk = *lru_it;
+
+      blocks_.erase(lru_it);
       id_to_block_.erase(old_blk.domain);
 
       status_[old_blk.domain] = MISS;
@@ -51,6 +51,11 @@ class LruCache {
   int getCacheSize() const { return capacity_; }
   int getSize() const { return size_; }
 
+  bool isLoaded(int domid) const { return status_[domid] == HIT; }
+
+  //! Keeps the domain in the cache once loaded. Used for resident domains.
+  void pin(int domid) { pinned_[domid] = true; }
+
   std::size_t getListSize() const { return blocks_.size(); }
   std::size_t getMapSize() const { return id_to_block_.size(); }
 
@@ -78,6 +83,7 @@ class LruCache {
   std::list<CacheBlock> blocks_;
   std::map<int, BlockIter> id_to_block_;  ///< domain ID-to-LRU_iterator map
   std::vector<int> status_;  ///< per-domain loaded status (-1 or 0)
+  std::vector<bool> pinned_;  ///< per-domain flag excluding it from eviction
 };
 
 }  // namespace spray
@@ -0,0 +1,143 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#pragma once
+
+#include <cstdint>
+
+#include "embree/random_sampler.h"
+#include "glm/glm.hpp"
+
+namespace spray {
+
+//! Sample streams of a path. Each vertex draws from its own streams.
+enum PathSamplerStream {
+  SAMPLER_STREAM_PIXEL,     // pixel jitter of eye rays
+  SAMPLER_STREAM_LIGHT,     // light selection and area light samples
+  SAMPLER_STREAM_BSDF,      // bsdf samples
+  SAMPLER_STREAM_ROULETTE,  // russian roulette of path extensions
+  SAMPLER_STREAM_COUNT
+};
+
+//! Stream ID of a path vertex at the given depth.
+inline int pathSamplerStream(int depth, int stream) {
+  return depth * SAMPLER_STREAM_COUNT + stream;
+}
+
+/**
+ * Uniform sample generator indexed by (pixel, sample, stream).
+ *
+ * RANDOM hashes the index into embree's LCG. SOBOL draws the first two
+ * dimensions of the Sobol sequence, shuffled and Owen-scrambled per pixel and
+ * draw with hashing (Burley, Practical Hash-based Owen Scrambling, JCGT 2020).
+ * Every draw is its own padded dimension. The samples of a pixel therefore
+ * stay stratified in each 1D and 2D draw, however many draws a path makes.
+ *
+ * Successive samples of a pixel are successive points of its sequence. A
+ * progressive pass continues the sequence by offsetting the sample index.
+ */
+class PathSampler {
+ public:
+  enum Type { RANDOM, SOBOL };
+
+  /**
+   * \param pixel Pixel ID. Decorrelates pixels.
+   * \param sample Sample index within the pixel.
+   * \param stream Stream ID of the draws (see pathSamplerStream).
+   */
+  void init(int type, int pixel, int sample, int stream) {
+    type_ = type;
+    sample_ = (uint32_t)sample;
+    dim_ = 0;
+    seed_ = MurmurHash3_mix(MurmurHash3_mix(0, pixel), stream);
+    if (type_ == RANDOM) {
+      random_.s = MurmurHash3_finalize(MurmurHash3_mix(seed_, sample));
+    }
+  }
+
+  float get1D() {
+    if (type_ == RANDOM) return RandomSampler_get1D(random_);
+
+    uint32_t seed = nextSeed();
+    uint32_t i = nestedUniformScramble(sample_, seed);
+    return toFloat(nestedUniformScramble(reverseBits(i), hash(seed, 1)));
+  }
+
+  glm::vec2 get2D() {
+    if (type_ == RANDOM) return RandomSampler_get2D(random_);
+
+    uint32_t seed = nextSeed();
+    uint32_t i = nestedUniformScramble(sample_, seed);
+    uint32_t x = nestedUniformScramble(reverseBits(i), hash(seed, 1));
+    uint32_t y = nestedUniformScramble(sobol1(i), hash(seed, 2));
+    return glm::vec2(toFloat(x), toFloat(y));
+  }
+
+ private:
+  static uint32_t hash(uint32_t seed, uint32_t k) {
+    return MurmurHash3_finalize(MurmurHash3_mix(seed, k));
+  }
+
+  uint32_t nextSeed() { return hash(seed_, dim_++); }
+
+  static uint32_t reverseBits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+  }
+
+  //! Second Sobol dimension. The first one is reverseBits.
+  static uint32_t sobol1(uint32_t i) {
+    uint32_t r = 0;
+    for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1) {
+      if (i & 1) r ^= v;
+    }
+    return r;
+  }
+
+  //! Permutes the higher bits by the lower ones, i.e. an Owen scramble of
+  //! the bit-reversed value.
+  static uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return x;
+  }
+
+  static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+    return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+  }
+
+  //! Keeps 24 bits so that the result is below one.
+  static float toFloat(uint32_t x) { return (x >> 8) * (1.0f / 16777216.0f); }
+
+ private:
+  int type_;
+  uint32_t sample_;
+  uint32_t seed_;
+  uint32_t dim_;  // draws so far
+  RandomSampler random_;
+};
+
+}  // namespace spray
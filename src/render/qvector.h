@@ -26,26 +26,35 @@
 
 #include "glog/logging.h"
 
+#include "utils/bitset.h"
+
 namespace spray {
 
+/**
+ * Per-domain queues with an occupancy bitset.
+ *
+ * A set bit means the queue may be non-empty. Bits are set on push() and
+ * cleared lazily by the queries once the queue is found empty, since callers
+ * may drain a queue directly through getQ(). Not thread-safe; each thread
+ * owns its own QVector.
+ */
 template <typename T>
 class QVector {
  public:
   void resize(std::size_t size) {
     CHECK(empty());
     qs_.resize(size);
+    occupied_.resize(size);
+  }
+  void push(int i, T& data) {
+    qs_[i].push(data);
+    occupied_.set(i);
   }
-  void push(int i, T& data) { qs_[i].push(data); }
 
   std::queue<T>* getQ(int i) { return &qs_[i]; }
   std::size_t size(int i) const { return qs_[i].size(); }
 
-  bool empty() const {
-    for (const auto& q : qs_) {
-      if (!q.empty()) return false;
-    }
-    return true;
-  }
+  bool empty() const { return nextNonEmpty(0) == (int)qs_.size(); }
 
   std::size_t size() const { return qs_.size(); }
 
@@ -53,16 +62,37 @@ class QVector {
   void pop(int i) { return qs_[i].pop(); }
   T& front(int i) { return qs_[i].front(); }
 
+  /**
+   * Finds the first non-empty queue at or after the given position.
+   *
+   * \param i A starting queue index.
+   * \return The queue index. size() if all remaining queues are empty.
+   */
+  int nextNonEmpty(int i) const {
+    int n = occupied_.findNext(i);
+    while (n < occupied_.size()) {
+      if (!qs_[n].empty()) return n;
+      occupied_.reset(n);
+      n = occupied_.findNext(n + 1);
+    }
+    return (int)qs_.size();
+  }
+
+  int firstNonEmpty() const { return nextNonEmpty(0); }
+
   void flush() {
-    for (auto& q : qs_) {
+    for (int i = firstNonEmpty(); i < (int)qs_.size(); i = nextNonEmpty(i)) {
+      auto& q = qs_[i];
       while (!q.empty()) {
         q.pop();
       }
     }
+    occupied_.clear();
   }
 
  private:
   std::vector<std::queue<T>> qs_;
+  mutable OccupancyBitset occupied_;
 };
 
 }  // namespace spray
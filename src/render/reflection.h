@@ -214,92 +214,91 @@ inline glm::vec3 blinnPhong(const float costheta, const glm::vec3 kd,
 }
 
 /**
- * Interface for BSDFs.
+ * BSDFs.
+ *
+ * The scene loader only creates a closed set of materials, so a BSDF is a
+ * tagged value dispatched with a switch instead of a class hierarchy with
+ * virtual calls. Use the make*() functions to create one.
  */
 class Bsdf {
  public:
-  virtual ~Bsdf() {}
-  virtual void sampleDelta(bool entering, float cos_theta_i,
-                           const glm::vec3& wo, const glm::vec3& normal_ff,
-                           uint32_t* sample_type, float* fr,
-                           glm::vec3* wt) const = 0;
-
-  virtual void sampleRandom(const glm::vec3& normal, RandomSampler* sampler,
-                            glm::vec3* wi, float* pdf) const = 0;
-  /**
-   * Get the emission value of the surface material. For non-emitting surfaces
-   * this would be a zero energy spectrum.
-   * \return emission spectrum of the surface material
-   */
-  virtual glm::vec3 getEmission() const = 0;
-
-  // virtual glm::vec3 getCoefficient() const = 0;
+  enum Type { DIFFUSE = 0, MIRROR, GLASS, TRANSMISSION };
 
-  virtual bool isDelta() const = 0;
-};
+  static Bsdf makeDiffuse(const glm::vec3& albedo) {
+    Bsdf b(DIFFUSE);
+    b.color_ = albedo;
+    return b;
+  }
 
-class DiffuseBsdf : public Bsdf {
- public:
-  DiffuseBsdf(const glm::vec3& albedo) : albedo_(albedo) {}
+  static Bsdf makeMirror(const glm::vec3& reflectance) {
+    Bsdf b(MIRROR);
+    b.color_ = reflectance;
+    return b;
+  }
 
-  void sampleRandom(const glm::vec3& normal, RandomSampler* sampler,
-                    glm::vec3* wi, float* pdf) const override {
-    glm::vec2 u = RandomSampler_get2D(*sampler);
-    getCosineHemisphereSample(u.x, u.y, normal, wi, pdf);
+  static Bsdf makeGlass(float eta_exterior, float eta_interior) {
+    Bsdf b(GLASS);
+    b.etaI_ = eta_exterior;
+    b.etaT_ = eta_interior;
+    return b;
   }
 
-  void sampleDelta(bool entering, float cos_theta_i, const glm::vec3& wo,
-                   const glm::vec3& normal_ff, uint32_t* sample_type, float* fr,
-                   glm::vec3* wt) const override {
-    LOG(FATAL) << "forbidden";
+  static Bsdf makeTransmission(float eta_exterior, float eta_interior) {
+    Bsdf b(TRANSMISSION);
+    b.etaI_ = eta_exterior;
+    b.etaT_ = eta_interior;
+    return b;
   }
 
-  glm::vec3 getEmission() const override { return glm::vec3(0.0f); }
-  bool isDelta() const override { return false; }
+  Type getType() const { return type_; }
 
- private:
-  glm::vec3 albedo_;
-};
+  bool isDelta() const { return type_ != DIFFUSE; }
 
-class MirrorBsdf : public Bsdf {
- public:
-  MirrorBsdf(const glm::vec3& reflectance) : reflectance_(reflectance) {}
+  /**
+   * Get the emission value of the surface material. For non-emitting surfaces
+   * this would be a zero energy spectrum.
+   * \return emission spectrum of the surface material
+   */
+  glm::vec3 getEmission() const { return glm::vec3(0.0f); }
 
-  glm::vec3 getEmission() const override { return glm::vec3(0.0f); }
-  bool isDelta() const override { return true; }
-  void sampleRandom(const glm::vec3& normal, RandomSampler* sampler,
-                    glm::vec3* wi, float* pdf) const override {
-    LOG(FATAL) << "forbidden";
+  //! Samples a non-delta BSDF with a uniform 2D sample.
+  void sampleRandom(const glm::vec3& normal, const glm::vec2& u, glm::vec3* wi,
+                    float* pdf) const {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_EQ(type_, DIFFUSE);
+#endif
+    getCosineHemisphereSample(u.x, u.y, normal, wi, pdf);
   }
+
+  //! Samples a delta BSDF.
   void sampleDelta(bool entering, float cos_theta_i, const glm::vec3& wo,
                    const glm::vec3& normal_ff, uint32_t* sample_type, float* fr,
-                   glm::vec3* wt) const override {
-    *fr = 1.0f;
-    *sample_type = BSDF_REFLECTION;
+                   glm::vec3* wt) const {
+    switch (type_) {
+      case MIRROR:
+        *fr = 1.0f;
+        *sample_type = BSDF_REFLECTION;
+        break;
+      case GLASS:
+        sampleGlass(entering, cos_theta_i, wo, normal_ff, sample_type, fr, wt);
+        break;
+      case TRANSMISSION:
+        sampleTransmission(entering, cos_theta_i, wo, normal_ff, sample_type,
+                           fr, wt);
+        break;
+      default:
+        LOG(FATAL) << "forbidden";
+        break;
+    }
   }
 
  private:
-  glm::vec3 reflectance_;
-};
+  explicit Bsdf(Type type)
+      : type_(type), color_(0.0f), etaI_(1.0f), etaT_(1.0f) {}
 
-/**
- * Glass BSDF.
- */
-class GlassBsdf : public Bsdf {
- public:
-  GlassBsdf(float eta_exterior, float eta_interior)
-      : etaI_(eta_exterior), etaT_(eta_interior) {}
-  glm::vec3 getEmission() const override { return glm::vec3(0.0f); }
-  bool isDelta() const override { return true; }
-
-  void sampleRandom(const glm::vec3& normal, RandomSampler* sampler,
-                    glm::vec3* wi, float* pdf) const override {
-    LOG(FATAL) << "forbidden";
-  }
-
-  void sampleDelta(bool entering, float cos_theta_i, const glm::vec3& wo,
+  void sampleGlass(bool entering, float cos_theta_i, const glm::vec3& wo,
                    const glm::vec3& normal_ff, uint32_t* sample_type, float* fr,
-                   glm::vec3* wt) const override {
+                   glm::vec3* wt) const {
     float etaI = entering ? etaI_ : etaT_;
     float etaT = entering ? etaT_ : etaI_;
 
@@ -321,31 +320,12 @@ class GlassBsdf : public Bsdf {
     }
   }
 
- private:
-  float etaI_, etaT_;
-};
-
-/**
- * Refraction BSDF.
- */
-class TransmissionBsdf : public Bsdf {
- public:
-  TransmissionBsdf(float eta_exterior, float eta_interior)
-      : etaI_(eta_exterior), etaT_(eta_interior) {}
-  glm::vec3 getEmission() const override { return glm::vec3(0.0f); }
-  bool isDelta() const override { return true; }
-
-  void sampleRandom(const glm::vec3& normal, RandomSampler* sampler,
-                    glm::vec3* wi, float* pdf) const override {
-    LOG(FATAL) << "forbidden";
-  }
-
-  void sampleDelta(bool entering, float cos_theta_i, const glm::vec3& wo,
-                   const glm::vec3& normal_ff, uint32_t* sample_type, float* fr,
-                   glm::vec3* wt) const override {
+  void sampleTransmission(bool entering, float cos_theta_i,
+                          const glm::vec3& wo, const glm::vec3& normal_ff,
+                          uint32_t* sample_type, float* fr,
+                          glm::vec3* wt) const {
     float etaI = entering ? etaI_ : etaT_;
     float etaT = entering ? etaT_ : etaI_;
-    // float eta = etaI / etaT;
 
     bool transmission = Refract(cos_theta_i, etaI, etaT, wo, normal_ff, wt);
 
@@ -360,7 +340,9 @@ class TransmissionBsdf : public Bsdf {
   }
 
  private:
-  float etaI_, etaT_;
+  Type type_;
+  glm::vec3 color_;    // albedo (diffuse) or reflectance (mirror)
+  float etaI_, etaT_;  // glass and transmission
 };
 
 }  // namespace spray
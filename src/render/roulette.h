@@ -0,0 +1,60 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#pragma once
+
+#include <algorithm>
+
+#include "glm/glm.hpp"
+
+#include "render/path_sampler.h"
+#include "utils/math.h"
+
+namespace spray {
+
+/**
+ * Russian roulette on the weight of a path extension.
+ *
+ * From start_depth on, a path survives with probability min(1, luminance(w))
+ * and survivors are scaled by 1/p, so the estimator stays unbiased while
+ * near-black paths stop before they cost domain traversals, queue entries or
+ * messages.
+ *
+ * \param sampler Sampler of the path vertex on SAMPLER_STREAM_ROULETTE. Only
+ * drawn from if the path is subject to roulette.
+ * \param depth Bounce of the extension.
+ * \param start_depth First bounce subject to roulette. Negative disables it.
+ * \param w Weight of the extension. Rescaled if the path survives.
+ * \return False if the path is terminated.
+ */
+inline bool russianRoulette(PathSampler* sampler, int depth, int start_depth,
+                            glm::vec3* w) {
+  if (start_depth < 0 || depth < start_depth) return true;
+
+  float p = std::min(1.0f, luminance(*w));
+  if (p >= 1.0f) return true;
+
+  if (sampler->get1D() >= p) return false;
+
+  *w /= p;
+  return true;
+}
+
+}  // namespace spray
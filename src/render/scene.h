@@ -22,6 +22,8 @@
 
 #include <glog/logging.h>
 #include <cstdlib>
+#include <list>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -57,6 +59,9 @@ struct Intersection {
 struct SceneInfo {
   RTCScene rtc_scene;
   int cache_block;
+  //! Domain whose rays are transformed into the shared mesh's object space.
+  //! nullptr if the domain's mesh is baked in world space.
+  const Domain* instance;
 };
 
 template <typename CacheT, typename SurfaceBufT = TriMeshBuffer>
@@ -72,11 +77,25 @@ class Scene {
 
   void init(const std::string& desc_filename, const std::string& ply_path,
             const std::string& storage_basepath, int cache_size, int view_mode,
-            bool insitu_mode, int num_virtual_ranks);
+            bool insitu_mode, int num_virtual_ranks, bool numa_interleave);
 
   const InsituPartition& getInsituPartition() const { return partition_; }
   bool insitu() const { return insitu_; }
 
+  /**
+   * Rebalances the insitu domains by cost and loads the domains this rank
+   * takes over. See InsituPartition::repartition().
+   *
+   * \return True if the assignment changed.
+   */
+  bool repartition(const std::vector<int64_t>& costs, float min_gain);
+
+  /**
+   * Copies the costliest insitu domains onto other ranks and loads the
+   * copies this rank takes on. See InsituPartition::replicate().
+   */
+  void replicate(const std::vector<int64_t>& costs, int max_replicas);
+
   void buildWbvh();
 
   Aabb getBound() const {
@@ -154,45 +173,48 @@ class Scene {
   void load(int id);
   void load(int id, SceneInfo* sinfo);
 
-  bool intersect(RTCScene rtc_scene, int cache_block, const float org[3],
-                 const float dir[3], RTCRayIntersection* isect) const {
-    RTCRayUtil::makeRadianceRay(org, dir, isect);
-    return intersect(rtc_scene, cache_block, isect);
-  }
+  //! True if the domain's mesh is in the cache, so load() costs nothing.
+  bool isLoaded(int id) const { return cache_.isLoaded(domains_[id].mesh_id); }
 
-  bool intersect(RTCScene rtc_scene, int cache_block, const glm::vec3& org,
+  //! Finds the closest hit and interpolates its attributes.
+  bool intersect(const SceneInfo& sinfo, const float org[3],
                  const float dir[3], RTCRayIntersection* isect) const {
-    RTCRayUtil::makeRadianceRay(org, dir, isect);
-    return intersect(rtc_scene, cache_block, isect);
+    if (intersectGeometry(sinfo, org, dir, isect)) {
+      updateIntersection(sinfo, isect);
+      return true;
+    }
+    return false;
   }
 
   bool intersect(const float org[3], const float dir[3],
                  RTCRayIntersection* isect) const {
-    RTCRayUtil::makeRadianceRay(org, dir, isect);
-    return intersect(scene_, cache_block_, isect);
+    return intersect(sinfo_, org, dir, isect);
   }
 
+  /**
+   * Finds the closest hit without interpolating the hit attributes. Only
+   * tfar, Ng, u, v, geomID and primID are valid on return. Call
+   * updateIntersection() on the hits that survive the visibility test before
+   * shading them.
+   */
+  bool intersectGeometry(const SceneInfo& sinfo, const float org[3],
+                         const float dir[3], RTCRayIntersection* isect) const;
+
   bool occluded(const glm::vec3& org, const glm::vec3& dir, RTCRay* ray) const {
-    RTCRayUtil::makeShadowRay(org, dir, ray);
-    return occluded(scene_, ray);
+    return occluded(sinfo_, &org[0], &dir[0], ray);
   }
 
-  bool occluded(RTCScene rtc_scene, const glm::vec3& org, const glm::vec3& dir,
-                RTCRay* ray) const {
-    RTCRayUtil::makeShadowRay(org, dir, ray);
-    return occluded(rtc_scene, ray);
+  bool occluded(const SceneInfo& sinfo, const glm::vec3& org,
+                const glm::vec3& dir, RTCRay* ray) const {
+    return occluded(sinfo, &org[0], &dir[0], ray);
   }
 
   bool occluded(const float org[3], const float dir[3], RTCRay* ray) const {
-    RTCRayUtil::makeShadowRay(org, dir, ray);
-    return occluded(scene_, ray);
+    return occluded(sinfo_, org, dir, ray);
   }
 
-  bool occluded(RTCScene rtc_scene, const float org[3], const float dir[3],
-                RTCRay* ray) const {
-    RTCRayUtil::makeShadowRay(org, dir, ray);
-    return occluded(rtc_scene, ray);
-  }
+  bool occluded(const SceneInfo& sinfo, const float org[3], const float dir[3],
+                RTCRay* ray) const;
 
   void intersectDomains(RTCRayExt& ray) const { wbvh_.intersect(ray); }
 
@@ -201,19 +223,25 @@ class Scene {
   }
 
   void updateIntersection(RTCRayIntersection* isect) const {
-    surface_buf_.updateIntersection(cache_block_, isect);
+    updateIntersection(sinfo_, isect);
   }
 
- private:
-  bool intersect(RTCScene rtc_scene, int cache_block,
-                 RTCRayIntersection* isect) const;
-  bool occluded(RTCScene rtc_scene, RTCRay* ray) const;
+  //! Interpolates the color and shading normal of a geometric hit.
+  void updateIntersection(const SceneInfo& sinfo,
+                          RTCRayIntersection* isect) const {
+    surface_buf_.updateIntersection(sinfo.cache_block, isect);
+    if (sinfo.instance) sinfo.instance->normalToWorld(isect->Ns);
+  }
 
  public:
   const Bsdf* getBsdf(int id) const { return domains_[id].bsdf; }
 
  public:
   std::size_t getNumDomains() const { return domains_.size(); }
+  //! Number of distinct meshes. Instanced domains share a mesh.
+  int getNumMeshes() const { return num_meshes_; }
+  //! Maximum number of meshes resident in the surface buffer at once.
+  int getCacheCapacity() const { return cache_.getCacheSize(); }
   const std::vector<Domain>& getDomains() const { return domains_; }
 
   const std::vector<Light*>& getLights() const { return lights_; }
@@ -223,6 +251,9 @@ class Scene {
   void mergeDomainBounds(std::size_t* max_num_vertices,
                          std::size_t* max_num_faces);
 
+  void assignMeshes();
+  int countMeshes(const std::list<int>& domains) const;
+
   void copyAllDomainsToLocalDisk(const std::string& dest_path,
                                  bool insitu_mode);
   void deleteAllDomainsFromLocalDisk();
@@ -237,8 +268,9 @@ class Scene {
   CacheT cache_;
   SurfaceBufT surface_buf_;
 
-  RTCScene scene_;   // current domain's scene
-  int cache_block_;  // current cache block
+  int num_meshes_;
+
+  SceneInfo sinfo_;  // current domain
 
   WbvhEmbree wbvh_;
 
@@ -32,11 +32,15 @@ void Scene<CacheT, SurfaceBufT>::init(const std::string& desc_filename,
                                       const std::string& ply_path,
                                       const std::string& storage_basepath,
                                       int cache_size, int view_mode,
-                                      bool insitu_mode, int num_partitions) {
+                                      bool insitu_mode, int num_partitions,
+                                      bool numa_interleave) {
   // load .domain file
   SceneLoader loader;
   loader.load(desc_filename, ply_path, &domains_, &lights_);
 
+  // share a single mesh among domains referencing the same file
+  assignMeshes();
+
   // merge domain bounds and find the scene bounds
   std::size_t max_num_vertices, max_num_faces;
   mergeDomainBounds(&max_num_vertices, &max_num_faces);
@@ -63,8 +67,10 @@ void Scene<CacheT, SurfaceBufT>::init(const std::string& desc_filename,
       LOG(INFO) << "rank " << mpi::rank() << " domain " << r;
     }
 #endif
-    // NOTE: override cache size
-    cache_size = partition_.getNumDomains(mpi::rank());
+    // NOTE: override cache size. in hybrid mode, the given cache size adds
+    // room for remote domains on top of the resident ones.
+    int num_remote = (cache_size > 0 ? cache_size : 0);
+    cache_size = countMeshes(partition_.getDomains(mpi::rank())) + num_remote;
   }
 
   // copy to local disk
@@ -76,11 +82,18 @@ void Scene<CacheT, SurfaceBufT>::init(const std::string& desc_filename,
 
   // initialize cache
   if (!(view_mode == VIEW_MODE_DOMAIN || view_mode == VIEW_MODE_PARTITION)) {
-    cache_.init(domains_.size(), cache_size, insitu_mode);
+    cache_.init(num_meshes_, cache_size, insitu_mode);
+
+    // remote domains never evict the resident ones
+    if (insitu_mode) {
+      for (int id : partition_.getDomains(mpi::rank())) {
+        cache_.pin(domains_[id].mesh_id);
+      }
+    }
 
     // initialize mesh buffer
     surface_buf_.init(cache_.getCacheSize(), max_num_vertices, max_num_faces,
-                      true /* compute_normals */);
+                      true /* compute_normals */, numa_interleave);
 
     // warm up cache
     if (view_mode == VIEW_MODE_FILM || view_mode == VIEW_MODE_GLFW) {
@@ -99,6 +112,37 @@ void Scene<CacheT, SurfaceBufT>::init(const std::string& desc_filename,
   glfw_domain_idx_ = 0;
 }
 
+template <typename CacheT, typename SurfaceBufT>
+bool Scene<CacheT, SurfaceBufT>::repartition(const std::vector<int64_t>& costs,
+                                             float min_gain) {
+  CHECK(insitu_);
+  if (!partition_.repartition(costs, mpi::size(), min_gain)) return false;
+
+  // every rank reads the domains from the shared ply files, so migrating a
+  // domain only means loading it on its new owner. the insitu cache holds all
+  // meshes, so domains handed over to other ranks stay resident here.
+  const std::list<int>& domains = partition_.getDomains(mpi::rank());
+  for (int id : domains) load(id);
+
+#ifdef SPRAY_GLOG_CHECK
+  LOG(INFO) << "rank " << mpi::rank() << " repartitioned to "
+            << domains.size() << " domains";
+#endif
+  return true;
+}
+
+template <typename CacheT, typename SurfaceBufT>
+void Scene<CacheT, SurfaceBufT>::replicate(const std::vector<int64_t>& costs,
+                                           int max_replicas) {
+  CHECK(insitu_);
+  partition_.replicate(costs, mpi::rank(), max_replicas);
+
+  // copies come from the shared ply files like owned domains. loading is a
+  // no-op for domains already resident.
+  const std::list<int>& domains = partition_.getDomains(mpi::rank());
+  for (int id : domains) load(id);
+}
+
 template <typename CacheT, typename SurfaceBufT>
 void Scene<CacheT, SurfaceBufT>::buildWbvh() {
 #if defined(SPRAY_ISECT_PACKET1)
@@ -133,81 +177,139 @@ void Scene<CacheT, SurfaceBufT>::buildWbvh() {
 
 template <typename CacheT, typename SurfaceBufT>
 void Scene<CacheT, SurfaceBufT>::load(int id) {
-  int cache_block;
-  if (cache_.load(id, &cache_block)) {
-#ifdef DEBUG_SCENE
-    LOG(INFO) << "loading cached domain " << id << " cache block "
-              << cache_block << " $size " << cache_.getSize() << " $capacity "
-              << cache_.getCacheSize();
-#endif
-    scene_ = surface_buf_.get(cache_block);
-  } else {
-#ifdef DEBUG_SCENE
-    LOG(INFO) << "loading uncached domain " << id << " cache block "
-              << cache_block << " $size " << cache_.getSize() << " $capacity "
-              << cache_.getCacheSize();
-#endif
-    const glm::mat4& x = domains_[id].transform;
-    bool apply_transform = (x != glm::mat4(1.0));
-
-    scene_ = surface_buf_.load(domains_[id].filename, cache_block, x,
-                               apply_transform);
-
-    // cache_.setLoaded(cache_block);
-  }
-  cache_block_ = cache_block;
+  load(id, &sinfo_);
 }
 
 template <typename CacheT, typename SurfaceBufT>
 void Scene<CacheT, SurfaceBufT>::load(int id, SceneInfo* sinfo) {
+  const Domain& domain = domains_[id];
   int cache_block;
-  if (cache_.load(id, &cache_block)) {
+  RTCScene scene;
+  if (cache_.load(domain.mesh_id, &cache_block)) {
 #ifdef DEBUG_SCENE
-    LOG(INFO) << "loading cached domain " << id << " cache block "
-              << cache_block << " $size " << cache_.getSize() << " $capacity "
-              << cache_.getCacheSize();
+    LOG(INFO) << "loading cached domain " << id << " mesh " << domain.mesh_id
+              << " cache block " << cache_block << " $size "
+              << cache_.getSize() << " $capacity " << cache_.getCacheSize();
 #endif
-    scene_ = surface_buf_.get(cache_block);
+    scene = surface_buf_.get(cache_block);
   } else {
 #ifdef DEBUG_SCENE
-    LOG(INFO) << "loading uncached domain " << id << " cache block "
-              << cache_block << " $size " << cache_.getSize() << " $capacity "
-              << cache_.getCacheSize();
+    LOG(INFO) << "loading uncached domain " << id << " mesh " << domain.mesh_id
+              << " cache block " << cache_block << " $size "
+              << cache_.getSize() << " $capacity " << cache_.getCacheSize();
 #endif
-    const glm::mat4& x = domains_[id].transform;
-    bool apply_transform = (x != glm::mat4(1.0));
+    // shared meshes stay in object space
+    const glm::mat4& x = domain.transform;
+    bool apply_transform = (!domain.instanced && x != glm::mat4(1.0));
 
-    scene_ = surface_buf_.load(domains_[id].filename, cache_block, x,
-                               apply_transform);
+    scene = surface_buf_.load(domain.filename, cache_block, x, apply_transform);
 
     // cache_.setLoaded(cache_block);
   }
-  sinfo->rtc_scene = scene_;
+  sinfo->rtc_scene = scene;
   sinfo->cache_block = cache_block;
+  sinfo->instance = domain.instanced ? &domain : nullptr;
 }
 
 template <typename CacheT, typename SurfaceBufT>
-bool Scene<CacheT, SurfaceBufT>::intersect(RTCScene rtc_scene, int cache_block,
-                                           RTCRayIntersection* isect) const {
-  rtcIntersect(rtc_scene, (RTCRay&)(*isect));
+bool Scene<CacheT, SurfaceBufT>::intersectGeometry(
+    const SceneInfo& sinfo, const float org[3], const float dir[3],
+    RTCRayIntersection* isect) const {
+  if (sinfo.instance == nullptr) {
+    RTCRayUtil::makeRadianceRay(org, dir, isect);
+    rtcIntersect(sinfo.rtc_scene, (RTCRay&)(*isect));
+    return (isect->geomID != RTC_INVALID_GEOMETRY_ID);
+  }
+
+  float org_obj[3], dir_obj[3];
+  sinfo.instance->toObjectSpace(org, dir, org_obj, dir_obj);
+
+  RTCRayUtil::makeRadianceRay(org_obj, dir_obj, isect);
+  rtcIntersect(sinfo.rtc_scene, (RTCRay&)(*isect));
+
+  // restore the world-space ray. tfar is the same in both spaces.
+  isect->org[0] = org[0];
+  isect->org[1] = org[1];
+  isect->org[2] = org[2];
+  isect->dir[0] = dir[0];
+  isect->dir[1] = dir[1];
+  isect->dir[2] = dir[2];
 
   if (isect->geomID != RTC_INVALID_GEOMETRY_ID) {
-    surface_buf_.updateIntersection(cache_block, isect);
+    sinfo.instance->normalToWorld(isect->Ng);
     return true;
   }
   return false;
 }
 
 template <typename CacheT, typename SurfaceBufT>
-bool Scene<CacheT, SurfaceBufT>::occluded(RTCScene rtc_scene,
+bool Scene<CacheT, SurfaceBufT>::occluded(const SceneInfo& sinfo,
+                                          const float org[3],
+                                          const float dir[3],
                                           RTCRay* ray) const {
-  rtcOccluded(rtc_scene, *ray);
+  if (sinfo.instance) {
+    float org_obj[3], dir_obj[3];
+    sinfo.instance->toObjectSpace(org, dir, org_obj, dir_obj);
+    RTCRayUtil::makeShadowRay(org_obj, dir_obj, ray);
+  } else {
+    RTCRayUtil::makeShadowRay(org, dir, ray);
+  }
+  rtcOccluded(sinfo.rtc_scene, *ray);
   if (ray->geomID != RTC_INVALID_GEOMETRY_ID) {  // occluded
     return true;
   }
   return false;  // unoccluded
 }
 
+template <typename CacheT, typename SurfaceBufT>
+void Scene<CacheT, SurfaceBufT>::assignMeshes() {
+  std::map<std::string, int> file_to_mesh;
+  std::vector<int> mesh_users;
+
+  for (Domain& d : domains_) {
+    auto it = file_to_mesh.find(d.filename);
+    if (it == file_to_mesh.end()) {
+      d.mesh_id = mesh_users.size();
+      file_to_mesh[d.filename] = d.mesh_id;
+      mesh_users.push_back(1);
+    } else {
+      d.mesh_id = it->second;
+      ++mesh_users[d.mesh_id];
+    }
+  }
+  num_meshes_ = mesh_users.size();
+
+  // meshes referenced by a single domain keep the transform baked in
+  for (Domain& d : domains_) {
+    d.instanced = (mesh_users[d.mesh_id] > 1);
+    if (d.instanced) {
+      glm::mat3 x(d.transform);
+      d.world_to_object = glm::inverse(d.transform);
+      d.normal_to_world = glm::determinant(x) * glm::transpose(glm::inverse(x));
+    }
+  }
+
+#ifdef SPRAY_GLOG_CHECK
+  LOG_IF(INFO, mpi::isRootProcess())
+      << "domains " << domains_.size() << " meshes " << num_meshes_;
+#endif
+}
+
+template <typename CacheT, typename SurfaceBufT>
+int Scene<CacheT, SurfaceBufT>::countMeshes(
+    const std::list<int>& domains) const {
+  std::vector<bool> counted(num_meshes_, false);
+  int count = 0;
+  for (int id : domains) {
+    int mesh = domains_[id].mesh_id;
+    if (!counted[mesh]) {
+      counted[mesh] = true;
+      ++count;
+    }
+  }
+  return count;
+}
+
 // copy only those domains mapped to this process.
 // we don't have to copy everything in some cases.
 template <typename CacheT, typename SurfaceBufT>
@@ -236,6 +338,9 @@ void Scene<CacheT, SurfaceBufT>::copyAllDomainsToLocalDisk(
     }
   }
 
+  // instanced domains share the copy of their mesh
+  std::vector<std::string> copied(num_meshes_);
+
   int res;
   // for (std::size_t i = 0; i < domains_.size(); ++i) {
   for (std::size_t i = 0; i < ids.size(); ++i) {
@@ -243,6 +348,11 @@ void Scene<CacheT, SurfaceBufT>::copyAllDomainsToLocalDisk(
     Domain& domain = domains_[id];
     CHECK_EQ(id, domain.id);
 
+    if (!copied[domain.mesh_id].empty()) {
+      domain.filename = copied[domain.mesh_id];
+      continue;
+    }
+
     // create a new folder
     std::string new_dir = dest_path + "/proc" + std::to_string(mpi::rank()) +
                           "_domain" + std::to_string(id);
@@ -274,6 +384,7 @@ void Scene<CacheT, SurfaceBufT>::copyAllDomainsToLocalDisk(
 
     // update the descriptor so it now points to the copied model file
     domain.filename = destination_file;
+    copied[domain.mesh_id] = destination_file;
   }
 }
 
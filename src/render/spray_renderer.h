@@ -20,6 +20,9 @@
 
 #pragma once
 
+#include <cstdint>
+#include <limits>
+
 #include "GLFW/glfw3.h"
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
@@ -29,7 +32,9 @@
 #include "display/image.h"
 #include "display/spray_glfw.h"
 #include "display/vis.h"
+#include "pbrt/memory.h"
 #include "render/aabb.h"
+#include "render/adaptive_sampler.h"
 #include "render/camera.h"
 #include "render/config.h"
 #include "render/domain.h"
@@ -66,6 +71,9 @@ class SprayRenderer {
   void renderFilmInOmp();
   void renderGlfwInOmp();
 
+  //! Composites a pass and selects the next one. True once converged.
+  bool endAdaptivePass(bool cluster);
+
  private:
   const Config* cfg_;
 
@@ -75,6 +83,7 @@ class SprayRenderer {
   Camera camera_;
   TracerT tracer_;
   HdrImage image_;
+  AdaptiveSampler adaptive_;
 };
 
 }  // namespace spray
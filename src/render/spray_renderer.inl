@@ -29,11 +29,17 @@ void SprayRenderer<TracerT>::init(const Config &cfg) {
   // config
   cfg_ = &cfg;
 
+  // huge pages for the mesh buffers and ray arenas allocated below
+  setHugePageMode(cfg.huge_pages);
+
   // scene
-  bool insitu_mode = (cfg.partition == spray::Config::INSITU);
+  // hybrid mode keeps the insitu ownership and caches remote domains on top
+  bool insitu_mode = (cfg.partition == spray::Config::INSITU ||
+                      cfg.partition == spray::Config::HYBRID);
 
   scene_.init(cfg.model_descriptor_filename, cfg.ply_path, cfg.local_disk_path,
-              cfg.cache_size, cfg.view_mode, insitu_mode, cfg.num_partitions);
+              cfg.cache_size, cfg.view_mode, insitu_mode, cfg.num_partitions,
+              cfg.numa_interleave);
 
 #ifdef SPRAY_GLOG_CHECK
   LOG(INFO) << "scene init done";
@@ -41,6 +47,9 @@ void SprayRenderer<TracerT>::init(const Config &cfg) {
 
 #ifdef SPRAY_TIMING
   global_profiler.init();
+#ifdef SPRAY_PROFILING_COUNTERS
+  global_profiler.openHwCounters(cfg.nthreads);
+#endif
 #endif
 
   // build wbvh
@@ -58,6 +67,14 @@ void SprayRenderer<TracerT>::init(const Config &cfg) {
     tracer_.init(cfg, camera_, &scene_, &image_);
   }
 
+  // adaptive sampling renders film frames as progressive passes
+  if (cfg.adaptive_threshold > 0.f && cfg.view_mode == VIEW_MODE_FILM) {
+    adaptive_.init(cfg.image_w, cfg.image_h, cfg.pixel_samples,
+                   cfg.adaptive_threshold, cfg.adaptive_min_passes,
+                   cfg.adaptive_budget);
+    tracer_.setAdaptiveSampler(&adaptive_);
+  }
+
   // vis
   WbvhObj<WbvhEmbree> wobj;
   wobj.ptr = nullptr;
@@ -357,15 +374,30 @@ void SprayRenderer<TracerT>::renderFilm() {
 #endif
 
   bool cluster = (mpi::size() > 1);
+  bool adaptive = (cfg_->adaptive_threshold > 0.f);
   int64_t cfg_nframes = cfg_->nframes;
 
-  for (int64_t i = 0; i < cfg_nframes; ++i) {
+  // frames are passes in adaptive mode. -1 runs them until convergence.
+  if (adaptive && cfg_nframes < 0) {
+    cfg_nframes = std::numeric_limits<int64_t>::max();
+  }
+
+  int64_t nframes = 0;
+
+  while (nframes < cfg_nframes) {
     image_.clear();
     tracer_.trace();
+    ++nframes;
 
-    if (cluster) image_.composite();
+    if (adaptive) {
+      if (endAdaptivePass(cluster)) break;
+    } else if (cluster) {
+      image_.composite();
+    }
   }
 
+  if (adaptive) adaptive_.resolve(&image_);
+
 #ifdef SPRAY_TIMING
   tStop(TIMER_TOTAL);
 #endif
@@ -375,7 +407,7 @@ void SprayRenderer<TracerT>::renderFilm() {
   if (root) image_.writePpm(cfg_->output_filename.c_str());
 
 #ifdef SPRAY_TIMING
-  tPrint(cfg_nframes);
+  tPrint(nframes);
 #endif
 }
 
@@ -387,11 +419,20 @@ void SprayRenderer<TracerT>::renderFilmInOmp() {
 #endif
 
   bool cluster = (mpi::size() > 1);
+  bool adaptive = (cfg_->adaptive_threshold > 0.f);
   int64_t cfg_nframes = cfg_->nframes;
 
-#pragma omp parallel firstprivate(cluster, cfg_nframes)
+  // frames are passes in adaptive mode. -1 runs them until convergence.
+  if (adaptive && cfg_nframes < 0) {
+    cfg_nframes = std::numeric_limits<int64_t>::max();
+  }
+
+  int64_t nframes = 0;
+  bool converged = false;
+
+#pragma omp parallel firstprivate(cluster, adaptive, cfg_nframes)
   {
-    for (int64_t i = 0; i < cfg_nframes; ++i) {
+    for (int64_t i = 0; i < cfg_nframes && !converged; ++i) {
 #pragma omp master
       image_.clear();
 #pragma omp barrier
@@ -399,12 +440,19 @@ void SprayRenderer<TracerT>::renderFilmInOmp() {
 #pragma omp barrier
 #pragma omp master
       {
-        if (cluster) image_.composite();
+        nframes = i + 1;
+        if (adaptive) {
+          converged = endAdaptivePass(cluster);
+        } else if (cluster) {
+          image_.composite();
+        }
       }
 #pragma omp barrier
     }
   }  // omp parallel
 
+  if (adaptive) adaptive_.resolve(&image_);
+
 #ifdef SPRAY_TIMING
   tStop(TIMER_TOTAL);
 #endif
@@ -414,8 +462,22 @@ void SprayRenderer<TracerT>::renderFilmInOmp() {
   if (root) image_.writePpm(cfg_->output_filename.c_str());
 
 #ifdef SPRAY_TIMING
-  tPrint(cfg_nframes);
+  tPrint(nframes);
+#endif
+}
+
+template <class TracerT>
+bool SprayRenderer<TracerT>::endAdaptivePass(bool cluster) {
+  // every rank selects the pixels of the next pass from the same image
+  if (cluster) image_.compositeAll();
+  adaptive_.update(image_);
+
+#ifdef SPRAY_GLOG_CHECK
+  LOG_IF(INFO, mpi::rank() == 0) << "pass " << adaptive_.getPass() << ": "
+                                 << adaptive_.getNumActive()
+                                 << " active pixels";
 #endif
+  return adaptive_.converged();
 }
 
 template <class TracerT>
@@ -349,7 +349,6 @@ void ImageScheduleTileList::init(int64_t image_w, int64_t image_h,
     std::size_t i = 0;
 
     int max_area = -1;
-    int largest_tile_index_;
 
     for (int y = 0; y < vstripe.h; y += tile_h) {
       int h = std::min(tile_h, vstripe.h - y);
@@ -390,4 +389,106 @@ void ImageScheduleTileList::init(int64_t image_w, int64_t image_h,
   tile_index_ = 0;
 }
 
+ImageScheduleTileList::~ImageScheduleTileList() {
+  if (shared_) {
+    MPI_Win_unlock_all(counter_win_);
+    MPI_Win_free(&counter_win_);
+  }
+}
+
+void ImageScheduleTileList::initShared(int64_t image_w, int64_t image_h,
+                                       int64_t num_pixel_samples,
+                                       int64_t num_ranks,
+                                       int64_t tiles_per_rank,
+                                       int64_t maximum_num_samples_per_rank) {
+  CHECK_GT(tiles_per_rank, 0);
+  CHECK(!shared_);
+
+  // horizontal stripes over the whole image, fine enough for every rank to
+  // get tiles_per_rank of them and small enough for the sample limit
+  int64_t num_samples = image_w * image_h * num_pixel_samples;
+
+  int64_t estimated_num_tiles =
+      std::max(num_ranks * tiles_per_rank,
+               (num_samples + maximum_num_samples_per_rank - 1) /
+                   maximum_num_samples_per_rank);
+
+  CHECK_LT(estimated_num_tiles, INT_MAX);
+
+  int ntiles = std::min(static_cast<int>(estimated_num_tiles),
+                        static_cast<int>(image_h));
+  int tile_h = (image_h + ntiles - 1) / ntiles;
+
+  ntiles = (image_h + tile_h - 1) / tile_h;
+
+  tiles_.resize(ntiles);
+
+  int max_area = -1;
+
+  for (int i = 0; i < ntiles; ++i) {
+    int y = i * tile_h;
+    Tile& t = tiles_[i];
+    t.x = 0;
+    t.y = y;
+    t.w = image_w;
+    t.h = std::min(tile_h, static_cast<int>(image_h) - y);
+#ifdef DEBUG_PRINT_TILES
+    std::cout << t << "\n";
+#endif
+    int area = t.w * t.h;
+    if (area > max_area) {
+      max_area = area;
+      largest_tile_index_ = i;
+    }
+  }
+
+#ifdef SPRAY_GLOG_CHECK
+  for (auto& t : tiles_) {
+    CHECK_GT(t.w * t.h, 0);
+    CHECK_LE(t.y + t.h, image_h);
+  }
+#endif
+
+  // the counter lives on the root rank and is updated with atomic
+  // fetch-and-add in a passive-target epoch that lasts as long as the list
+  MPI_Aint counter_bytes = mpi::isRootProcess() ? sizeof(int64_t) : 0;
+  MPI_Win_allocate(counter_bytes, sizeof(int64_t), MPI_INFO_NULL, mpi::comm(),
+                   &counter_, &counter_win_);
+  MPI_Win_lock_all(0, counter_win_);
+
+  shared_ = true;
+  tile_index_ = 0;
+
+  reset();
+}
+
+void ImageScheduleTileList::reset() {
+  if (!shared_) {
+    tile_index_ = 0;
+    return;
+  }
+
+  // every rank has run out of tiles before the root rewinds the counter, and
+  // no rank claims before it is rewound
+  MPI_Barrier(mpi::comm());
+  if (mpi::isRootProcess()) {
+    *counter_ = 0;
+    MPI_Win_sync(counter_win_);
+  }
+  MPI_Barrier(mpi::comm());
+
+  tile_index_ = claim();
+}
+
+int ImageScheduleTileList::claim() {
+  const int64_t one = 1;
+  int64_t index;
+  MPI_Fetch_and_op(&one, &index, MPI_INT64_T, mpi::root(), 0, MPI_SUM,
+                   counter_win_);
+  MPI_Win_flush(mpi::root(), counter_win_);
+
+  // ranks keep claiming past the end until they see it
+  return static_cast<int>(std::min(index, static_cast<int64_t>(tiles_.size())));
+}
+
 }  // namespace spray
@@ -303,13 +303,39 @@ class RankTiler {
  * (i.e. vertical stripes) as the number of ranks, and then each rank further
  * divides assigned tiles to create blocking tiles (i.e. horizontal stripes)
  * based on the maximum number of samples allowed.
+ *
+ * With initShared(), every rank instead builds the same list of finer blocking
+ * tiles over the whole image, and ranks claim them one at a time from a counter
+ * on the root rank (MPI-3 RMA), so ranks that finish early pull the remaining
+ * tiles. Each tile is still traced by exactly one rank per frame, so the
+ * additive image composite does not change.
  */
 class ImageScheduleTileList {
  public:
+  ImageScheduleTileList()
+      : tile_index_(0),
+        largest_tile_index_(0),
+        shared_(false),
+        counter_(nullptr) {}
+  ~ImageScheduleTileList();
+
+  ImageScheduleTileList(const ImageScheduleTileList&) = delete;
+  ImageScheduleTileList& operator=(const ImageScheduleTileList&) = delete;
+
   void init(int64_t image_w, int64_t image_h, int64_t num_pixel_samples,
             int64_t num_ranks, int rank, int64_t maximum_num_samples_per_rank);
 
-  void reset() { tile_index_ = 0; }
+  /**
+   * Builds a tile list shared by all ranks. Collective over MPI_COMM_WORLD.
+   *
+   * \param tiles_per_rank Minimum number of blocking tiles per rank.
+   */
+  void initShared(int64_t image_w, int64_t image_h, int64_t num_pixel_samples,
+                  int64_t num_ranks, int64_t tiles_per_rank,
+                  int64_t maximum_num_samples_per_rank);
+
+  //! Rewinds the list for the next frame. Collective with a shared list.
+  void reset();
 
   const Tile& front() const {
 #ifdef SPRAY_GLOG_CHECK
@@ -318,25 +344,43 @@ class ImageScheduleTileList {
     return tiles_[tile_index_];
   }
 
+  //! Moves to the next tile. A shared list claims it from the root rank.
   void pop() {
 #ifdef SPRAY_GLOG_CHECK
     CHECK_LT(tile_index_, tiles_.size());
 #endif
-    ++tile_index_;
+    if (shared_) {
+      tile_index_ = claim();
+    } else {
+      ++tile_index_;
+    }
   }
 
   bool empty() const { return (tile_index_ == tiles_.size()); }
 
   std::size_t size() const { return tiles_.size(); }
 
+  //! Position of front() in the list.
+  int getIndex() const { return tile_index_; }
+
+  //! True if the tiles are claimed dynamically by all ranks.
+  bool isShared() const { return shared_; }
+
   const Tile& getLargestBlockingTile() const {
     return tiles_[largest_tile_index_];
   }
 
+ private:
+  int claim();
+
  private:
   std::vector<Tile> tiles_;
   int tile_index_;
   int largest_tile_index_;
+
+  bool shared_;
+  MPI_Win counter_win_;  // next unclaimed tile, held by the root rank
+  int64_t* counter_;
 };
 
 }  // namespace spray
@@ -25,6 +25,7 @@
 #include "glog/logging.h"
 
 #include "render/rays.h"
+#include "utils/numa.h"
 #include "utils/util.h"
 
 #define DEBUG_MESH
@@ -50,7 +51,8 @@ TriMeshBuffer::TriMeshBuffer()
 TriMeshBuffer::~TriMeshBuffer() { cleanup(); }
 
 void TriMeshBuffer::init(int max_cache_size_ndomains, std::size_t max_nvertices,
-                         std::size_t max_nfaces, bool compute_normals) {
+                         std::size_t max_nfaces, bool compute_normals,
+                         bool numa_interleave) {
   // cleanup
   cleanup();
 
@@ -92,6 +94,18 @@ void TriMeshBuffer::init(int max_cache_size_ndomains, std::size_t max_nvertices,
   colors_ = arena_.Alloc<uint32_t>(cache_size * max_nvertices, false);
   CHECK_NOTNULL(colors_);
 
+  // place geometry pages before the loader writes them from this thread
+  numa::firstTouch(vertices_, cache_size * max_nvertices * 3 * sizeof(float),
+                   numa_interleave);
+  numa::firstTouch(normals_, cache_size * max_nvertices * 3 * sizeof(float),
+                   numa_interleave);
+  numa::firstTouch(faces_,
+                   cache_size * max_nfaces * NUM_VERTICES_PER_FACE *
+                       sizeof(uint32_t),
+                   numa_interleave);
+  numa::firstTouch(colors_, cache_size * max_nvertices * sizeof(uint32_t),
+                   numa_interleave);
+
   // embree mesh created
   embree_mesh_created_ = arena_.Alloc<int>(cache_size);
   CHECK_NOTNULL(embree_mesh_created_);
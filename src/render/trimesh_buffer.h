@@ -42,8 +42,18 @@ class TriMeshBuffer {
   ~TriMeshBuffer();
 
  public:
+  /**
+   * Allocates the per-cache-block geometry arrays.
+   *
+   * The arrays are first touched by the OpenMP threads (see numa::firstTouch)
+   * so that their pages are spread over the sockets instead of all landing on
+   * the node of the main thread.
+   *
+   * \param numa_interleave Interleave pages round-robin instead of in
+   *        contiguous per-thread ranges.
+   */
   void init(int max_cache_size_ndomains, std::size_t max_nvertices,
-            std::size_t max_nfaces, bool compute_normals);
+            std::size_t max_nfaces, bool compute_normals, bool numa_interleave);
 
   RTCScene load(const std::string& filename, int cache_block,
                 const glm::mat4& transform, bool apply_transform);
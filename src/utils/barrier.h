@@ -0,0 +1,191 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "render/spray.h"
+
+namespace spray {
+
+/**
+ * A sense-reversing barrier for a fixed team of OpenMP threads.
+ *
+ * Unlike omp barrier, the last thread to arrive (or the master thread) can run
+ * serial code before the others are released, and the barrier can reduce a
+ * per-thread value on the way. This replaces the set/barrier/single-scan
+ * pattern, which costs two barriers per decision, with a single episode.
+ *
+ * Every thread of the team must call the same sequence of episodes.
+ */
+class SenseBarrier {
+ public:
+  SenseBarrier() : num_threads_(0), count_(0), sense_(0) {}
+
+  void resize(int num_threads) {
+    num_threads_ = num_threads;
+    count_ = 0;
+    sense_ = 0;
+    results_[0] = 0;
+    results_[1] = 0;
+    locals_.resize(num_threads);
+    for (auto& l : locals_) {
+      l.sense = 0;
+      l.value = 0;
+    }
+  }
+
+  void wait(int tid) {
+    wait(tid, [] {});
+  }
+
+  //! The last thread to arrive runs serial() before releasing the others.
+  template <typename F>
+  void wait(int tid, F serial) {
+    int sense = flip(tid);
+    if (arrive() == num_threads_) {
+      release(sense, serial);
+    } else {
+      spin(sense);
+    }
+  }
+
+  /**
+   * The master thread runs serial() once every thread has arrived. Use this
+   * for serial code that makes MPI calls.
+   */
+  template <typename F>
+  void waitMaster(int tid, F serial) {
+    int sense = flip(tid);
+    arrive();
+    if (tid == 0) {
+      int count;
+      for (int i = 0;; ++i) {
+#pragma omp atomic read seq_cst
+        count = count_;
+        if (count == num_threads_) break;
+        backoff(i);
+      }
+      release(sense, serial);
+    } else {
+      spin(sense);
+    }
+  }
+
+  /**
+   * Returns the maximum of the values passed in by all threads.
+   *
+   * \param serial Run by the last thread with the result before the others
+   *        are released.
+   */
+  template <typename F>
+  int reduceMax(int tid, int value, F serial) {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(tid, num_threads_);
+#endif
+    locals_[tid].value = value;
+    int parity = 1 - locals_[tid].sense;
+    wait(tid, [&] {
+      int result = locals_[0].value;
+      for (int i = 1; i < num_threads_; ++i) {
+        if (locals_[i].value > result) result = locals_[i].value;
+      }
+      // results are double buffered so that a fast thread entering the next
+      // episode can't overwrite a result that is still being read
+      results_[parity] = result;
+      serial(result);
+    });
+    return results_[parity];
+  }
+
+  int reduceMax(int tid, int value) {
+    return reduceMax(tid, value, [](int) {});
+  }
+
+ private:
+  int flip(int tid) {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(tid, num_threads_);
+#endif
+    int sense = 1 - locals_[tid].sense;
+    locals_[tid].sense = sense;
+    return sense;
+  }
+
+  int arrive() {
+    int count;
+#pragma omp flush
+#pragma omp atomic capture seq_cst
+    count = ++count_;
+    return count;
+  }
+
+  template <typename F>
+  void release(int sense, F serial) {
+#pragma omp atomic write seq_cst
+    count_ = 0;
+    serial();
+#pragma omp flush
+#pragma omp atomic write seq_cst
+    sense_ = sense;
+  }
+
+  void spin(int sense) {
+    int s;
+    for (int i = 0;; ++i) {
+#pragma omp atomic read seq_cst
+      s = sense_;
+      if (s == sense) break;
+      backoff(i);
+    }
+#pragma omp flush
+  }
+
+  //! Gives up the core after a while in case threads are oversubscribed.
+  static void backoff(int i) {
+    if (i >= YIELD_COUNT) {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    } else if (i >= SPIN_COUNT) {
+      std::this_thread::yield();
+    }
+  }
+
+  enum { SPIN_COUNT = 1024, YIELD_COUNT = 2048 };
+
+ private:
+  struct Local {
+    int sense;
+    int value;
+    char pad[SPRAY_L1_CACHE_LINE_SIZE - 2 * sizeof(int)];
+  };
+
+  int num_threads_;
+  int count_;
+  int sense_;
+  int results_[2];
+  std::vector<Local> locals_;
+};
+
+}  // namespace spray
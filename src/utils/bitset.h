@@ -0,0 +1,143 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace spray {
+
+/**
+ * A flat bitset with word-level queries.
+ *
+ * Used as an occupancy map next to per-domain multi-queues, so that emptiness
+ * checks cost O(words) and domain loops only visit set bits.
+ */
+class OccupancyBitset {
+ public:
+  typedef uint64_t Word;
+  enum { WORD_BITS = 64 };
+
+  OccupancyBitset() : size_(0) {}
+
+  void resize(int size) {
+    size_ = size;
+    words_.resize(numWords(size));
+    clear();
+  }
+
+  int size() const { return size_; }
+  std::size_t getNumWords() const { return words_.size(); }
+
+  void clear() {
+    for (auto& w : words_) w = 0;
+  }
+
+  void set(int i) {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(i, size_);
+#endif
+    words_[wordIndex(i)] |= bitMask(i);
+  }
+
+  //! Thread-safe version of set() for bitsets shared by threads.
+  void setAtomic(int i) {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(i, size_);
+#endif
+    Word& w = words_[wordIndex(i)];
+    Word mask = bitMask(i);
+#pragma omp atomic
+    w |= mask;
+  }
+
+  void reset(int i) {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(i, size_);
+#endif
+    words_[wordIndex(i)] &= ~bitMask(i);
+  }
+
+  //! Clears the given word. Each word can be cleared by a different thread.
+  void resetWord(std::size_t w) { words_[w] = 0; }
+
+  bool test(int i) const {
+#ifdef SPRAY_GLOG_CHECK
+    CHECK_LT(i, size_);
+#endif
+    return (words_[wordIndex(i)] & bitMask(i)) != 0;
+  }
+
+  bool none() const {
+    for (auto w : words_) {
+      if (w) return false;
+    }
+    return true;
+  }
+
+  bool any() const { return !none(); }
+
+  std::size_t count() const {
+    std::size_t c = 0;
+    for (auto w : words_) c += __builtin_popcountll(w);
+    return c;
+  }
+
+  /**
+   * Finds the first set bit at or after the given position.
+   *
+   * \param i A starting position.
+   * \return The position of the set bit. size() if there is none.
+   */
+  int findNext(int i) const {
+    if (i >= size_) return size_;
+
+    std::size_t wi = wordIndex(i);
+    Word w = words_[wi] & (~(Word)0 << (i & (WORD_BITS - 1)));
+
+    while (true) {
+      if (w) {
+        int pos = (int)(wi * WORD_BITS) + __builtin_ctzll(w);
+        return pos < size_ ? pos : size_;
+      }
+      if (++wi == words_.size()) break;
+      w = words_[wi];
+    }
+    return size_;
+  }
+
+  int findFirst() const { return findNext(0); }
+
+ private:
+  static std::size_t numWords(int size) {
+    return ((std::size_t)size + WORD_BITS - 1) / WORD_BITS;
+  }
+  static std::size_t wordIndex(int i) { return (std::size_t)i / WORD_BITS; }
+  static Word bitMask(int i) { return (Word)1 << (i & (WORD_BITS - 1)); }
+
+ private:
+  std::vector<Word> words_;
+  int size_;
+};
+
+}  // namespace spray
@@ -0,0 +1,77 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#include "utils/hw_counter.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace spray {
+namespace hw {
+
+int openDtlbMissCounter() {
+#if defined(__linux__)
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  // pid 0 and cpu -1: the calling thread on any cpu.
+  long fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  return fd < 0 ? -1 : (int)fd;
+#else
+  return -1;
+#endif
+}
+
+void resetCounter(int fd) {
+#if defined(__linux__)
+  if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+#endif
+}
+
+uint64_t readCounter(int fd) {
+#if defined(__linux__)
+  uint64_t count;
+  if (fd >= 0 && read(fd, &count, sizeof(count)) == sizeof(count)) {
+    return count;
+  }
+#endif
+  return 0;
+}
+
+void closeCounter(int fd) {
+#if defined(__linux__)
+  if (fd >= 0) close(fd);
+#endif
+}
+
+}  // namespace hw
+}  // namespace spray
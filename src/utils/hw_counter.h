@@ -0,0 +1,49 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#pragma once
+
+#include <cstdint>
+
+namespace spray {
+namespace hw {
+
+/**
+ * Opens a data TLB load miss counter for the calling thread.
+ *
+ * The counter starts running immediately and only counts events of the
+ * calling thread, so open one per OpenMP thread from inside a parallel region.
+ *
+ * \return A counter handle. -1 if hardware counters are unavailable (e.g. a
+ *         non-Linux host or a restrictive perf_event_paranoid setting).
+ */
+int openDtlbMissCounter();
+
+//! Zeroes a counter. Ignores invalid handles.
+void resetCounter(int fd);
+
+//! Reads a counter. Returns 0 for invalid handles.
+uint64_t readCounter(int fd);
+
+//! Closes a counter. Ignores invalid handles.
+void closeCounter(int fd);
+
+}  // namespace hw
+}  // namespace spray
@@ -85,5 +85,10 @@ inline float maxComponent(const glm::vec3 v) {
   return glm::max(glm::max(v.x, v.y), v.z);
 }
 
+//! Rec. 709 luminance of a linear RGB value.
+inline float luminance(const glm::vec3& c) {
+  return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
 }  // namespace spray
 
@@ -0,0 +1,71 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#include "utils/numa.h"
+
+#include <omp.h>
+#include <unistd.h>
+#include <cstdint>
+
+#include "glog/logging.h"
+
+namespace spray {
+namespace numa {
+
+void firstTouch(void* ptr, std::size_t bytes, bool interleave) {
+  if (ptr == nullptr || bytes == 0) return;
+
+  const std::size_t page_size = (std::size_t)sysconf(_SC_PAGESIZE);
+
+  uint8_t* begin = (uint8_t*)ptr;
+  uint8_t* end = begin + bytes;
+
+  // the partial page in front of the first page boundary stays with the
+  // calling thread. only bytes inside the buffer are written.
+  *begin = 0;
+
+  const uintptr_t page_mask = ~(uintptr_t)(page_size - 1);
+  uint8_t* base = (uint8_t*)(((uintptr_t)begin + page_size - 1) & page_mask);
+  if (base >= end) return;
+
+  const long num_pages = (long)((end - base + page_size - 1) / page_size);
+
+  if (interleave) {
+#pragma omp parallel for schedule(static, 1)
+    for (long p = 0; p < num_pages; ++p) {
+      base[(std::size_t)p * page_size] = 0;
+    }
+  } else {
+#pragma omp parallel for schedule(static)
+    for (long p = 0; p < num_pages; ++p) {
+      base[(std::size_t)p * page_size] = 0;
+    }
+  }
+}
+
+void checkThreadBinding() {
+  if (omp_get_max_threads() > 1 && omp_get_proc_bind() == omp_proc_bind_false) {
+    LOG(WARNING) << "OpenMP threads are not bound to places. Set OMP_PROC_BIND "
+                    "and OMP_PLACES for NUMA-local ray and mesh buffers.";
+  }
+}
+
+}  // namespace numa
+}  // namespace spray
@@ -0,0 +1,52 @@
+// ========================================================================== //
+// Copyright (c) 2017-2018 The University of Texas at Austin.                 //
+// All rights reserved.                                                       //
+//                                                                            //
+// Licensed under the Apache License, Version 2.0 (the "License");            //
+// you may not use this file except in compliance with the License.           //
+// A copy of the License is included with this software in the file LICENSE.  //
+// If your copy does not contain the License, you may obtain a copy of the    //
+// License at:                                                                //
+//                                                                            //
+//     https://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+// Unless required by applicable law or agreed to in writing, software        //
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT  //
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.           //
+// See the License for the specific language governing permissions and        //
+// limitations under the License.                                             //
+//                                                                            //
+// ========================================================================== //
+
+#pragma once
+
+#include <cstddef>
+
+namespace spray {
+namespace numa {
+
+/**
+ * Places the pages of a buffer by touching them from the OpenMP threads.
+ *
+ * Linux backs a page on the NUMA node of the thread that first writes it, so
+ * large buffers that are allocated and filled by the main thread end up on a
+ * single socket. Call this right after allocation, before any other write.
+ *
+ * \param ptr Start of the buffer.
+ * \param bytes Size of the buffer in bytes.
+ * \param interleave If true, pages are dealt round-robin to the threads, which
+ *        spreads buffers that every thread reads evenly across the sockets.
+ *        Otherwise, each thread touches one contiguous range of pages.
+ */
+void firstTouch(void* ptr, std::size_t bytes, bool interleave);
+
+/**
+ * Warns if OpenMP threads are not bound to places. First-touch placement only
+ * helps if a thread stays on the socket where it touched its pages, so run
+ * with OMP_PROC_BIND and OMP_PLACES set (e.g. OMP_PROC_BIND=spread,
+ * OMP_PLACES=cores).
+ */
+void checkThreadBinding();
+
+}  // namespace numa
+}  // namespace spray
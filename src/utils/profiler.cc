@@ -21,6 +21,7 @@
 #include "utils/profiler.h"
 
 #include <mpi.h>
+#include <omp.h>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -29,8 +30,10 @@
 
 #include "glog/logging.h"
 
+#include "pbrt/memory.h"
 #include "render/spray.h"
 #include "utils/comm.h"
+#include "utils/hw_counter.h"
 
 namespace spray {
 
@@ -42,7 +45,37 @@ std::map<int, std::string> Profiler::timer_names = {
 std::map<int, std::string> Profiler::counter_names = {
     {COUNTER_RAYS_SENT, "rays_sent"},
     {COUNTER_RAYS_SPAWNED, "rays_spawned"},
-    {COUNTER_RAYS_TESTED, "rays_tested"}};
+    {COUNTER_RAYS_TESTED, "rays_tested"},
+    {COUNTER_RAY_BYTES_SENT, "ray_bytes_sent"},
+    {COUNTER_RAY_MEM, "ray_mem_hwm"},
+    {COUNTER_DTLB_MISSES, "dtlb_misses"},
+    {COUNTER_HUGE_PAGE_BYTES, "huge_page_bytes"},
+    {COUNTER_MSG_BUFFERS_REUSED, "msg_buffers_reused"},
+    {COUNTER_MSG_BUFFERS_ALLOCATED, "msg_buffers_allocated"}};
+
+void Profiler::openHwCounters(int nthreads) {
+  for (int fd : hw_counters_) hw::closeCounter(fd);
+  hw_counters_.assign(nthreads, -1);
+
+#pragma omp parallel num_threads(nthreads)
+  { hw_counters_[omp_get_thread_num()] = hw::openDtlbMissCounter(); }
+
+  if (hw_counters_[0] < 0) {
+    LOG(WARNING) << "hardware counters unavailable. dtlb_misses stays zero. "
+                    "check /proc/sys/kernel/perf_event_paranoid.";
+  }
+}
+
+void Profiler::resetHwCounters() {
+  for (int fd : hw_counters_) hw::resetCounter(fd);
+}
+
+void Profiler::sampleMemCounters() {
+  uint64_t misses = 0;
+  for (int fd : hw_counters_) misses += hw::readCounter(fd);
+  counters_[COUNTER_DTLB_MISSES] = misses;
+  counters_[COUNTER_HUGE_PAGE_BYTES] = getHugePageBytes();
+}
 
 void Profiler::aggStats(int rank, const double* timers,
                         std::vector<Stats>* stats) {
@@ -45,6 +45,12 @@ enum CounterNames {
   COUNTER_RAYS_SENT = 0,
   COUNTER_RAYS_SPAWNED,
   COUNTER_RAYS_TESTED,
+  COUNTER_RAY_BYTES_SENT,
+  COUNTER_RAY_MEM,
+  COUNTER_DTLB_MISSES,
+  COUNTER_HUGE_PAGE_BYTES,
+  COUNTER_MSG_BUFFERS_REUSED,
+  COUNTER_MSG_BUFFERS_ALLOCATED,
   COUNTER_COUNT
 };
 
@@ -102,12 +108,23 @@ class Profiler {
     reset();
   }
 
+  /**
+   * Opens one data TLB miss counter per OpenMP thread. The counts are summed
+   * into COUNTER_DTLB_MISSES whenever TIMER_TOTAL stops.
+   *
+   * \param nthreads Number of threads of the tracer's parallel regions.
+   */
+  void openHwCounters(int nthreads);
+
   //! Synchronizes all the measured values across the cluster and prints them on
   //! screen.
   void print(int64_t nframes);
 
   void start(int timer) { timers_[timer].start(); }
-  void stop(int timer) { timers_[timer].stop(); }
+  void stop(int timer) {
+    timers_[timer].stop();
+    if (timer == TIMER_TOTAL) sampleMemCounters();
+  }
 
   void agg(int counter, uint64_t v) { counters_[counter] += v; }
 
@@ -121,9 +138,13 @@ class Profiler {
     for (auto& c : counters_) {
       c = 0;
     }
+    resetHwCounters();
   }
 
  private:
+  void resetHwCounters();
+  void sampleMemCounters();
+
   void printTimers(int rank, const double* timers, int64_t nframes);
   void printCounters(int rank, const uint64_t* counters, int64_t nframes);
   void printStats(const std::vector<Stats>& stats, int64_t nframes);
@@ -136,6 +157,7 @@ class Profiler {
 
   std::vector<Timer> timers_;
   std::vector<uint64_t> counters_;
+  std::vector<int> hw_counters_;  // per-thread dtlb miss counters
 };
 
 }  // namespace spray